@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "binary.h"
+#include "executor.h"
+
+#define BIN_MAGIC "BUXCMD"
+#define BIN_BYTE_ORDER 0x01020304u
+#define BIN_STDOUT_BUFFER (1 << 20)
+
+static size_t pad8(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write record, followed by text (if not NULL) as its payload.
+*/
+static int write_record(FILE *file, struct bin_record *record, const char *text) {
+    static const char zeros[8];
+    size_t size = text != NULL ? strlen(text) + 1 : 0;
+
+    record->length = (uint32_t) pad8(size);
+    if (fwrite(record, sizeof(*record), 1, file) != 1 ||
+        (text != NULL && fwrite(text, 1, size, file) != size) ||
+        fwrite(zeros, 1, record->length - size, file) != record->length - size) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Names seen so far while compiling, each mapped to its number + 1.
+*/
+struct name_table {
+	HTable numbers;
+	Arena strings;			// The names, which the table's keys point to
+	uint32_t count;
+};
+
+/* Return the number of name, writing a BIN_NAME record for it first if this
+* is the first time it has come up. Returns BIN_NO_NAME if the record cannot
+* be written.
+*/
+static uint32_t name_number(FILE *file, struct name_table *names, const char *name) {
+    uintptr_t item = (uintptr_t) ht_get(&names->numbers, name);
+    if (item != 0) {
+        return (uint32_t) (item - 1);
+    }
+
+    struct bin_record record;
+    memset(&record, 0, sizeof(record));
+    record.op = BIN_NAME;
+    record.group = record.user = BIN_NO_NAME;
+    if (write_record(file, &record, name) == -1) {
+        return BIN_NO_NAME;
+    }
+    ht_put(&names->numbers, arena_strdup(&names->strings, name), (void *) (uintptr_t) (names->count + 1));
+    return names->count++;
+}
+
+/* Write the binary form of one line of text. Lines that parse as a command
+* become a command record; anything else, including commands with more
+* arguments than a record holds (see command_record_argc), is kept as text. Returns 1, or 0
+* for a blank line, which needs no record, or -1 if the file cannot be
+* written.
+*/
+static int compile_line(FILE *file, struct name_table *names, char *line, size_t length) {
+    char *cmd_argv[INPUT_ARG_MAX_NUM];
+    struct command_args args;
+    struct bin_record record;
+
+    // Tokenizing writes NULs into the line, so keep it whole for a text record
+    char text[length + 1];
+    memcpy(text, line, length);
+    text[length] = '\0';
+
+    int cmd_argc = tokenize_line(line, line + length, cmd_argv);
+    if (cmd_argc == 0) {
+        return 0; // Blank lines do nothing
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.group = record.user = BIN_NO_NAME;
+    if (cmd_argc == -1 || command_parse(cmd_argc, cmd_argv, &args) == -1 || args.value_error != 0 ||
+        cmd_argc > command_record_argc(args.op)) {
+        record.op = BIN_TEXT;
+        return write_record(file, &record, text) == -1 ? -1 : 1;
+    }
+
+    record.op = (uint8_t) args.op;
+    record.value = args.value;
+    if (args.group != NULL && (record.group = name_number(file, names, args.group)) == BIN_NO_NAME) {
+        return -1;
+    }
+    if (args.user != NULL && (record.user = name_number(file, names, args.user)) == BIN_NO_NAME) {
+        return -1;
+    }
+    return write_record(file, &record, NULL) == -1 ? -1 : 1;
+}
+
+/* Compile the batch file at text_path into a binary command file at
+* binary_path. Sets *lines (if not NULL) to the number of non-blank lines.
+* Returns 0 on success and -1 if either file cannot be read or written.
+*/
+int binary_compile(const char *text_path, const char *binary_path, size_t *lines) {
+    FILE *in = fopen(text_path, "r");
+    if (in == NULL) {
+        return -1;
+    }
+    FILE *out = fopen(binary_path, "wb");
+    if (out == NULL) {
+        fclose(in);
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, BIN_STDOUT_BUFFER);
+
+    struct name_table names;
+    ht_init(&names.numbers);
+    arena_init(&names.strings);
+    names.count = 0;
+
+    struct bin_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BIN_MAGIC, sizeof(BIN_MAGIC));
+    header.version = BIN_VERSION;
+    header.byte_order = BIN_BYTE_ORDER;
+    int result = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    size_t count = 0;
+    while (result != -1 && (length = getline(&line, &capacity, in)) != -1) {
+        // getline leaves a NUL after the line, which the tokenizer may overwrite
+        if (length > 0 && line[length - 1] == '\n') {
+            length--;
+        }
+        result = compile_line(out, &names, line, length);
+        count += result == 1;
+    }
+
+    free(line);
+    fclose(in);
+    if (fclose(out) != 0) {
+        result = -1;
+    }
+    ht_free(&names.numbers);
+    arena_release(&names.strings);
+    if (lines != NULL) {
+        *lines = count;
+    }
+    return result == -1 ? -1 : 0;
+}
+
+/* Check that the records of a binary command file are well formed: every
+* payload is inside the file and NUL terminated, every opcode exists and
+* every command has the arguments it needs. Returns 0 if so and -1 if not.
+*/
+static int validate(const char *data, size_t size) {
+    size_t offset = sizeof(struct bin_header);
+    uint32_t name_count = 0;
+
+    while (offset < size) {
+        struct bin_record record;
+        if (size - offset < sizeof(record)) {
+            return -1;
+        }
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+        const char *payload = data + offset;
+        if (record.length > size - offset || record.length % 8 != 0) {
+            return -1;
+        }
+        offset += record.length;
+
+        if (record.op == BIN_NAME || record.op == BIN_TEXT) {
+            if (record.length == 0 || payload[record.length - 1] != '\0') {
+                return -1;
+            }
+            name_count += record.op == BIN_NAME;
+            continue;
+        }
+        if (record.op >= OP_COUNT || record.length != 0) {
+            return -1;
+        }
+
+        const struct command *command = &commands[record.op];
+        int has_group = record.group != BIN_NO_NAME;
+        int has_user = record.user != BIN_NO_NAME;
+        int has_value = (command->flags & (CMD_CENTS | CMD_COUNT)) != 0;
+        int argc = 1 + has_group + has_user + has_value;
+        if ((has_group && record.group >= name_count) || (has_user && record.user >= name_count) ||
+            has_user != ((command->flags & CMD_USER) != 0) || (has_user && !has_group) ||
+            argc < command->min_argc || argc > command->max_argc) {
+            return -1;
+        }
+        if ((command->flags & CMD_CENTS) && (record.value < -XCT_MAX_CENTS || record.value > XCT_MAX_CENTS)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* A name from the file, and the group of that name once one has been found.
+*/
+struct bin_name {
+	const char *name;
+	Group *group;
+};
+
+/* Run the text line of a BIN_TEXT record, as ingest would, counting it in
+* *count. Sets *loaded if it was a load. Returns -1 for quit.
+*/
+static int run_text(const char *text, char **scratch, size_t *scratch_capacity, size_t *count,
+                    int *loaded, Group **group_list_addr) {
+    char *cmd_argv[INPUT_ARG_MAX_NUM];
+    size_t length = strlen(text);
+
+    if (length + 1 > *scratch_capacity) {
+        *scratch_capacity = length + 1;
+        *scratch = realloc(*scratch, *scratch_capacity);
+        if (*scratch == NULL) {
+            perror("Error allocating memory for text command. Exiting...");
+            exit(1);
+        }
+    }
+    memcpy(*scratch, text, length + 1); // The NUL is the spare byte tokenize_line needs
+
+    int cmd_argc = tokenize_line(*scratch, *scratch + length, cmd_argv);
+    int result = 0;
+    executor_begin();
+    if (cmd_argc == -1) {
+        error("Too many arguments!");
+    } else if (cmd_argc > 0) {
+        (*count)++;
+        *loaded = command_lookup(cmd_argv[0], cmd_argc) == OP_LOAD;
+        result = execute(cmd_argc, cmd_argv, group_list_addr);
+    }
+    executor_end();
+    return result;
+}
+
+/* Run a command record, counting it in *count. Returns -1 for quit.
+*/
+static int run_record(const struct bin_record *record, struct bin_name *names, size_t *count,
+                      Group **group_list_addr) {
+    int flags = commands[record->op].flags;
+    struct command_args args;
+
+    args.op = record->op;
+    args.group = record->group != BIN_NO_NAME ? names[record->group].name : NULL;
+    args.user = record->user != BIN_NO_NAME ? names[record->user].name : NULL;
+    args.argc = 1 + (args.group != NULL) + (args.user != NULL) + ((flags & (CMD_CENTS | CMD_COUNT)) != 0);
+    args.value = record->value;
+    args.value_error = 0;
+    args.time = XCT_TIME_NOW;
+    args.time_error = 0;
+    args.argv = NULL;
+    args.target = NULL;
+    if (flags & CMD_GROUP) {
+        // Groups only go away on load, so a group once found stays valid until then
+        struct bin_name *group_name = &names[record->group];
+        if (group_name->group == NULL) {
+            group_name->group = find_group(*group_list_addr, group_name->name);
+        }
+        args.target = group_name->group;
+    }
+
+    (*count)++;
+    executor_begin();
+    int result = execute_command(&args, group_list_addr);
+    executor_end();
+    return result;
+}
+
+/* Run every command in the binary command file at path against the groups
+* at group_list_addr, stopping early at quit. Fills in stats (which may be
+* NULL). Returns 0, -1 if the file cannot be read and -2 if it is not a valid
+* binary command file, in which case nothing has been run.
+*/
+int binary_run(const char *path, Group **group_list_addr, struct ingest_stats *stats) {
+    struct stat st;
+    double started = now_seconds();
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t) sizeof(struct bin_header)) {
+        close(fd);
+        return -2;
+    }
+    size_t size = (size_t) st.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+
+    struct bin_header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, BIN_MAGIC, sizeof(BIN_MAGIC)) != 0 || header.version != BIN_VERSION ||
+        header.byte_order != BIN_BYTE_ORDER || validate(data, size) == -1) {
+        munmap((void *) data, size);
+        return -2;
+    }
+
+    setvbuf(stdout, NULL, _IOFBF, BIN_STDOUT_BUFFER);
+
+    struct bin_name *names = NULL;
+    size_t name_count = 0, name_capacity = 0;
+    char *scratch = NULL;
+    size_t scratch_capacity = 0;
+    size_t count = 0;
+    size_t offset = sizeof(header);
+    int quit = 0;
+
+    while (offset < size && !quit) {
+        struct bin_record record;
+        memcpy(&record, data + offset, sizeof(record));
+        const char *payload = data + offset + sizeof(record);
+        offset += sizeof(record) + record.length;
+
+        if (record.op == BIN_NAME) {
+            if (name_count == name_capacity) {
+                name_capacity = name_capacity == 0 ? 64 : name_capacity * 2;
+                names = realloc(names, name_capacity * sizeof(struct bin_name));
+                if (names == NULL) {
+                    perror("Error allocating memory for command names. Exiting...");
+                    exit(1);
+                }
+            }
+            names[name_count].name = payload;
+            names[name_count].group = NULL;
+            name_count++;
+            continue;
+        }
+        int loaded = record.op == OP_LOAD;
+        if (record.op == BIN_TEXT) {
+            quit = run_text(payload, &scratch, &scratch_capacity, &count, &loaded, group_list_addr) == -1;
+        } else {
+            quit = run_record(&record, names, &count, group_list_addr) == -1;
+        }
+        if (loaded) {
+            // The groups found so far are gone
+            for (size_t i = 0; i < name_count; i++) {
+                names[i].group = NULL;
+            }
+        }
+    }
+
+    fflush(stdout);
+    if (stats != NULL) {
+        stats->commands = count;
+        stats->bytes = offset;
+        stats->seconds = now_seconds() - started;
+    }
+    free(names);
+    free(scratch);
+    munmap((void *) data, size);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include "ingest.h"
+
+/* Binary command files: batch files compiled ahead of time, so that running
+* them needs no tokenizing, no command name lookup and no number parsing.
+*
+* After a header, the file is a sequence of records. Each is a fixed
+* struct bin_record, followed by length bytes of payload:
+*   BIN_NAME  defines the next name number; the payload is the name.
+*   BIN_TEXT  a line that has no binary form (a syntax error, say); the
+*             payload is the line, which runs exactly as text would.
+*   opcode    a command from the command table, with its group and user as
+*             name numbers and its number already parsed.
+* Payloads are NUL terminated and padded to 8 bytes.
+*
+* Running a compiled file behaves exactly like --ingest of the original.
+*/
+
+#define BIN_VERSION 1
+#define BIN_NAME 0xfe
+#define BIN_TEXT 0xff
+#define BIN_NO_NAME UINT32_MAX
+
+struct bin_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;		// Files are only read on machines of the same endianness
+};
+
+struct bin_record {
+	uint32_t length;		// Bytes of payload after the record
+	uint8_t op;			// An opcode, BIN_NAME or BIN_TEXT
+	uint8_t padding[3];
+	uint32_t group;			// Name number of the first argument, or BIN_NO_NAME
+	uint32_t user;			// Name number of the user, or BIN_NO_NAME
+	int64_t value;			// Cents or count, for commands that take a number
+};
+
+int binary_compile(const char *text_path, const char *binary_path, size_t *commands);
+int binary_run(const char *path, Group **group_list_addr, struct ingest_stats *stats);
+
+#endif
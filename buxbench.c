@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "columns.h"
+#include "output.h"
+#include "workload.h"
+
+/* Benchmark harness for the ledger itself. It runs a synthetic workload (see
+* workload.h) by calling the functions in lists.c directly, so no parsing or
+* I/O is measured, and times every command. The workload is cut into phases
+* that end as the transaction count reaches 0.1%, 1%, 10% and 100% of --xcts
+* (the setup is a phase of its own), so each command's cost can be followed
+* as the data grows.
+*
+* Results go to --out (standard output by default) as JSON lines: first one
+* describing the run, then one per command per phase. A table of the same
+* results goes to standard error.
+*/
+
+#define BENCH_PHASES 4			// Phases after setup, each ten times the data of the last
+#define BENCH_NAME_SIZE 16
+
+#ifndef BENCH_BUILD_FLAGS
+#define BENCH_BUILD_FLAGS "unknown"	// The Makefile passes the flags the benchmark was built with
+#endif
+
+struct samples {
+	uint64_t *ns;
+	size_t count;
+	size_t capacity;
+};
+
+static struct samples samples[OP_COUNT];
+static OutBuf sink;			// Command output, thrown away after every command
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record(int op, uint64_t ns) {
+    struct samples *s = &samples[op];
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity == 0 ? 1024 : s->capacity * 2;
+        s->ns = realloc(s->ns, s->capacity * sizeof(uint64_t));
+        if (s->ns == NULL) {
+            perror("Error allocating memory for samples. Exiting...");
+            exit(1);
+        }
+    }
+    s->ns[s->count++] = ns;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const struct samples *s, double fraction) {
+    size_t index = (size_t) (s->count * fraction);
+    return s->ns[index < s->count ? index : s->count - 1];
+}
+
+/* Run op against the groups, the way process_group_command would.
+*/
+static void run(const struct workload_op *op, Group **group_list, Group **groups,
+                char (*group_names)[BENCH_NAME_SIZE], char (*user_names)[BENCH_NAME_SIZE]) {
+    Group *g = groups[op->group];
+    const char *user = op->user >= 0 ? user_names[op->user] : NULL;
+
+    switch (op->op) {
+    case OP_ADD_GROUP:
+        add_group(group_list, group_names[op->group]);
+        groups[op->group] = find_group(*group_list, group_names[op->group]);
+        break;
+    case OP_ADD_USER:
+        add_user(g, user);
+        break;
+    case OP_REMOVE_USER:
+        remove_user(g, user);
+        break;
+    case OP_LIST_USERS:
+        list_users(g, SIZE_MAX, 0);
+        break;
+    case OP_USER_BALANCE:
+        user_balance(g, user);
+        break;
+    case OP_UNDER_PAID:
+        under_paid(g);
+        break;
+    case OP_ADD_XCT:
+        add_xct(g, user, op->value, xct_now(g));
+        break;
+    case OP_RANK:
+        rank_user(g, user);
+        break;
+    case OP_TOP_PAID:
+        top_paid(g, op->value);
+        break;
+    case OP_RECENT_XCT:
+        recent_xct(g, op->value);
+        break;
+    case OP_USER_XCT:
+        user_xct(g, user, op->value);
+        break;
+    case OP_GROUP_TOTAL:
+        group_total(g);
+        break;
+    case OP_USER_TOTAL:
+        user_total(g, user);
+        break;
+    case OP_RECOMPUTE_BALANCES:
+        recompute_balances(g);
+        break;
+    case OP_SETTLE:
+        settle(g, 0, XCT_TIME_NOW);
+        break;
+    case OP_SETTLE_APPLY:
+        settle(g, 1, xct_now(g));
+        break;
+    case OP_GROUP_SUMMARY:
+        group_summary(g);
+        break;
+    case OP_FAIR_SHARE:
+        fair_share(g, user);
+        break;
+    }
+}
+
+/* Report and forget the samples of one phase.
+*/
+static void report(FILE *out, int phase, Group *group_list) {
+    size_t rows = 0, live = 0, users = 0;
+    for (Group *g = group_list; g != NULL; g = g->next) {
+        rows += g->xct_rows;
+        live += g->xct_live;
+        users += g->user_count;
+    }
+
+    fprintf(stderr, "Phase %d: %zu transactions (%zu live), %zu users\n", phase, rows, live, users);
+    fprintf(stderr, "  %-20s %10s %12s %10s %10s %10s %10s\n", "command", "count", "ops/sec",
+            "p50 ns", "p99 ns", "p999 ns", "max ns");
+    for (int op = 0; op < OP_COUNT; op++) {
+        struct samples *s = &samples[op];
+        if (s->count == 0) {
+            continue;
+        }
+        uint64_t total = 0;
+        for (size_t i = 0; i < s->count; i++) {
+            total += s->ns[i];
+        }
+        qsort(s->ns, s->count, sizeof(uint64_t), compare_ns);
+        double ops_per_sec = total > 0 ? s->count * 1e9 / total : 0.0;
+        uint64_t p50 = percentile(s, 0.5), p99 = percentile(s, 0.99), p999 = percentile(s, 0.999);
+        uint64_t max = s->ns[s->count - 1];
+
+        fprintf(out, "{\"phase\":%d,\"rows\":%zu,\"live_rows\":%zu,\"users\":%zu,\"command\":\"%s\","
+                "\"count\":%zu,\"ops_per_sec\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+                "\"max_ns\":%llu}\n", phase, rows, live, users, commands[op].name, s->count, ops_per_sec,
+                (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) p999,
+                (unsigned long long) max);
+        fprintf(stderr, "  %-20s %10zu %12.0f %10llu %10llu %10llu %10llu\n", commands[op].name, s->count,
+                ops_per_sec, (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) p999,
+                (unsigned long long) max);
+        s->count = 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct workload w;
+    struct workload_op op;
+    const char *out_path = NULL;
+
+    workload_init(&w);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (workload_option(&w, argc, argv, &i) != 1) {
+            fprintf(stderr, "Usage: %s [--out <file>] ", argv[0]);
+            workload_usage(stderr);
+            fprintf(stderr, "\n");
+            exit(1);
+        }
+    }
+    FILE *out = out_path != NULL ? fopen(out_path, "w") : stdout;
+    if (out == NULL) {
+        perror("Error opening output file");
+        exit(1);
+    }
+
+    Group *group_list = NULL;
+    Group **groups = calloc(w.groups, sizeof(Group *));
+    char (*group_names)[BENCH_NAME_SIZE] = malloc(w.groups * sizeof(*group_names));
+    char (*user_names)[BENCH_NAME_SIZE] = malloc(w.users * sizeof(*user_names));
+    if (groups == NULL || group_names == NULL || user_names == NULL) {
+        perror("Error allocating memory for benchmark. Exiting...");
+        exit(1);
+    }
+    for (int g = 0; g < w.groups; g++) {
+        snprintf(group_names[g], BENCH_NAME_SIZE, "g%d", g);
+    }
+    for (int u = 0; u < w.users; u++) {
+        snprintf(user_names[u], BENCH_NAME_SIZE, "u%d", u);
+    }
+
+    fprintf(out, "{\"benchmark\":\"buxfer\",\"groups\":%d,\"users\":%d,\"xcts\":%ld,\"skew\":%g,"
+            "\"seed\":%llu,\"kernels\":\"%s\",\"cflags\":\"%s\",\"mix\":\"", w.groups, w.users, w.xcts, w.skew,
+            (unsigned long long) w.seed, col_kernel_name(), BENCH_BUILD_FLAGS);
+    workload_print_mix(&w, out);
+    fprintf(out, "\"}\n");
+
+    // Phase ends: setup, then 0.1%, 1%, 10% and 100% of the transactions
+    long ends[BENCH_PHASES + 1];
+    ends[0] = 0;
+    for (int p = BENCH_PHASES, divisor = 1; p >= 1; p--, divisor *= 10) {
+        ends[p] = w.xcts / divisor;
+    }
+    int phase = 0;
+
+    workload_start(&w);
+    out_capture(&sink);
+    while (workload_next(&w, &op)) {
+        uint64_t started = now_ns();
+        run(&op, &group_list, groups, group_names, user_names);
+        record(op.op, now_ns() - started);
+        out_reset(&sink);
+
+        // The last add_xct of a phase may leave a user to put back first
+        while (phase <= BENCH_PHASES && w.setup_done == (long) w.groups * (w.users + 1) &&
+               w.xcts_done >= ends[phase] && w.readd_group < 0) {
+            out_capture(NULL);
+            report(out, phase, group_list);
+            out_capture(&sink);
+            phase++;
+        }
+    }
+    out_capture(NULL);
+
+    free_groups(group_list);
+    intern_release();
+    out_free(&sink);
+    for (int i = 0; i < OP_COUNT; i++) {
+        free(samples[i].ns);
+    }
+    workload_free(&w);
+    free(groups);
+    free(group_names);
+    free(user_names);
+    return fclose(out) == 0 ? 0 : 1;
+}
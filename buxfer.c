@@ -1,112 +1,507 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "binary.h"
+#include "commands.h"
+#include "directory.h"
 #include "lists.h"
+#include "memory.h"
+#include "output.h"
+#include "server.h"
+#include "executor.h"
+#include "ingest.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
+#include "wal.h"
 
-#define INPUT_BUFFER_SIZE 256
-#define INPUT_ARG_MAX_NUM 5
+#define INPUT_BUFFER_SIZE (64 * 1024)	// Room for a bulk command with every argument it can take
 #define DELIM " \n"
 
 
 /* A standard template for error messages */
 void error(const char *msg) {
-    fprintf(stderr, "Error: %s\n", msg);
+    out_eprintf("Error: %s\n", msg);
+    stats_add(STAT_ERRORS, 1);
+}
+
+/* Spell out a binary command as the equivalent text in cmd_argv, using
+* amount to hold its number. Returns the argument count.
+*/
+static int spell_command(const struct command_args *args, char **cmd_argv, char *amount) {
+    int cmd_argc = 0;
+    cmd_argv[cmd_argc++] = (char *) commands[args->op].name;
+    cmd_argv[cmd_argc++] = (char *) args->group;
+    if (args->user != NULL) {
+        cmd_argv[cmd_argc++] = (char *) args->user;
+    }
+    if (commands[args->op].flags & CMD_CENTS) {
+        cmd_argv[cmd_argc++] = format_cents(args->value, amount);
+    }
+    return cmd_argc;
+}
+
+/* Log a command that has just changed state. Text commands are logged as
+* they were typed; binary ones are spelled out as the equivalent text.
+*/
+static void log_command(const struct command_args *args) {
+    if (args->argv != NULL) {
+        wal_append(args->argc, args->argv);
+        return;
+    }
+    if (!wal_enabled()) {
+        return;
+    }
+    char amount[CENTS_BUFFER];
+    char *cmd_argv[INPUT_ARG_MAX_NUM];
+    int cmd_argc = spell_command(args, cmd_argv, amount);
+    cmd_argv[cmd_argc] = NULL;
+    wal_append(cmd_argc, cmd_argv);
+}
+
+/* Log a command that has just posted transactions stamped with time. One
+* that was given no time is logged with the time it used, so that replaying
+* the log stamps every transaction the same way again.
+*/
+static void log_stamped(const struct command_args *args, int64_t time) {
+    if (args->time != XCT_TIME_NOW) {
+        log_command(args);
+        return;
+    }
+    if (!wal_enabled()) {
+        return;
+    }
+    char amount[CENTS_BUFFER];
+    char stamp[TIME_BUFFER];
+    char *cmd_argv[INPUT_ARG_MAX_NUM];
+    int cmd_argc;
+    if (args->argv != NULL) {
+        memcpy(cmd_argv, args->argv, args->argc * sizeof(char *));
+        cmd_argc = args->argc;
+    } else {
+        cmd_argc = spell_command(args, cmd_argv, amount);
+    }
+    snprintf(stamp, sizeof(stamp), "%lld", (long long) time);
+    cmd_argv[cmd_argc++] = stamp;
+    cmd_argv[cmd_argc] = NULL;
+    wal_append(cmd_argc, cmd_argv);
+}
+
+/* Report a command refused by mem_admit, given what it returned. Returns
+* whether it was refused.
+*/
+static int over_budget(int admit) {
+    if (admit == MEM_OVER_GROUP) {
+        error("Group memory budget exceeded");
+    } else if (admit == MEM_OVER_TOTAL) {
+        error("Memory budget exceeded");
+    }
+    return admit != 0;
+}
+
+/* Parse the count and cursor of a page of a listing of total items, either
+* of which may be NULL to list everything from the start. Returns 0, or
+* reports the error and returns -1.
+*/
+static int parse_page(const char *count_text, const char *cursor_text, size_t total, size_t *count, size_t *cursor) {
+    char *end;
+    *count = SIZE_MAX;
+    *cursor = 0;
+    if (count_text != NULL) {
+        *count = strtoul(count_text, &end, 10);
+        if (end == count_text || *end != '\0' || *count_text == '-') {
+            error("Incorrect number format");
+            return -1;
+        }
+    }
+    if (cursor_text != NULL) {
+        *cursor = strtoul(cursor_text, &end, 10);
+        if (end == cursor_text || *end != '\0' || *cursor_text == '-' || *cursor > total) {
+            error("Invalid cursor");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void run_group_command(const struct command_args *args, Group *g) {
+    switch (args->op) {
+    case OP_ADD_USER:
+        if (find_user(g, args->user) != NULL) {
+            error("User already exists");
+        } else if (!over_budget(user_admit(g, 1))) {
+            add_user(g, args->user);
+            log_command(args);
+        }
+        break;
+
+    case OP_REMOVE_USER:
+        if (remove_user(g, args->user) == -1) {
+            error("User does not exist");
+        } else {
+            log_command(args);
+        }
+        break;
+
+    case OP_LIST_USERS: {
+        size_t count, cursor;
+        if (parse_page(args->argc > 2 ? args->argv[2] : NULL, args->argc > 3 ? args->argv[3] : NULL,
+                       g->user_count, &count, &cursor) == 0) {
+            list_users(g, count, cursor);
+        }
+        break;
+    }
+
+    case OP_USER_BALANCE:
+        if (user_balance(g, args->user) == -1) {
+            error("User does not exist");
+        }
+        break;
+
+    case OP_UNDER_PAID:
+        if (under_paid(g) == -1) {
+            error("User list empty");
+        }
+        break;
+
+    case OP_ADD_XCT: {
+        int64_t time = args->time != XCT_TIME_NOW ? args->time : xct_now(g);
+        if (args->value_error == -1) {
+            error("Incorrect number format");
+        } else if (args->value_error == -2) {
+            error("Amount out of range");
+        } else if (args->time_error != 0) {
+            error("Invalid time");
+        } else if (find_user(g, args->user) == NULL) {
+            error("User does not exist");
+        } else if (time < g->xct_last_time) {
+            error("Time is before the group's last transaction");
+        } else if (!over_budget(xct_admit(g, 1))) {
+            add_xct(g, args->user, args->value, time);
+            log_stamped(args, time);
+        }
+        break;
+    }
+
+    case OP_RANK:
+        if (rank_user(g, args->user) == -1) {
+            error("User does not exist");
+        }
+        break;
+
+    case OP_TOP_PAID:
+        if (args->value_error != 0) {
+            error("Incorrect number format");
+        } else {
+            top_paid(g, args->value);
+        }
+        break;
+
+    case OP_RECENT_XCT:
+        if (args->value_error != 0) {
+            error("Incorrect number format");
+        } else if (args->argc == 3) {
+            recent_xct(g, args->value);
+        } else {
+            // A cursor is a row reference, so the page starts right there
+            char *end;
+            unsigned long cursor = strtoul(args->argv[3], &end, 10);
+            if (end == args->argv[3] || *end != '\0' || cursor > g->xct_rows) {
+                error("Invalid cursor");
+            } else {
+                recent_xct_page(g, args->value, (uint32_t) cursor);
+            }
+        }
+        break;
+
+    case OP_XCT_RANGE: {
+        int64_t from, to;
+        if (parse_time(args->argv[2], &from) == -1 || parse_time(args->argv[3], &to) == -1) {
+            error("Invalid time");
+        } else {
+            xct_range(g, from, to);
+        }
+        break;
+    }
+
+    case OP_USER_XCT:
+        if (args->value_error != 0) {
+            error("Incorrect number format");
+        } else if (user_xct(g, args->user, args->value) == -1) {
+            error("User does not exist");
+        }
+        break;
+
+    case OP_GROUP_TOTAL:
+        group_total(g);
+        break;
+
+    case OP_USER_TOTAL:
+        if (user_total(g, args->user) == -1) {
+            error("User does not exist");
+        }
+        break;
+
+    case OP_RECOMPUTE_BALANCES:
+        recompute_balances(g);
+        break;
+
+    case OP_GROUP_SUMMARY:
+        group_summary(g);
+        break;
+
+    case OP_FAIR_SHARE:
+        if (fair_share(g, args->user) == -1) {
+            error("User does not exist");
+        }
+        break;
+
+    case OP_SETTLE:
+        settle(g, 0, XCT_TIME_NOW);
+        break;
+
+    case OP_SETTLE_APPLY: {
+        int64_t time = args->time != XCT_TIME_NOW ? args->time : xct_now(g);
+        if (args->time_error != 0) {
+            error("Invalid time");
+        } else if (time < g->xct_last_time) {
+            error("Time is before the group's last transaction");
+        } else if (over_budget(xct_admit(g, 2 * g->user_count))) {
+            break;	// Two rows per transfer, and fewer transfers than users
+        } else if (settle(g, 1, time) > 0) {
+            log_stamped(args, time);
+        }
+        break;
+    }
+
+    case OP_ADD_XCTS: {
+        int64_t time = args->time != XCT_TIME_NOW ? args->time : xct_now(g);
+        if (args->time_error != 0) {
+            error("Invalid time");
+            break;
+        } else if (time < g->xct_last_time) {
+            error("Time is before the group's last transaction");
+            break;
+        }
+
+        // Rows are checked in order, as separate add_xct commands would be
+        size_t rows = (args->argc - 2) / 2, count = 0;
+        User *users[rows];
+        int64_t amounts[rows];
+        char *kept[args->argc + 2];	// The command with only the rows that were posted and the time, to log
+        char stamp[TIME_BUFFER];
+        kept[0] = args->argv[0];
+        kept[1] = args->argv[1];
+        for (size_t i = 0; i < rows; i++) {
+            int result = parse_cents(args->argv[3 + 2 * i], &amounts[count]);
+            if (result == -1) {
+                error("Incorrect number format");
+            } else if (result == -2) {
+                error("Amount out of range");
+            } else if ((users[count] = find_user(g, args->argv[2 + 2 * i])) == NULL) {
+                error("User does not exist");
+            } else {
+                kept[2 + 2 * count] = args->argv[2 + 2 * i];
+                kept[3 + 2 * count] = args->argv[3 + 2 * i];
+                count++;
+            }
+        }
+        if (count > 0 && !over_budget(xct_admit(g, count))) {
+            add_xcts(g, users, amounts, count, time);
+            snprintf(stamp, sizeof(stamp), "%lld", (long long) time);
+            kept[2 + 2 * count] = stamp;
+            kept[3 + 2 * count] = NULL;
+            wal_append(3 + 2 * count, kept);
+        }
+        break;
+    }
+
+    case OP_ADD_USERS: {
+        size_t count = args->argc - 2, fresh = 0;
+        char *kept[args->argc + 1];	// The command with only the users that were added, to log
+        for (size_t i = 0; i < count; i++) {
+            fresh += find_user(g, args->argv[2 + i]) == NULL;
+        }
+        if (over_budget(user_admit(g, fresh))) {
+            break;
+        }
+        size_t added = add_users(g, args->argv + 2, count, kept + 2);
+        for (size_t i = added; i < count; i++) {
+            error("User already exists");
+        }
+        if (added > 0) {
+            kept[0] = args->argv[0];
+            kept[1] = args->argv[1];
+            kept[2 + added] = NULL;
+            wal_append(2 + added, kept);
+        }
+        break;
+    }
+    }
 }
 
 /* 
- * Read and process buxfer commands
+ * Run a group command (one with CMD_GROUP set) against the group it names,
+ * which the caller has already found
  */
-int process_args(int cmd_argc, char **cmd_argv, Group **group_list_addr) {
+void process_group_command(const struct command_args *args, Group *g) {
+    uint64_t started = stats_now();
+    run_group_command(args, g);
+    mem_settle();
+    stats_command(args->op, stats_now() - started);
+}
+
+static int run_command(const struct command_args *args, Group **group_list_addr) {
     Group *group_list = *group_list_addr; 
     Group *g;
 
-    if (cmd_argc <= 0) {
-        return 0;
-    } else if (strcmp(cmd_argv[0], "quit") == 0 && cmd_argc == 1) {
+    switch (args->op) {
+    case OP_QUIT:
         return -1;
-        
-    } else if (strcmp(cmd_argv[0], "add_group") == 0 && cmd_argc == 2) {
-        if (add_group(group_list_addr, cmd_argv[1]) == -1) {
+
+    case OP_ADD_GROUP:
+        if (find_group(group_list, args->group) != NULL) {
+            error("Group already exists");
+        } else if (over_budget(mem_admit(NULL, sizeof(Group) + strlen(args->group) + 1))) {
+            break;
+        } else if (add_group(group_list_addr, args->group) == -1) {
             error("Group already exists");
-        }
-        
-    } else if (strcmp(cmd_argv[0], "list_groups") == 0 && cmd_argc == 1) {
-        list_groups(group_list);
-        
-    } else if (strcmp(cmd_argv[0], "add_user") == 0 && cmd_argc == 3) {
-        if ((g = find_group(group_list, cmd_argv[1])) == NULL) {
-            error("Group does not exist");
         } else {
-            if (add_user(g, cmd_argv[2]) == -1) {
-                error("User already exists");
-            }
+            log_command(args);
         }
-        
-    } else if (strcmp(cmd_argv[0], "remove_user") == 0 && cmd_argc == 3) {
-        if ((g = find_group(group_list, cmd_argv[1])) == NULL) {
-            error("Group does not exist");
-        } else {
-            if (remove_user(g, cmd_argv[2]) == -1) {
-                error("User does not exist");
-            }
+        break;
+
+    case OP_LIST_GROUPS: {
+        size_t count, cursor, groups = 0;
+        for (Group *current = group_list; current != NULL; current = current->next) {
+            groups++;
+        }
+        // A binary record holds the count where a group name would go
+        if (parse_page(args->group, args->argc > 2 ? args->argv[2] : NULL, groups, &count, &cursor) == 0) {
+            list_groups(group_list, count, cursor);
         }
-        
-    } else if (strcmp(cmd_argv[0], "list_users") == 0 && cmd_argc == 2) {
-        if ((g = find_group(group_list, cmd_argv[1])) == NULL) {
+        break;
+    }
+
+    case OP_POOL_STATS:
+        if (args->argc == 1) {
+            pool_stats(group_list, NULL);
+        } else if ((g = find_group(group_list, args->group)) == NULL) {
             error("Group does not exist");
         } else {
-            list_users(g);
+            pool_stats(group_list, g);
         }
-        
-    } else if (strcmp(cmd_argv[0], "user_balance") == 0 && cmd_argc == 3) {
-        if ((g = find_group(group_list, cmd_argv[1])) == NULL) {
+        break;
+
+    case OP_MEMORY:
+        if (args->argc == 1) {
+            memory_usage(group_list, NULL);
+        } else if ((g = find_group(group_list, args->group)) == NULL) {
             error("Group does not exist");
         } else {
-            if (user_balance(g, cmd_argv[2]) == -1) {
-                error("User does not exist");
-            }
+            memory_usage(group_list, g);
         }
-        
-    } else if (strcmp(cmd_argv[0], "under_paid") == 0 && cmd_argc == 2) {
-        if ((g = find_group(group_list, cmd_argv[1])) == NULL) {
+        break;
+
+    case OP_SAVE:
+        if (snapshot_save(group_list, args->group) == -1) {
+            error("Could not write snapshot");
+        } else if (wal_checkpoint() == -1) {
+            error("Could not truncate write-ahead log");
+        }
+        break;
+
+    case OP_LOAD: {
+        int result = snapshot_load(group_list_addr, args->group);
+        if (result == -1) {
+            error("Could not read snapshot");
+        } else if (result == -2) {
+            error("Invalid snapshot");
+        } else if (wal_checkpoint() == -1) {
+            error("Could not truncate write-ahead log");
+        }
+        break;
+    }
+
+    case OP_STATS:
+        stats_print();
+        break;
+
+    case OP_USER_GROUPS:
+        if (user_groups(args->group) == -1) {
+            error("User does not exist");
+        }
+        break;
+
+    case OP_TOTAL_BALANCE:
+        if (total_balance(args->group) == -1) {
+            error("User does not exist");
+        }
+        break;
+
+    case OP_FIND_USERS: {
+        // The group, if given, comes last, so that it can be left out
+        size_t limit, cursor;
+        if (parse_page(args->argc > 2 ? args->argv[2] : NULL, NULL, 0, &limit, &cursor) == -1) {
+            break;
+        } else if (args->argc < 4) {
+            directory_find(args->group, limit);
+        } else if ((g = find_group(group_list, args->argv[3])) == NULL) {
             error("Group does not exist");
         } else {
-            if (under_paid(g) == -1) {
-                error("User list empty");
-            }
+            find_users(g, args->group, limit);
         }
-        
-    } else if (strcmp(cmd_argv[0], "add_xct") == 0 && cmd_argc == 4) {
-        if ((g = find_group(group_list, cmd_argv[1])) == NULL) {
+        break;
+    }
+
+    case OP_SUGGEST:
+        if (args->argc < 3) {
+            directory_suggest(args->group);
+        } else if ((g = find_group(group_list, args->argv[2])) == NULL) {
             error("Group does not exist");
         } else {
-            char *end;
-            double amount = strtod(cmd_argv[3], &end);
-            if (end == cmd_argv[3]) {
-                error("Incorrect number format");
-            } else {
-                if (add_xct(g, cmd_argv[2], amount) == -1) {
-                    error("User does not exist");
-                }
-            }
+            suggest_users(g, args->group);
         }
-    } else if(strcmp(cmd_argv[0], "recent_xct") == 0 && cmd_argc == 3) {
-        if ((g = find_group(group_list, cmd_argv[1])) == NULL) {
+        break;
+    }
+    return 0;
+}
+
+/* 
+ * Run a parsed command. Returns -1 for quit and 0 otherwise
+ */
+int process_command(const struct command_args *args, Group **group_list_addr) {
+    if (commands[args->op].flags & CMD_GROUP) {
+        Group *g = args->target != NULL ? args->target : find_group(*group_list_addr, args->group);
+        if (g == NULL) {
             error("Group does not exist");
         } else {
-            char *end;
-            long num = strtol(cmd_argv[2], &end, 10);
-            if (end == cmd_argv[2]) {
-                error("Incorrect number format");
-            } else {
-                recent_xct(g, num);
-            }
+            process_group_command(args, g);
         }
+        return 0;
+    }
 
-    } else {
+    uint64_t started = stats_now();
+    int result = run_command(args, group_list_addr);
+    mem_settle();
+    stats_command(args->op, stats_now() - started);
+    return result;
+}
+
+/* 
+ * Read and process buxfer commands
+ */
+int process_args(int cmd_argc, char **cmd_argv, Group **group_list_addr) {
+    struct command_args args;
+
+    if (cmd_argc <= 0) {
+        return 0;
+    }
+    if (command_parse(cmd_argc, cmd_argv, &args) == -1) {
         error("Incorrect syntax");
+        return 0;
     }
-    return 0;
+    return process_command(&args, group_list_addr);
 }
 
 int main(int argc, char* argv[]) {
@@ -114,13 +509,268 @@ int main(int argc, char* argv[]) {
     char *cmd_argv[INPUT_ARG_MAX_NUM];
     int cmd_argc;
     FILE *input_stream;
+    const char *batch_path = NULL;
+    const char *ingest_path = NULL;
+    const char *binary_path = NULL;
+    const char *compile_path = NULL;
+    const char *snapshot_path = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    double replay_speed = 1.0;
+    const char *wal_path = NULL;
+    enum wal_mode wal_mode = WAL_GROUP;
+    long wal_window_us = WAL_DEFAULT_WINDOW_US;
+    long threads = 0;
+    long readers = 0;
+    const char *stats_path = NULL;
+    long stats_interval_ms = STATS_DEFAULT_INTERVAL_MS;
+    size_t memory_budget = 0;
+    size_t group_memory_budget = 0;
+    const char *listen_addresses[SERVER_MAX_LISTENERS];
+    int listen_count = 0;
 
     /* Initialize the list head */
     Group *group_list = NULL;
 
+    /* Parse options; anything else is the batch file */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ingest") == 0 && i + 1 < argc) {
+            ingest_path = argv[++i];
+        } else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc) {
+            binary_path = argv[++i];
+        } else if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc) {
+            compile_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            char *end;
+            replay_speed = strtod(argv[++i], &end);
+            if (end == argv[i] || *end != '\0' || !(replay_speed > 0)) {
+                error("Incorrect number format");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--wal") == 0 && i + 1 < argc) {
+            wal_path = argv[++i];
+        } else if (strcmp(argv[i], "--wal-mode") == 0 && i + 1 < argc) {
+            if (wal_parse_mode(argv[++i], &wal_mode) == -1) {
+                error("Unknown write-ahead log mode");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--wal-window") == 0 && i + 1 < argc) {
+            char *end;
+            wal_window_us = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || wal_window_us < 0) {
+                error("Incorrect number format");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc && listen_count < SERVER_MAX_LISTENERS) {
+            listen_addresses[listen_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            char *end;
+            threads = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || threads < 1 || threads > EXECUTOR_MAX_THREADS) {
+                error("Incorrect number format");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            char *end;
+            readers = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || readers < 1 || readers > EXECUTOR_MAX_THREADS) {
+                error("Incorrect number format");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+            char *end;
+            stats_interval_ms = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || stats_interval_ms < 1) {
+                error("Incorrect number format");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            if (parse_bytes(argv[++i], &memory_budget) == -1) {
+                error("Incorrect number format");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--group-memory-budget") == 0 && i + 1 < argc) {
+            if (parse_bytes(argv[++i], &group_memory_budget) == -1) {
+                error("Incorrect number format");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (out_parse_format(argv[++i], &out_format) == -1) {
+                error("Unknown output format");
+                exit(1);
+            }
+        } else if (batch_path == NULL && argv[i][0] != '-') {
+            batch_path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [--snapshot <file>] [--wal <file> [--wal-mode sync|group|async] "
+                    "[--wal-window <microseconds>]] [--threads <n> | --readers <n>] [--listen [host:]port|unix:<path>]... "
+                    "[--stats-file <file> [--stats-interval <milliseconds>]] "
+                    "[--memory-budget <bytes>] [--group-memory-budget <bytes>] [--format text|csv|json] [--record <file>] "
+                    "[--ingest <file> | --binary <file> | --replay <file> [--speed <x>] | <batch file>]\n"
+                    "       %s --compile <binary file> <batch file>\n", argv[0], argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Compile mode: turn the batch file into a binary command file and stop */
+    if (compile_path != NULL) {
+        size_t lines;
+        if (batch_path == NULL || binary_compile(batch_path, compile_path, &lines) == -1) {
+            error("Could not compile batch file");
+            exit(1);
+        }
+        fprintf(stderr, "Compiled %zu commands into %s\n", lines, compile_path);
+        return 0;
+    }
+
+    /* Keep a file of command latencies and event counts up to date */
+    if (stats_path != NULL && stats_start_file(stats_path, stats_interval_ms) == -1) {
+        error("Could not write statistics file");
+        exit(1);
+    }
+
+    /* Start from a snapshot instead of an empty ledger */
+    if (snapshot_path != NULL) {
+        int result = snapshot_load(&group_list, snapshot_path);
+        if (result == -1) {
+            error("Could not read snapshot");
+            exit(1);
+        } else if (result == -2) {
+            error("Invalid snapshot");
+            exit(1);
+        }
+    }
+
+    /* Replay the write-ahead log on top of the snapshot, then keep logging to it */
+    if (wal_path != NULL) {
+        struct wal_replay_stats stats;
+        int result = wal_open(wal_path, wal_mode, wal_window_us, &group_list, &stats);
+        if (result == -1) {
+            error("Could not open write-ahead log");
+            exit(1);
+        } else if (result == -2) {
+            error("Invalid write-ahead log");
+            exit(1);
+        }
+        if (stats.records > 0 || stats.truncated_bytes > 0) {
+            fprintf(stderr, "Replayed %zu write-ahead log records, discarded %zu bytes of torn tail\n",
+                    stats.records, stats.truncated_bytes);
+        }
+    }
+
+    /* Hold the ledger to its budgets from here on; what was restored above is
+     * kept even if it is over them */
+    mem_budget = memory_budget;
+    mem_group_budget = group_memory_budget;
+
+    /* Record every command from here on, with when it came */
+    if (record_path != NULL && trace_start(record_path) == -1) {
+        error("Could not write trace");
+        exit(1);
+    }
+
+    /* Server mode: serve commands from network clients until interrupted */
+    if (listen_count > 0) {
+        int result = serve(listen_addresses, listen_count, &group_list);
+        trace_close();
+        wal_close();
+        stats_close();
+        free_groups(group_list);
+        intern_release();
+        return result == -1 ? 1 : 0;
+    }
+
+    /* Run batches on worker threads, one group per thread at a time, or
+     * make every change here and leave reads to reader threads */
+    if (threads > 0 && readers > 0) {
+        error("Use either --threads or --readers");
+        exit(1);
+    }
+    int batch = ingest_path != NULL || binary_path != NULL || replay_path != NULL || batch_path != NULL;
+    if (threads > 0 && batch) {
+        executor_start(threads);
+    } else if (readers > 0 && batch) {
+        executor_start_readers(readers);
+    }
+
+    /* Ingest mode: replay a batch file as fast as possible, without echo or prompts */
+    if (ingest_path != NULL) {
+        struct ingest_stats stats;
+        if (ingest_file(ingest_path, &group_list, &stats) == -1) {
+            error("Error opening file");
+            exit(1);
+        }
+        executor_finish();
+        fprintf(stderr, "Ingested %zu commands (%zu bytes) in %.3f s: %.0f commands/sec\n",
+                stats.commands, stats.bytes, stats.seconds,
+                stats.seconds > 0 ? stats.commands / stats.seconds : 0.0);
+        trace_close();
+        wal_close();
+        stats_close();
+        free_groups(group_list);
+        intern_release();
+        return 0;
+    }
+
+    /* Binary mode: like ingest, but the commands were parsed ahead of time by --compile */
+    if (binary_path != NULL) {
+        struct ingest_stats stats;
+        int result = binary_run(binary_path, &group_list, &stats);
+        if (result == -1) {
+            error("Error opening file");
+            exit(1);
+        } else if (result == -2) {
+            error("Invalid binary command file");
+            exit(1);
+        }
+        executor_finish();
+        fprintf(stderr, "Ran %zu binary commands (%zu bytes) in %.3f s: %.0f commands/sec\n",
+                stats.commands, stats.bytes, stats.seconds,
+                stats.seconds > 0 ? stats.commands / stats.seconds : 0.0);
+        trace_close();
+        wal_close();
+        stats_close();
+        free_groups(group_list);
+        intern_release();
+        return 0;
+    }
+
+    /* Replay mode: run a recorded trace open loop at its recorded pace, times --speed */
+    if (replay_path != NULL) {
+        struct trace_replay_stats stats;
+        int result = trace_replay(replay_path, replay_speed, &group_list, &stats);
+        if (result == -1) {
+            error("Error opening file");
+            exit(1);
+        } else if (result == -2) {
+            error("Invalid trace");
+            exit(1);
+        }
+        executor_finish();
+        fprintf(stderr, "Replayed %zu commands in %.3f s at %gx: %.0f commands/sec\n",
+                stats.commands, stats.seconds, replay_speed,
+                stats.seconds > 0 ? stats.commands / stats.seconds : 0.0);
+        fprintf(stderr, "Latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us; %zu commands behind schedule\n",
+                stats.p50_ns / 1e3, stats.p99_ns / 1e3, stats.p999_ns / 1e3, stats.max_ns / 1e3, stats.behind);
+        trace_close();
+        wal_close();
+        stats_close();
+        free_groups(group_list);
+        intern_release();
+        return 0;
+    }
+
     /* Batch mode */
-    if (argc == 2) {
-        input_stream = fopen(argv[1], "r");
+    if (batch_path != NULL) {
+        input_stream = fopen(batch_path, "r");
         if (input_stream == NULL) {
             error("Error opening file");
             exit(1);
@@ -134,9 +784,10 @@ int main(int argc, char* argv[]) {
     printf("Welcome to Buxfer!\nPlease input command:\n>");
     
     while (fgets(input, INPUT_BUFFER_SIZE, input_stream) != NULL) {
+        executor_begin();
         /* Echo line if in batch mode */
-        if (argc == 2) {
-            printf("%s", input);
+        if (batch_path != NULL) {
+            out_write(input, strlen(input));
         }
         /* Tokenize arguments */
         char *next_token = strtok(input, DELIM);
@@ -152,15 +803,23 @@ int main(int argc, char* argv[]) {
             next_token = strtok(NULL, DELIM);
         }
         cmd_argv[cmd_argc] = NULL;
-        if (cmd_argc > 0 && process_args(cmd_argc, cmd_argv, &group_list) == -1) {
+        if (cmd_argc > 0 && execute(cmd_argc, cmd_argv, &group_list) == -1) {
+            executor_end();
             break; /* quit command was entered */
         }
-        printf(">");
+        out_write(">", 1);
+        executor_end();
     }
+    executor_finish();
 
     /* Close file if in batch mode */
-    if (argc == 2) {
+    if (batch_path != NULL) {
         fclose(input_stream);
     }
+    trace_close();
+    wal_close();
+    stats_close();
+    free_groups(group_list);
+    intern_release();
     return 0;
 }
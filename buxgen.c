@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "workload.h"
+
+/* Print a synthetic workload (see workload.h) as a batch file on standard
+* output, for buxfer, --ingest or --compile.
+*/
+
+int main(int argc, char *argv[]) {
+    struct workload w;
+    struct workload_op op;
+
+    workload_init(&w);
+    for (int i = 1; i < argc; i++) {
+        if (workload_option(&w, argc, argv, &i) != 1) {
+            fprintf(stderr, "Usage: %s ", argv[0]);
+            workload_usage(stderr);
+            fprintf(stderr, "\n");
+            exit(1);
+        }
+    }
+
+    static char buffer[1 << 20];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    workload_start(&w);
+    while (workload_next(&w, &op)) {
+        workload_print(&op, stdout);
+    }
+    workload_free(&w);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
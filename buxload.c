@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Load generator for buxfer --listen. It creates groups and users over one
+* connection, then has many clients, all driven from one epoll loop, send a
+* mix of add_xct and user_balance commands, each keeping up to --pipeline
+* commands in flight. Prints throughput and latency percentiles at the end.
+*/
+
+#define LOAD_READ_SIZE (64 * 1024)
+#define LOAD_BUCKET_US 10			// Latency histogram resolution
+#define LOAD_BUCKETS 100000			// Up to one second; slower replies land in the last bucket
+#define LOAD_MAX_EVENTS 256
+#define LOAD_UNIX_PREFIX "unix:"
+
+struct client {
+	int fd;
+	char *out;			// Commands not yet sent
+	size_t out_used;
+	size_t out_sent;
+	size_t out_capacity;
+	size_t sent;			// Commands queued so far
+	size_t answered;		// Responses received so far
+	double *sent_at;		// Send time of each command in flight, by sequence number
+	uint64_t rng;
+	int writing;			// Watching for EPOLLOUT
+};
+
+static const char *address = "127.0.0.1:7070";
+static int client_count = 100;
+static size_t requests = 10000;		// Per client
+static size_t pipeline = 16;
+static int groups = 8;
+static int users = 100;
+static int read_percent = 50;
+
+static uint64_t histogram[LOAD_BUCKETS];
+static double max_latency;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void fail(const char *what) {
+    perror(what);
+    exit(1);
+}
+
+/* Connect to address ("[host:]port" or "unix:<path>") and return a blocking
+* socket.
+*/
+static int connect_to(const char *target) {
+    if (strncmp(target, LOAD_UNIX_PREFIX, strlen(LOAD_UNIX_PREFIX)) == 0) {
+        struct sockaddr_un addr;
+        const char *path = target + strlen(LOAD_UNIX_PREFIX);
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", path);
+            exit(1);
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+            fail("Error connecting");
+        }
+        return fd;
+    }
+
+    char host[256] = "localhost";
+    const char *port = strrchr(target, ':');
+    if (port == NULL) {
+        port = target;
+    } else {
+        size_t length = port - target;
+        if (length > 0 && length < sizeof(host)) {
+            memcpy(host, target, length);
+            host[length] = '\0';
+        }
+        port++;
+    }
+
+    struct addrinfo hints, *results;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &results) != 0) {
+        fprintf(stderr, "Cannot resolve %s\n", target);
+        exit(1);
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = results; ai != NULL && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    if (fd == -1) {
+        fail("Error connecting");
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void append(struct client *client, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(struct client *client, const char *format, ...) {
+    va_list args;
+    if (client->out_capacity - client->out_used < 256) {
+        client->out_capacity = client->out_capacity == 0 ? 4096 : client->out_capacity * 2;
+        client->out = realloc(client->out, client->out_capacity);
+        if (client->out == NULL) {
+            fail("Error allocating memory");
+        }
+    }
+    va_start(args, format);
+    client->out_used += vsnprintf(client->out + client->out_used, 256, format, args);
+    va_end(args);
+}
+
+/* Send all of client's queued commands, blocking, and wait for one response
+* per command. Used for setup, where the answers do not matter.
+*/
+static void run_blocking(struct client *client, size_t commands) {
+    char buffer[LOAD_READ_SIZE];
+    size_t offset = 0;
+    while (offset < client->out_used) {
+        ssize_t count = write(client->fd, client->out + offset, client->out_used - offset);
+        if (count == -1) {
+            fail("Error sending setup commands");
+        }
+        offset += count;
+    }
+    client->out_used = 0;
+    while (commands > 0) {
+        ssize_t count = read(client->fd, buffer, sizeof(buffer));
+        if (count <= 0) {
+            fprintf(stderr, "Server closed the connection during setup\n");
+            exit(1);
+        }
+        for (ssize_t i = 0; i < count; i++) {
+            commands -= buffer[i] == '\0';
+        }
+    }
+}
+
+/* Queue commands until client has pipeline of them in flight or has sent all
+* of its requests.
+*/
+static void top_up(struct client *client, double now) {
+    while (client->sent < requests && client->sent - client->answered < pipeline) {
+        int group = next_random(&client->rng) % groups;
+        int user = next_random(&client->rng) % users;
+        if ((int) (next_random(&client->rng) % 100) < read_percent) {
+            append(client, "user_balance load%d u%d\n", group, user);
+        } else {
+            append(client, "add_xct load%d u%d %d\n", group, user, (int) (next_random(&client->rng) % 100) + 1);
+        }
+        client->sent_at[client->sent % pipeline] = now;
+        client->sent++;
+    }
+}
+
+/* Returns -1 if the connection failed.
+*/
+static int flush_client(struct client *client) {
+    while (client->out_sent < client->out_used) {
+        ssize_t count = send(client->fd, client->out + client->out_sent,
+                             client->out_used - client->out_sent, MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        client->out_sent += count;
+    }
+    client->out_used = client->out_sent = 0;
+    return 0;
+}
+
+static void record_latency(double seconds) {
+    size_t bucket = (size_t) (seconds * 1e6 / LOAD_BUCKET_US);
+    histogram[bucket < LOAD_BUCKETS ? bucket : LOAD_BUCKETS - 1]++;
+    if (seconds > max_latency) {
+        max_latency = seconds;
+    }
+}
+
+static double percentile(uint64_t total, double fraction) {
+    uint64_t wanted = (uint64_t) (total * fraction);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LOAD_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > wanted) {
+            return (double) (i + 1) * LOAD_BUCKET_US;
+        }
+    }
+    return (double) LOAD_BUCKETS * LOAD_BUCKET_US;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--connect [host:]port|unix:<path>] [--clients <n>] [--requests <per client>] "
+            "[--pipeline <n>] [--groups <n>] [--users <per group>] [--reads <percent>]\n", name);
+    exit(1);
+}
+
+static long number(const char *text, const char *name, long min) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < min) {
+        usage(name);
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        } else if (strcmp(argv[i], "--connect") == 0) {
+            address = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0) {
+            client_count = number(argv[++i], argv[0], 1);
+        } else if (strcmp(argv[i], "--requests") == 0) {
+            requests = number(argv[++i], argv[0], 1);
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipeline = number(argv[++i], argv[0], 1);
+        } else if (strcmp(argv[i], "--groups") == 0) {
+            groups = number(argv[++i], argv[0], 1);
+        } else if (strcmp(argv[i], "--users") == 0) {
+            users = number(argv[++i], argv[0], 1);
+        } else if (strcmp(argv[i], "--reads") == 0) {
+            read_percent = number(argv[++i], argv[0], 0);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    // Setup: the groups and users every client picks from
+    struct client setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.fd = connect_to(address);
+    for (int g = 0; g < groups; g++) {
+        append(&setup, "add_group load%d\n", g);
+    }
+    run_blocking(&setup, groups);
+    for (int g = 0; g < groups; g++) {
+        for (int u = 0; u < users; u++) {
+            append(&setup, "add_user load%d u%d\n", g, u);
+        }
+        run_blocking(&setup, users);
+    }
+    close(setup.fd);
+    free(setup.out);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct client *clients = calloc(client_count, sizeof(struct client));
+    if (epoll_fd == -1 || clients == NULL) {
+        fail("Error starting clients");
+    }
+    for (int i = 0; i < client_count; i++) {
+        struct client *client = &clients[i];
+        client->fd = connect_to(address);
+        fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+        client->sent_at = malloc(pipeline * sizeof(double));
+        if (client->sent_at == NULL) {
+            fail("Error allocating memory");
+        }
+        client->rng = 0x9e3779b97f4a7c15ull * (i + 1);
+        struct epoll_event event = { EPOLLIN, { .ptr = client } };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event) == -1) {
+            fail("Error adding client to epoll");
+        }
+    }
+
+    double started = now_seconds();
+    for (int i = 0; i < client_count; i++) {
+        top_up(&clients[i], started);
+        if (flush_client(&clients[i]) == -1) {
+            fail("Error sending");
+        }
+    }
+
+    // Every client either has commands in flight or is done, so wait for replies
+    struct epoll_event events[LOAD_MAX_EVENTS];
+    char buffer[LOAD_READ_SIZE];
+    int finished = 0;
+    uint64_t answered = 0;
+    while (finished < client_count) {
+        int ready = epoll_wait(epoll_fd, events, LOAD_MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("Error waiting for events");
+        }
+        double now = now_seconds();
+        for (int e = 0; e < ready; e++) {
+            struct client *client = events[e].data.ptr;
+            if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                ssize_t count = read(client->fd, buffer, sizeof(buffer));
+                if (count == 0 || (count == -1 && errno != EAGAIN && errno != EINTR)) {
+                    fprintf(stderr, "Server closed a connection\n");
+                    exit(1);
+                }
+                for (ssize_t i = 0; i < count; i++) {
+                    if (buffer[i] == '\0') {
+                        record_latency(now - client->sent_at[client->answered % pipeline]);
+                        client->answered++;
+                        answered++;
+                    }
+                }
+                if (client->answered == requests) {
+                    finished++;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+                    continue;
+                }
+                top_up(client, now);
+            }
+            if (flush_client(client) == -1) {
+                fail("Error sending");
+            }
+            int writing = client->out_used > 0;
+            if (writing != client->writing) {
+                struct epoll_event event = { EPOLLIN | (writing ? EPOLLOUT : 0), { .ptr = client } };
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+                client->writing = writing;
+            }
+        }
+    }
+    double seconds = now_seconds() - started;
+
+    printf("%llu commands from %d clients (pipeline %zu) in %.3f s: %.0f commands/sec\n",
+           (unsigned long long) answered, client_count, pipeline, seconds, answered / seconds);
+    printf("Latency: p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n",
+           percentile(answered, 0.5), percentile(answered, 0.99), percentile(answered, 0.999), max_latency * 1e6);
+
+    for (int i = 0; i < client_count; i++) {
+        close(clients[i].fd);
+        free(clients[i].out);
+        free(clients[i].sent_at);
+    }
+    free(clients);
+    close(epoll_fd);
+    return 0;
+}
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cold.h"
+
+#define COLD_SLOTS 2048			// Dictionary hash slots, a power of two at least twice XCT_CHUNK_ROWS
+#define COLD_NO_ENTRY UINT16_MAX	// A row dead when sealed, in the first pass
+#define COLD_PENDING UINT32_MAX		// An entry whose first row has not been decoded yet
+#define COLD_MAX_BYTES (XCT_CHUNK_ROWS * 40) // Dictionary (18 bytes an entry) and columns (17 bytes a row) at worst
+
+struct seal_entry {
+	uint32_t uid;
+	uint32_t gap;			// First row of the block less the user's transaction before it, 0 for none
+	uint32_t count;
+	uint32_t last_ref;		// The user's newest row so far, to check user_prev against
+	int64_t sum;
+	uint16_t first_seen;		// Entry number before sorting
+};
+
+/* Where the parts of a block's data start.
+*/
+struct layout {
+	const uint8_t *uids, *gaps, *counts, *sums;
+	const uint8_t *rows;		// The packed dictionary index column, then the cents and time varints
+};
+
+static uint8_t *put_varint(uint8_t *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+    *p++ = (uint8_t) value;
+    return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, uint64_t *value) {
+    uint64_t result = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        result |= (uint64_t) (*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value = result | (uint64_t) *p++ << shift;
+    return p;
+}
+
+/* get_varint for a value that must end before end and fit in 64 bits.
+* Returns NULL if it does not.
+*/
+static const uint8_t *get_varint_checked(const uint8_t *p, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint64_t byte = *p++;
+        if (shift == 63 && byte > 1) {
+            return NULL;
+        }
+        result |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static uint8_t *put_fixed(uint8_t *p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *p++ = (uint8_t) (value >> (8 * i));
+    }
+    return p;
+}
+
+static uint64_t get_fixed(const uint8_t *p, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t) p[i] << (8 * i);
+    }
+    return value;
+}
+
+// Bytes a fixed-width field needs to hold value, at least 1
+static int fixed_width(uint64_t value) {
+    int bytes = 1;
+    while (bytes < 8 && value >> (8 * bytes) != 0) {
+        bytes++;
+    }
+    return bytes;
+}
+
+// Bits each row's dictionary index takes in a block of names entries, the
+// index names itself marking a row that was dead when the block was sealed
+static int index_width(uint32_t names) {
+    int width = 0;
+    while (names >> width != 0) {
+        width++;
+    }
+    return width;
+}
+
+// Small amounts of either sign become small numbers: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static int by_uid(const void *a, const void *b) {
+    uint32_t x = ((const struct seal_entry *) a)->uid, y = ((const struct seal_entry *) b)->uid;
+    return x < y ? -1 : x > y;
+}
+
+static struct layout layout_of(const struct xct_block *block) {
+    struct layout at;
+    at.uids = block->data;
+    at.gaps = at.uids + (size_t) block->names * block->uid_bytes;
+    at.counts = at.gaps + (size_t) block->names * block->gap_bytes;
+    at.sums = at.counts + (size_t) block->names * block->count_bytes;
+    at.rows = at.sums + (size_t) block->names * block->sum_bytes;
+    return at;
+}
+
+static int entry_dead(const struct xct_block *block, uint32_t e) {
+    return (block->dead[e / 64] >> (e % 64)) & 1;
+}
+
+/* Compress chunk, the full chunk number index of its group, into a new cold
+* block. Returns NULL, leaving the chunk hot, if some row's user_prev is not
+* the same user's row before it, which is all the block can record, or if
+* its rows are not in time order.
+*/
+struct xct_block *cold_seal(const struct xct_chunk *chunk, size_t index) {
+    uint32_t slot_uid[COLD_SLOTS];
+    uint16_t slot_entry[COLD_SLOTS];	// Entry + 1, or 0 for an empty slot
+    struct seal_entry dict[XCT_CHUNK_ROWS];
+    uint16_t entries[XCT_CHUNK_ROWS];
+    uint16_t renumber[XCT_CHUNK_ROWS];
+    uint8_t buffer[COLD_MAX_BYTES];
+    uint32_t first = (uint32_t) (index * XCT_CHUNK_ROWS + 1);
+    uint32_t count = 0, live = 0;
+    int64_t sum = 0;
+
+    memset(slot_entry, 0, sizeof(slot_entry));
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        uint32_t uid = chunk->uid[row], ref = first + row, prev = chunk->user_prev[row];
+        if (row > 0 && chunk->time[row] < chunk->time[row - 1]) {
+            return NULL;
+        }
+        if (uid == XCT_DEAD) {
+            entries[row] = COLD_NO_ENTRY;
+            continue;
+        }
+        uint32_t slot = (uid * 2654435761u) & (COLD_SLOTS - 1);
+        while (slot_entry[slot] != 0 && slot_uid[slot] != uid) {
+            slot = (slot + 1) & (COLD_SLOTS - 1);
+        }
+        struct seal_entry *entry;
+        if (slot_entry[slot] == 0) {
+            if (prev >= first) {
+                return NULL;
+            }
+            entry = &dict[count];
+            entry->uid = uid;
+            entry->gap = prev == XCT_NONE ? 0 : first - prev;
+            entry->count = 0;
+            entry->sum = 0;
+            entry->first_seen = (uint16_t) count;
+            slot_uid[slot] = uid;
+            slot_entry[slot] = (uint16_t) ++count;
+        } else {
+            entry = &dict[slot_entry[slot] - 1];
+            if (prev != entry->last_ref) {
+                return NULL;
+            }
+        }
+        entry->last_ref = ref;
+        entry->count++;
+        entry->sum += chunk->cents[row];
+        entries[row] = entry->first_seen;
+        live++;
+        sum += chunk->cents[row];
+    }
+
+    // Sorted by uid, so that an entry can be found by binary search
+    qsort(dict, count, sizeof(struct seal_entry), by_uid);
+    uint64_t max_uid = 0, max_gap = 0, max_count = 0, max_sum = 0;
+    for (uint32_t e = 0; e < count; e++) {
+        renumber[dict[e].first_seen] = (uint16_t) e;
+        max_uid = dict[e].uid > max_uid ? dict[e].uid : max_uid;
+        max_gap = dict[e].gap > max_gap ? dict[e].gap : max_gap;
+        max_count = dict[e].count > max_count ? dict[e].count : max_count;
+        max_sum = zigzag(dict[e].sum) > max_sum ? zigzag(dict[e].sum) : max_sum;
+    }
+    int uid_bytes = fixed_width(max_uid), gap_bytes = fixed_width(max_gap);
+    int count_bytes = fixed_width(max_count), sum_bytes = fixed_width(max_sum);
+
+    uint8_t *p = buffer;
+    for (uint32_t e = 0; e < count; e++) {
+        p = put_fixed(p, dict[e].uid, uid_bytes);
+    }
+    for (uint32_t e = 0; e < count; e++) {
+        p = put_fixed(p, dict[e].gap, gap_bytes);
+    }
+    for (uint32_t e = 0; e < count; e++) {
+        p = put_fixed(p, dict[e].count, count_bytes);
+    }
+    for (uint32_t e = 0; e < count; e++) {
+        p = put_fixed(p, zigzag(dict[e].sum), sum_bytes);
+    }
+    int width = index_width(count);
+    uint64_t bits = 0;
+    int held = 0;
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        uint32_t entry = entries[row] == COLD_NO_ENTRY ? count : renumber[entries[row]];
+        bits |= (uint64_t) entry << held;
+        for (held += width; held >= 8; held -= 8) {
+            *p++ = (uint8_t) bits;
+            bits >>= 8;
+        }
+    }
+    if (held > 0) {
+        *p++ = (uint8_t) bits;
+    }
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        p = put_varint(p, zigzag(chunk->cents[row]));
+    }
+    p = put_varint(p, zigzag(chunk->time[0]));
+    for (uint32_t row = 1; row < XCT_CHUNK_ROWS; row++) {
+        p = put_varint(p, (uint64_t) (chunk->time[row] - chunk->time[row - 1]));
+    }
+
+    size_t size = p - buffer;
+    struct xct_block *block = malloc(sizeof(struct xct_block) + size);
+    if (block == NULL) {
+        perror("Error allocating memory for cold block. Exiting...");
+        exit(1);
+    }
+    memset(block, 0, sizeof(struct xct_block)); // Padding too, as snapshots write blocks out whole
+    block->live = live;
+    block->sum = sum;
+    block->size = (uint32_t) size;
+    block->names = (uint16_t) count;
+    block->uid_bytes = (uint8_t) uid_bytes;
+    block->gap_bytes = (uint8_t) gap_bytes;
+    block->count_bytes = (uint8_t) count_bytes;
+    block->sum_bytes = (uint8_t) sum_bytes;
+    memcpy(block->data, buffer, size);
+    return block;
+}
+
+/* Decode block, sealed from chunk number index, back into chunk. The rows of
+* entries set in dead come out as dead rows would in a hot chunk.
+*/
+void cold_decode(const struct xct_block *block, size_t index, struct xct_chunk *chunk) {
+    uint32_t names[XCT_CHUNK_ROWS + 1];
+    uint32_t last_ref[XCT_CHUNK_ROWS];	// COLD_PENDING until the entry's first row
+    uint32_t first = (uint32_t) (index * XCT_CHUNK_ROWS + 1);
+    struct layout at = layout_of(block);
+    const uint8_t *p = at.rows;
+    uint64_t value;
+
+    for (uint32_t e = 0; e < block->names; e++) {
+        names[e] = entry_dead(block, e) ? XCT_DEAD : (uint32_t) get_fixed(at.uids + e * block->uid_bytes, block->uid_bytes);
+        last_ref[e] = COLD_PENDING;
+    }
+    names[block->names] = XCT_DEAD;
+
+    int width = index_width(block->names);
+    uint64_t bits = 0;
+    int held = 0;
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        for (; held < width; held += 8) {
+            bits |= (uint64_t) *p++ << held;
+        }
+        uint32_t e = (uint32_t) (bits & ((1u << width) - 1));
+        bits >>= width;
+        held -= width;
+        chunk->uid[row] = names[e];
+        if (names[e] == XCT_DEAD) {
+            chunk->user_prev[row] = XCT_NONE;
+            continue;
+        }
+        if (last_ref[e] == COLD_PENDING) {
+            uint32_t gap = (uint32_t) get_fixed(at.gaps + e * block->gap_bytes, block->gap_bytes);
+            chunk->user_prev[row] = gap == 0 ? XCT_NONE : first - gap;
+        } else {
+            chunk->user_prev[row] = last_ref[e];
+        }
+        last_ref[e] = first + row;
+    }
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        p = get_varint(p, &value);
+        chunk->cents[row] = chunk->uid[row] == XCT_DEAD ? 0 : unzigzag(value);
+    }
+    p = get_varint(p, &value);
+    chunk->time[0] = unzigzag(value);
+    for (uint32_t row = 1; row < XCT_CHUNK_ROWS; row++) {
+        p = get_varint(p, &value);
+        chunk->time[row] = chunk->time[row - 1] + (int64_t) value;
+    }
+    chunk->live = block->live;
+    chunk->version = 0;
+}
+
+/* Check that the size bytes at block, which may come from a file, hold a
+* well formed block sealed from chunk number index: every part within size,
+* the dictionary sorted with each entry's count and sum those of its rows,
+* live and sum those of the entries not in dead, every amount in range and
+* the times in order.
+* If so, decode it into chunk and return 0; otherwise return -1.
+*/
+int cold_check(const struct xct_block *block, size_t size, size_t index, struct xct_chunk *chunk) {
+    uint32_t entries[XCT_CHUNK_ROWS];
+    uint32_t counts[XCT_CHUNK_ROWS];
+    int64_t sums[XCT_CHUNK_ROWS];
+    uint32_t first = (uint32_t) (index * XCT_CHUNK_ROWS + 1);
+
+    if (size < sizeof(struct xct_block) || block->size != size - sizeof(struct xct_block) ||
+        block->names > XCT_CHUNK_ROWS || block->uid_bytes < 1 || block->uid_bytes > 4 ||
+        block->gap_bytes < 1 || block->gap_bytes > 4 || block->count_bytes < 1 || block->count_bytes > 2 ||
+        block->sum_bytes < 1 || block->sum_bytes > 8) {
+        return -1;
+    }
+    for (uint32_t e = block->names; e < XCT_CHUNK_ROWS; e++) {
+        if (entry_dead(block, e)) {
+            return -1;
+        }
+    }
+    int width = index_width(block->names);
+    size_t dictionary = (size_t) block->names * (block->uid_bytes + block->gap_bytes + block->count_bytes + block->sum_bytes);
+    if (dictionary + (XCT_CHUNK_ROWS * width + 7) / 8 > block->size) {
+        return -1;
+    }
+    struct layout at = layout_of(block);
+    const uint8_t *p = at.rows, *end = block->data + block->size;
+    uint64_t value;
+
+    memset(counts, 0, sizeof(counts));
+    memset(sums, 0, sizeof(sums));
+    uint64_t bits = 0;
+    int held = 0;
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        for (; held < width; held += 8) {
+            bits |= (uint64_t) *p++ << held;
+        }
+        entries[row] = (uint32_t) (bits & ((1u << width) - 1));
+        bits >>= width;
+        held -= width;
+        if (entries[row] > block->names) {
+            return -1;
+        }
+    }
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        if ((p = get_varint_checked(p, end, &value)) == NULL || unzigzag(value) < -XCT_MAX_CENTS ||
+            unzigzag(value) > XCT_MAX_CENTS) {
+            return -1;
+        }
+        if (entries[row] < block->names) {
+            counts[entries[row]]++;
+            sums[entries[row]] += unzigzag(value);
+        }
+    }
+    int64_t time;
+    if ((p = get_varint_checked(p, end, &value)) == NULL) {
+        return -1;
+    }
+    time = unzigzag(value);
+    for (uint32_t row = 1; row < XCT_CHUNK_ROWS; row++) {
+        if ((p = get_varint_checked(p, end, &value)) == NULL || value > INT64_MAX ||
+            __builtin_add_overflow(time, (int64_t) value, &time)) {
+            return -1;
+        }
+    }
+    if (p != end) {
+        return -1;
+    }
+
+    uint64_t live = 0;
+    int64_t sum = 0;
+    for (uint32_t e = 0; e < block->names; e++) {
+        struct cold_entry entry;
+        cold_entry(block, index, (int) e, &entry);
+        if ((e > 0 && get_fixed(at.uids + (e - 1) * block->uid_bytes, block->uid_bytes) >= entry.uid) ||
+            entry.uid >= XCT_DEAD || counts[e] == 0 || entry.count != counts[e] || entry.sum != sums[e] ||
+            get_fixed(at.gaps + e * block->gap_bytes, block->gap_bytes) >= first) {
+            return -1;
+        }
+        if (!entry_dead(block, e)) {
+            live += entry.count;
+            sum += entry.sum;
+        }
+    }
+    if (live != block->live || sum != block->sum) {
+        return -1;
+    }
+    cold_decode(block, index, chunk);
+    return 0;
+}
+
+/* The uid of row row of block, or XCT_DEAD if the row is dead, reading only
+* its dictionary index.
+*/
+uint32_t cold_row_uid(const struct xct_block *block, uint32_t row) {
+    struct layout at = layout_of(block);
+    int width = index_width(block->names);
+    size_t bit = (size_t) row * width;
+    uint64_t bits = 0;
+    for (size_t i = 0; i * 8 < bit % 8 + width; i++) {
+        bits |= (uint64_t) at.rows[bit / 8 + i] << (8 * i);
+    }
+    uint32_t e = (uint32_t) ((bits >> (bit % 8)) & ((1u << width) - 1));
+    if (e == block->names || entry_dead(block, e)) {
+        return XCT_DEAD;
+    }
+    return (uint32_t) get_fixed(at.uids + e * block->uid_bytes, block->uid_bytes);
+}
+
+/* Time of the first row of block, skipping the columns before it undecoded.
+*/
+int64_t cold_start(const struct xct_block *block) {
+    struct layout at = layout_of(block);
+    const uint8_t *p = at.rows + (XCT_CHUNK_ROWS * index_width(block->names) + 7) / 8;
+    for (uint32_t row = 0; row < XCT_CHUNK_ROWS; row++) {
+        while (*p++ & 0x80) {
+        }
+    }
+    uint64_t value;
+    get_varint(p, &value);
+    return unzigzag(value);
+}
+
+/* Return the dictionary entry of uid in block, or -1 if uid has no live row
+* there. Only the dictionary is searched; no row is decoded.
+*/
+int cold_find(const struct xct_block *block, uint32_t uid) {
+    struct layout at = layout_of(block);
+    int low = 0, high = block->names;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (get_fixed(at.uids + mid * block->uid_bytes, block->uid_bytes) < uid) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == block->names || get_fixed(at.uids + low * block->uid_bytes, block->uid_bytes) != uid ||
+        entry_dead(block, low)) {
+        return -1;
+    }
+    return low;
+}
+
+/* Fill in entry e of block, sealed from chunk number index: its user, how
+* many rows it has and their sum, and the user's transaction before them.
+*/
+void cold_entry(const struct xct_block *block, size_t index, int e, struct cold_entry *entry) {
+    struct layout at = layout_of(block);
+    uint32_t gap = (uint32_t) get_fixed(at.gaps + e * block->gap_bytes, block->gap_bytes);
+    entry->uid = (uint32_t) get_fixed(at.uids + e * block->uid_bytes, block->uid_bytes);
+    entry->prev = gap == 0 ? XCT_NONE : (uint32_t) (index * XCT_CHUNK_ROWS + 1) - gap;
+    entry->count = (uint32_t) get_fixed(at.counts + e * block->count_bytes, block->count_bytes);
+    entry->sum = unzigzag(get_fixed(at.sums + e * block->sum_bytes, block->sum_bytes));
+}
+
+/* Add the sum of each live entry of block into totals[uid], for the entries
+* whose uid is below limit, as col_scatter_add does for the rows of a chunk.
+*/
+void cold_scatter_add(const struct xct_block *block, int64_t *totals, uint32_t limit) {
+    struct layout at = layout_of(block);
+    const uint8_t *uid = at.uids, *sum = at.sums;
+    for (uint32_t e = 0; e < block->names; e++, uid += block->uid_bytes, sum += block->sum_bytes) {
+        uint32_t id = (uint32_t) get_fixed(uid, block->uid_bytes);
+        if (id < limit && !entry_dead(block, e)) {
+            totals[id] += unzigzag(get_fixed(sum, block->sum_bytes));
+        }
+    }
+}
+
+/* Return a copy of block, for changing while the original may still be read.
+*/
+struct xct_block *cold_copy(const struct xct_block *block) {
+    struct xct_block *copy = malloc(cold_bytes(block));
+    if (copy == NULL) {
+        perror("Error allocating memory for cold block. Exiting...");
+        exit(1);
+    }
+    memcpy(copy, block, cold_bytes(block));
+    return copy;
+}
+
+/* Bytes block takes, its header included.
+*/
+size_t cold_bytes(const struct xct_block *block) {
+    return sizeof(struct xct_block) + block->size;
+}
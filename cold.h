@@ -0,0 +1,42 @@
+#ifndef COLD_H
+#define COLD_H
+
+#include "lists.h"
+
+/* Compression of sealed transaction chunks into cold blocks.
+*
+* A block starts with a dictionary of the distinct uids in the chunk, sorted,
+* giving for each user its row count, the sum of those rows and the distance
+* back from the block's first row to the user's previous transaction. Each of
+* those four is a column of the narrowest fixed width that holds it, so an
+* entry can be found by binary search and read without decoding anything.
+* Then come the row columns: each row's dictionary index, packed in as few
+* bits as the dictionary needs, then as LEB128 varints its cents, zigzag
+* encoded, and its time as the difference from the row before. user_prev is
+* not stored per row, since within a chunk it is always the same user's row
+* before. A row typically takes 4 to 9 bytes instead of 24.
+*
+* Removing a user marks their entry dead. Every row a user has in a sealed
+* block dies with them, since any of the user's rows that were already dead
+* when the block was sealed are in no entry.
+*/
+
+struct cold_entry {
+	uint32_t uid;
+	uint32_t prev;			// The user's transaction before the block, or XCT_NONE
+	uint32_t count;			// Rows in the block
+	int64_t sum;			// Cents of those rows
+};
+
+struct xct_block *cold_seal(const struct xct_chunk *chunk, size_t index);
+void cold_decode(const struct xct_block *block, size_t index, struct xct_chunk *chunk);
+int cold_check(const struct xct_block *block, size_t size, size_t index, struct xct_chunk *chunk);
+uint32_t cold_row_uid(const struct xct_block *block, uint32_t row);
+int64_t cold_start(const struct xct_block *block);
+int cold_find(const struct xct_block *block, uint32_t uid);
+void cold_entry(const struct xct_block *block, size_t index, int e, struct cold_entry *entry);
+void cold_scatter_add(const struct xct_block *block, int64_t *totals, uint32_t limit);
+struct xct_block *cold_copy(const struct xct_block *block);
+size_t cold_bytes(const struct xct_block *block);
+
+#endif
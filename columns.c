@@ -0,0 +1,117 @@
+#include "columns.h"
+
+#if !defined(COLUMNS_SCALAR) && defined(__x86_64__)
+#define COLUMNS_AVX2
+#include <immintrin.h>
+#endif
+
+/* Sum of the first n amounts, with four independent accumulators so the adds
+* do not wait on each other.
+*/
+static int64_t col_sum_scalar(const int64_t *cents, size_t n) {
+    int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += cents[i];
+        s1 += cents[i + 1];
+        s2 += cents[i + 2];
+        s3 += cents[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += cents[i];
+    }
+    return s0 + s1 + s2 + s3;
+}
+
+static int64_t col_sum_matching_scalar(const uint32_t *uid, const int64_t *cents, size_t n, uint32_t id) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        // Branch-free: the mask is all ones for a match and zero otherwise
+        sum += cents[i] & -(int64_t) (uid[i] == id);
+    }
+    return sum;
+}
+
+#ifdef COLUMNS_AVX2
+
+__attribute__((target("avx2")))
+static int64_t hsum(__m256i v) {
+    __m128i pair = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return _mm_cvtsi128_si64(pair) + _mm_extract_epi64(pair, 1);
+}
+
+__attribute__((target("avx2")))
+static int64_t col_sum_avx2(const int64_t *cents, size_t n) {
+    __m256i a = _mm256_setzero_si256();
+    __m256i b = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm256_add_epi64(a, _mm256_loadu_si256((const __m256i *) (cents + i)));
+        b = _mm256_add_epi64(b, _mm256_loadu_si256((const __m256i *) (cents + i + 4)));
+    }
+    return hsum(_mm256_add_epi64(a, b)) + col_sum_scalar(cents + i, n - i);
+}
+
+/* Widen four uids at a time to 64 bits so they line up with their amounts,
+* compare them all against id and keep only the matching amounts.
+*/
+__attribute__((target("avx2")))
+static int64_t col_sum_matching_avx2(const uint32_t *uid, const int64_t *cents, size_t n, uint32_t id) {
+    __m256i want = _mm256_set1_epi64x(id);
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i ids = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) (uid + i)));
+        __m256i match = _mm256_cmpeq_epi64(ids, want);
+        sum = _mm256_add_epi64(sum, _mm256_and_si256(match, _mm256_loadu_si256((const __m256i *) (cents + i))));
+    }
+    return hsum(sum) + col_sum_matching_scalar(uid + i, cents + i, n - i, id);
+}
+
+static int use_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+int64_t col_sum(const int64_t *cents, size_t n) {
+#ifdef COLUMNS_AVX2
+    if (use_avx2()) {
+        return col_sum_avx2(cents, n);
+    }
+#endif
+    return col_sum_scalar(cents, n);
+}
+
+int64_t col_sum_matching(const uint32_t *uid, const int64_t *cents, size_t n, uint32_t id) {
+#ifdef COLUMNS_AVX2
+    if (use_avx2()) {
+        return col_sum_matching_avx2(uid, cents, n, id);
+    }
+#endif
+    return col_sum_matching_scalar(uid, cents, n, id);
+}
+
+/* Add each amount to totals[uid] for every row whose uid is below limit,
+* which skips dead rows. AVX2 has no scatter, and rows of the same user
+* collide within a vector anyway, so this one is scalar everywhere; it streams
+* both columns once, so it is bound by memory rather than by the adds.
+*/
+void col_scatter_add(const uint32_t *uid, const int64_t *cents, size_t n, int64_t *totals, uint32_t limit) {
+    for (size_t i = 0; i < n; i++) {
+        if (uid[i] < limit) {
+            totals[uid[i]] += cents[i];
+        }
+    }
+}
+
+/* Which set of kernels col_sum and col_sum_matching run, for pool_stats.
+*/
+const char *col_kernel_name(void) {
+#ifdef COLUMNS_AVX2
+    if (use_avx2()) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
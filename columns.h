@@ -0,0 +1,19 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernels over the columns of a transaction chunk. Each has an AVX2 version,
+* used when the CPU supports it, and a portable scalar one; building with
+* -DCOLUMNS_SCALAR leaves only the scalar ones.
+*
+* Dead rows have zero cents, so sums may include them without checking uid.
+*/
+
+int64_t col_sum(const int64_t *cents, size_t n);
+int64_t col_sum_matching(const uint32_t *uid, const int64_t *cents, size_t n, uint32_t id);
+void col_scatter_add(const uint32_t *uid, const int64_t *cents, size_t n, int64_t *totals, uint32_t limit);
+const char *col_kernel_name(void);
+
+#endif
@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commands.h"
+
+#define TIME_MIN_SECONDS -62167219200LL	// 0000-01-01T00:00:00Z
+#define TIME_MAX_SECONDS 253402300799LL	// 9999-12-31T23:59:59Z
+
+const struct command commands[OP_COUNT] = {
+    [OP_QUIT] = { "quit", 1, 1, 0 },
+    [OP_ADD_GROUP] = { "add_group", 2, 2, 0 },
+    [OP_LIST_GROUPS] = { "list_groups", 1, 3, 0 },
+    [OP_POOL_STATS] = { "pool_stats", 1, 2, CMD_BARRIER },
+    [OP_SAVE] = { "save", 2, 2, CMD_BARRIER | CMD_FILE },
+    [OP_LOAD] = { "load", 2, 2, CMD_BARRIER | CMD_FILE },
+    [OP_ADD_USER] = { "add_user", 3, 3, CMD_GROUP | CMD_USER },
+    [OP_REMOVE_USER] = { "remove_user", 3, 3, CMD_GROUP | CMD_USER },
+    [OP_LIST_USERS] = { "list_users", 2, 4, CMD_GROUP | CMD_VIEW_USERS },
+    [OP_USER_BALANCE] = { "user_balance", 3, 3, CMD_GROUP | CMD_USER },
+    [OP_UNDER_PAID] = { "under_paid", 2, 2, CMD_GROUP },
+    [OP_ADD_XCT] = { "add_xct", 4, 5, CMD_GROUP | CMD_USER | CMD_CENTS | CMD_TIME },
+    [OP_RANK] = { "rank", 3, 3, CMD_GROUP | CMD_USER },
+    [OP_TOP_PAID] = { "top_paid", 3, 3, CMD_GROUP | CMD_COUNT },
+    [OP_RECENT_XCT] = { "recent_xct", 3, 4, CMD_GROUP | CMD_COUNT | CMD_VIEW_XCTS },
+    [OP_USER_XCT] = { "user_xct", 4, 4, CMD_GROUP | CMD_USER | CMD_COUNT },
+    [OP_GROUP_TOTAL] = { "group_total", 2, 2, CMD_GROUP | CMD_VIEW_XCTS },
+    [OP_USER_TOTAL] = { "user_total", 3, 3, CMD_GROUP | CMD_USER },
+    [OP_RECOMPUTE_BALANCES] = { "recompute_balances", 2, 2, CMD_GROUP },
+    [OP_STATS] = { "stats", 1, 1, CMD_BARRIER },
+    [OP_ADD_XCTS] = { "add_xcts", 4, INPUT_ARG_MAX_NUM - 1, CMD_GROUP | CMD_TIME, 2 },
+    [OP_ADD_USERS] = { "add_users", 3, INPUT_ARG_MAX_NUM - 1, CMD_GROUP, 1 },
+    [OP_SETTLE] = { "settle", 2, 2, CMD_GROUP },
+    [OP_SETTLE_APPLY] = { "settle_apply", 2, 3, CMD_GROUP | CMD_TIME },
+    [OP_XCT_RANGE] = { "xct_range", 4, 4, CMD_GROUP | CMD_VIEW_XCTS },
+    [OP_GROUP_SUMMARY] = { "group_summary", 2, 2, CMD_GROUP },
+    [OP_FAIR_SHARE] = { "fair_share", 3, 3, CMD_GROUP | CMD_USER },
+    [OP_USER_GROUPS] = { "user_groups", 2, 2, CMD_BARRIER },
+    [OP_TOTAL_BALANCE] = { "total_balance", 2, 2, CMD_BARRIER },
+    [OP_MEMORY] = { "memory", 1, 2, CMD_BARRIER },
+    [OP_FIND_USERS] = { "find_users", 2, 4, CMD_BARRIER },
+    [OP_SUGGEST] = { "suggest", 2, 3, CMD_BARRIER },
+};
+
+/* The only command name that name could be: commands are told apart by their
+* length and then by one character, so at most one comparison is needed.
+*/
+static int candidate(const char *name, size_t length) {
+    switch (length) {
+    case 4:
+        switch (name[0]) {
+        case 'q': return OP_QUIT;
+        case 's': return OP_SAVE;
+        case 'l': return OP_LOAD;
+        case 'r': return OP_RANK;
+        }
+        return OP_NONE;
+    case 5:
+        return OP_STATS;
+    case 6:
+        switch (name[0]) {
+        case 's': return OP_SETTLE;
+        case 'm': return OP_MEMORY;
+        }
+        return OP_NONE;
+    case 7:
+        return name[0] == 's' ? OP_SUGGEST : OP_ADD_XCT;
+    case 8:
+        switch (name[4]) {
+        case 'u': return OP_ADD_USER;
+        case 'x': return OP_ADD_XCTS;
+        case 'p': return OP_TOP_PAID;
+        case '_': return OP_USER_XCT;
+        }
+        return OP_NONE;
+    case 9:
+        switch (name[4]) {
+        case 'g': return OP_ADD_GROUP;
+        case 'u': return OP_ADD_USERS;
+        case 'r': return OP_XCT_RANGE;
+        }
+        return OP_NONE;
+    case 10:
+        switch (name[1]) {
+        case 'o': return OP_POOL_STATS;
+        case 'i': return name[0] == 'f' ? OP_FIND_USERS : OP_LIST_USERS;
+        case 'n': return OP_UNDER_PAID;
+        case 'e': return OP_RECENT_XCT;
+        case 's': return OP_USER_TOTAL;
+        case 'a': return OP_FAIR_SHARE;
+        }
+        return OP_NONE;
+    case 11:
+        switch (name[1]) {
+        case 'i': return OP_LIST_GROUPS;
+        case 'e': return OP_REMOVE_USER;
+        case 'r': return OP_GROUP_TOTAL;
+        case 's': return OP_USER_GROUPS;
+        }
+        return OP_NONE;
+    case 12:
+        switch (name[0]) {
+        case 'u': return OP_USER_BALANCE;
+        case 's': return OP_SETTLE_APPLY;
+        }
+        return OP_NONE;
+    case 13:
+        switch (name[0]) {
+        case 'g': return OP_GROUP_SUMMARY;
+        case 't': return OP_TOTAL_BALANCE;
+        }
+        return OP_NONE;
+    case 18:
+        return OP_RECOMPUTE_BALANCES;
+    }
+    return OP_NONE;
+}
+
+/* Return the opcode of the command called name when given cmd_argc
+* arguments (the name included), or OP_NONE if there is no such command or it
+* takes a different number of arguments. Bulk commands take any number of
+* whole rows, followed by a time if they take one.
+*/
+int command_lookup(const char *name, int cmd_argc) {
+    size_t length = strlen(name);
+    int op = candidate(name, length);
+    if (op == OP_NONE || memcmp(name, commands[op].name, length) != 0 ||
+        cmd_argc < commands[op].min_argc || cmd_argc > commands[op].max_argc ||
+        (commands[op].row_argc > 0 && (cmd_argc - 2) % commands[op].row_argc > ((commands[op].flags & CMD_TIME) != 0))) {
+        return OP_NONE;
+    }
+    return op;
+}
+
+/* The most arguments op can be given, the name included, when they are only
+* a group, a user and a number, as its flags call for. That is all a binary
+* record or a workload op holds; anything more needs the text of the command.
+*/
+int command_record_argc(int op) {
+    int flags = commands[op].flags;
+    return 1 + (commands[op].max_argc > 1) + ((flags & CMD_USER) != 0) + ((flags & (CMD_CENTS | CMD_COUNT)) != 0);
+}
+
+/* Parse text as an amount of money, rounded to the nearest cent, into cents.
+* Like strtod, only the leading number is read. Returns 0 on success, -1 if
+* text does not start with a number and -2 if the amount is not finite or
+* larger in magnitude than XCT_MAX_CENTS.
+*/
+int parse_cents(const char *text, int64_t *cents) {
+    // Plain amounts with at most two decimals are read exactly, digit by digit
+    const char *p = text;
+    int negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+    int64_t whole = 0;
+    int digits = 0;
+    while (*p >= '0' && *p <= '9' && digits < 10) {
+        whole = whole * 10 + (*p++ - '0');
+        digits++;
+    }
+    int64_t fraction = 0;
+    if (*p == '.') {
+        p++;
+        for (int place = 10; place > 0 && *p >= '0' && *p <= '9'; place /= 10) {
+            fraction += (*p++ - '0') * place;
+            digits++;
+        }
+    }
+    if (*p == '\0' && digits > 0) {
+        int64_t value = whole * 100 + fraction;
+        if (value > XCT_MAX_CENTS) {
+            return -2;
+        }
+        *cents = negative ? -value : value;
+        return 0;
+    }
+
+    // Anything else (exponents, more decimals, trailing text) goes through strtod
+    char *end;
+    double amount = strtod(text, &end);
+    if (end == text) {
+        return -1;
+    }
+    double scaled = amount * 100;
+    // Written so that NaN fails the test too
+    if (!(scaled >= -XCT_MAX_CENTS && scaled <= XCT_MAX_CENTS)) {
+        return -2;
+    }
+    *cents = (int64_t) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    return 0;
+}
+
+/* Read exactly n digits from *text into *value, moving *text past them.
+* Returns 0, or -1 if there are fewer than n digits.
+*/
+static int read_digits(const char **text, int n, int *value) {
+    *value = 0;
+    for (int i = 0; i < n; i++) {
+        char c = (*text)[i];
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        *value = *value * 10 + (c - '0');
+    }
+    *text += n;
+    return 0;
+}
+
+/* Days from 1970-01-01 to the given date of the proleptic Gregorian calendar.
+*/
+static int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return (int64_t) era * 146097 + day_of_era - 719468;
+}
+
+/* Parse text as a time into seconds since the epoch. text is either a whole
+* number of seconds since the epoch or an ISO 8601 UTC date such as
+* "2024-03-01", optionally followed by a time of day as in "2024-03-01T09:30"
+* or "2024-03-01T09:30:00Z". Returns 0 on success and -1 if text is neither or
+* is outside the years 0 to 9999.
+*/
+int parse_time(const char *text, int64_t *time) {
+    static const int month_days[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    const char *p = text;
+    int year, month, day, hour = 0, minute = 0, second = 0;
+
+    if (read_digits(&p, 4, &year) == -1 || *p != '-') {
+        // Not a date, so it had better be a number of seconds
+        char *end;
+        errno = 0;
+        long long seconds = strtoll(text, &end, 10);
+        if (end == text || *end != '\0' || errno != 0 ||
+            seconds < TIME_MIN_SECONDS || seconds > TIME_MAX_SECONDS) {
+            return -1;
+        }
+        *time = seconds;
+        return 0;
+    }
+    p++;
+    if (read_digits(&p, 2, &month) == -1 || *p++ != '-' || read_digits(&p, 2, &day) == -1) {
+        return -1;
+    }
+    if (*p == 'T') {
+        p++;
+        if (read_digits(&p, 2, &hour) == -1 || *p++ != ':' || read_digits(&p, 2, &minute) == -1) {
+            return -1;
+        }
+        if (*p == ':') {
+            p++;
+            if (read_digits(&p, 2, &second) == -1) {
+                return -1;
+            }
+        }
+        if (*p == 'Z') {
+            p++;
+        }
+    }
+    int leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (*p != '\0' || month < 1 || month > 12 || day < 1 || day > month_days[month - 1] ||
+        (month == 2 && day == 29 && !leap) || hour > 23 || minute > 59 || second > 59) {
+        return -1;
+    }
+    *time = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return 0;
+}
+
+/* Look up the command in cmd_argv and fill in args from its arguments, which
+* args then points into. Returns 0, or -1 if the command does not exist or is
+* given the wrong number of arguments.
+*/
+int command_parse(int cmd_argc, char **cmd_argv, struct command_args *args) {
+    int op = command_lookup(cmd_argv[0], cmd_argc);
+    if (op == OP_NONE) {
+        return -1;
+    }
+    int flags = commands[op].flags;
+
+    args->op = op;
+    args->argc = cmd_argc;
+    args->group = cmd_argc > 1 ? cmd_argv[1] : NULL;
+    args->user = flags & CMD_USER ? cmd_argv[2] : NULL;
+    args->value = 0;
+    args->value_error = 0;
+    args->time = XCT_TIME_NOW;
+    args->time_error = 0;
+    args->argv = cmd_argv;
+    args->target = NULL;
+
+    // The number comes straight after the group and user
+    if (flags & CMD_CENTS) {
+        args->value_error = parse_cents(cmd_argv[flags & CMD_USER ? 3 : 2], &args->value);
+    } else if (flags & CMD_COUNT) {
+        const char *number = cmd_argv[flags & CMD_USER ? 3 : 2];
+        char *end;
+        args->value = strtol(number, &end, 10);
+        args->value_error = end == number ? -1 : 0;
+    }
+
+    // A time is always the last argument, and optional
+    int row_argc = commands[op].row_argc;
+    if ((flags & CMD_TIME) &&
+        (row_argc > 0 ? (cmd_argc - 2) % row_argc != 0 : cmd_argc > commands[op].min_argc)) {
+        args->time_error = parse_time(cmd_argv[cmd_argc - 1], &args->time);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "lists.h"
+
+/* The command table. Every command has a fixed opcode; opcodes are stored in
+* binary command files (see binary.h), so new commands only ever go at the end.
+*/
+enum command_op {
+	OP_QUIT,
+	OP_ADD_GROUP,
+	OP_LIST_GROUPS,
+	OP_POOL_STATS,
+	OP_SAVE,
+	OP_LOAD,
+	OP_ADD_USER,
+	OP_REMOVE_USER,
+	OP_LIST_USERS,
+	OP_USER_BALANCE,
+	OP_UNDER_PAID,
+	OP_ADD_XCT,
+	OP_RANK,
+	OP_TOP_PAID,
+	OP_RECENT_XCT,
+	OP_USER_XCT,
+	OP_GROUP_TOTAL,
+	OP_USER_TOTAL,
+	OP_RECOMPUTE_BALANCES,
+	OP_STATS,
+	OP_ADD_XCTS,
+	OP_ADD_USERS,
+	OP_SETTLE,
+	OP_SETTLE_APPLY,
+	OP_XCT_RANGE,
+	OP_GROUP_SUMMARY,
+	OP_FAIR_SHARE,
+	OP_USER_GROUPS,
+	OP_TOTAL_BALANCE,
+	OP_MEMORY,
+	OP_FIND_USERS,
+	OP_SUGGEST,
+	OP_COUNT
+};
+
+#define OP_NONE -1
+
+#define CMD_GROUP 1		// Acts on the single group its first argument names
+#define CMD_USER 2		// Its second argument is a user name
+#define CMD_BARRIER 4		// Looks at every group, so must not overlap group commands
+#define CMD_CENTS 8		// Its argument after the group and user is an amount, parsed with parse_cents
+#define CMD_COUNT 16		// Its argument after the group and user is a count, parsed with strtol
+#define CMD_TIME 32		// Its last argument may be a time, parsed with parse_time
+#define CMD_VIEW_USERS 64	// Only reads the users, so a reader can run it on a view (see view.h)
+#define CMD_VIEW_XCTS 128	// Only reads the transaction history, likewise
+#define CMD_FILE 256		// Its argument is a path on this machine, so network clients may not run it
+
+struct command {
+	const char *name;
+	int min_argc;			// Including the command name itself
+	int max_argc;
+	int flags;
+	int row_argc;			// For bulk commands, the arguments of each row after the group
+};
+
+/* A command with its arguments picked apart and its number, if any, already
+* parsed. A bad number is not reported until the command runs, so that a
+* missing group is still reported first.
+*/
+struct command_args {
+	int op;
+	int argc;			// Argument count, including the command name
+	const char *group;		// The group name, the path for save and load, the user for user_groups and total_balance, the name for find_users and suggest, or the page size for list_groups
+	const char *user;
+	int64_t value;			// Cents for add_xct, or the count of a listing
+	int value_error;		// -1 for a malformed number, -2 for one out of range
+	int64_t time;			// The time given to stamp transactions with, or XCT_TIME_NOW
+	int time_error;			// -1 for a malformed time
+	char **argv;			// The text arguments, or NULL for a binary command
+	Group *target;			// The group, if the caller has already found it
+};
+
+extern const struct command commands[OP_COUNT];
+
+int command_lookup(const char *name, int cmd_argc);
+int command_record_argc(int op);
+int command_parse(int cmd_argc, char **cmd_argv, struct command_args *args);
+
+int process_command(const struct command_args *args, Group **group_list_addr);
+void process_group_command(const struct command_args *args, Group *g);
+
+#endif
@@ -0,0 +1,253 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "directory.h"
+#include "lists.h"
+#include "memory.h"
+#include "output.h"
+
+/* The memberships of one name, in no particular order: a removal moves the
+* last one into the gap, and tells its user where it went.
+*/
+struct directory_entry {
+	struct membership *items;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+static struct directory_entry *entries;	// Interned ID -> memberships
+static size_t entry_capacity;
+static size_t memberships;
+static size_t item_bytes;		// Bytes of every entry's memberships array
+static Trie names;			// Every name with a membership -> its interned ID + 1
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Record that group has user, which must not already be recorded.
+*/
+void directory_add(struct group *group, struct user *user) {
+    pthread_mutex_lock(&lock);
+    if (user->id >= entry_capacity) {
+        size_t capacity = entry_capacity == 0 ? 256 : entry_capacity;
+        while (capacity <= user->id) {
+            capacity *= 2;
+        }
+        struct directory_entry *grown = realloc(entries, capacity * sizeof(struct directory_entry));
+        if (grown == NULL) {
+            perror("Error allocating memory for user directory. Exiting...");
+            exit(1);
+        }
+        memset(grown + entry_capacity, 0, (capacity - entry_capacity) * sizeof(struct directory_entry));
+        mem_charge(NULL, MEM_USER, (capacity - entry_capacity) * sizeof(struct directory_entry));
+        entries = grown;
+        entry_capacity = capacity;
+    }
+
+    struct directory_entry *entry = &entries[user->id];
+    if (entry->count == 0) {
+        size_t bytes = names.bytes;
+        trie_insert(&names, user->name, (void *) (uintptr_t) (user->id + 1));
+        mem_charge(NULL, MEM_NAME, names.bytes - bytes);
+    }
+    if (entry->count == entry->capacity) {
+        uint32_t capacity = entry->capacity == 0 ? 2 : entry->capacity * 2;
+        struct membership *items = realloc(entry->items, capacity * sizeof(struct membership));
+        if (items == NULL) {
+            perror("Error allocating memory for user directory. Exiting...");
+            exit(1);
+        }
+        mem_charge(NULL, MEM_USER, (capacity - entry->capacity) * sizeof(struct membership));
+        item_bytes += (capacity - entry->capacity) * sizeof(struct membership);
+        entry->items = items;
+        entry->capacity = capacity;
+    }
+    user->membership = entry->count;
+    entry->items[entry->count++] = (struct membership) { group, user };
+    memberships++;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Forget the membership of user, which is about to leave its group.
+*/
+void directory_remove(struct user *user) {
+    pthread_mutex_lock(&lock);
+    struct directory_entry *entry = &entries[user->id];
+    struct membership *last = &entry->items[--entry->count];
+    entry->items[user->membership] = *last;
+    last->user->membership = user->membership;
+    memberships--;
+    if (entry->count == 0) {
+        size_t bytes = names.bytes;
+        trie_remove(&names, user->name);
+        mem_credit(NULL, MEM_NAME, bytes - names.bytes);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Forget every membership, as every group is about to be freed.
+*/
+void directory_release(void) {
+    pthread_mutex_lock(&lock);
+    for (size_t i = 0; i < entry_capacity; i++) {
+        free(entries[i].items);
+    }
+    free(entries);
+    mem_credit(NULL, MEM_USER, entry_capacity * sizeof(struct directory_entry) + item_bytes);
+    mem_credit(NULL, MEM_NAME, names.bytes);
+    trie_free(&names);
+    entries = NULL;
+    entry_capacity = 0;
+    item_bytes = 0;
+    memberships = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Number of memberships recorded.
+*/
+size_t directory_count(void) {
+    return memberships;
+}
+
+/* Bytes held by the directory.
+*/
+size_t directory_bytes(void) {
+    pthread_mutex_lock(&lock);
+    size_t bytes = entry_capacity * sizeof(struct directory_entry) + item_bytes + names.bytes;
+    pthread_mutex_unlock(&lock);
+    return bytes;
+}
+
+/* Return 0 if count more users may join the directory without going over the
+* process budget, or MEM_OVER_TOTAL if not (see mem_admit). Each may add an
+* entry, up to two memberships while its array doubles, and two trie nodes;
+* the names' labels are left out.
+*/
+int directory_admit(size_t count) {
+    return mem_admit_shared(count * (sizeof(struct directory_entry) + 2 * sizeof(struct membership) +
+                                     2 * sizeof(struct trie_node)));
+}
+
+/* The memberships of user_name, or NULL if it is in no group. Callers hold
+* the lock.
+*/
+static struct directory_entry *find_entry(const char *user_name) {
+    uint32_t id = intern_find(user_name);
+    if (id == INTERN_NONE || id >= entry_capacity || entries[id].count == 0) {
+        return NULL;
+    }
+    return &entries[id];
+}
+
+static int group_order(const void *a, const void *b) {
+    const struct membership *x = a, *y = b;
+    return strcmp(x->group->name, y->group->name);
+}
+
+/* Print to standard output every group that has a user called user_name, in
+* name order, with the user's balance in it. Returns 0, or -1 if no group
+* has such a user.
+*/
+int user_groups(const char *user_name) {
+    pthread_mutex_lock(&lock);
+    struct directory_entry *entry = find_entry(user_name);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    struct membership *sorted = malloc(entry->count * sizeof(struct membership));
+    if (sorted == NULL) {
+        perror("Error allocating memory for user directory. Exiting...");
+        exit(1);
+    }
+    memcpy(sorted, entry->items, entry->count * sizeof(struct membership));
+    qsort(sorted, entry->count, sizeof(struct membership), group_order);
+
+    char amount[CENTS_BUFFER];
+    out_printf("Group \t Balance \n");
+    for (uint32_t i = 0; i < entry->count; i++) {
+        out_printf("%s \t %s \n", sorted[i].group->name, format_cents(sorted[i].user->balance, amount));
+    }
+    free(sorted);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/* Print to standard output the sum of the balances of user_name across every
+* group, and how many groups that is. Returns 0, or -1 if no group has a user
+* called user_name.
+*/
+int total_balance(const char *user_name) {
+    pthread_mutex_lock(&lock);
+    struct directory_entry *entry = find_entry(user_name);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    int64_t total = 0;
+    for (uint32_t i = 0; i < entry->count; i++) {
+        total += entry->items[i].user->balance;
+    }
+    char amount[CENTS_BUFFER];
+    out_printf("Name \t Balance \t Groups \n");
+    out_printf("%s \t %s \t %u \n", intern_name(entry->items[0].user->id), format_cents(total, amount), entry->count);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+static const struct out_list name_list_format = {
+    "Name \t Groups \n", "%s \t %s \n", 2, {"name", "groups"}, 1u << 1
+};
+
+static const struct out_list name_suggest_format = {
+    "Name \t Distance \t Groups \n", "%s \t %s \t %s \n", 3, {"name", "distance", "groups"}, 1u << 1 | 1u << 2
+};
+
+/* Write the row of the name whose trie item is item, with its distance if
+* distance is not NULL. Callers hold the lock.
+*/
+static void name_row(void *item, const char *distance) {
+    uint32_t id = (uint32_t) ((uintptr_t) item - 1);
+    char groups[OUT_U64_BUFFER];
+    out_u64(entries[id].count, groups);
+    if (distance == NULL) {
+        const char *fields[2] = {intern_name(id), groups};
+        out_list_row(&name_list_format, fields);
+    } else {
+        const char *fields[3] = {intern_name(id), distance, groups};
+        out_list_row(&name_suggest_format, fields);
+    }
+}
+
+static void visit_name(void *item, void *context) {
+    name_row(item, NULL);
+}
+
+/* Print to standard output at most limit user names, of any group, that
+* start with prefix, in name order, with the number of groups each is in.
+*/
+void directory_find(const char *prefix, size_t limit) {
+    pthread_mutex_lock(&lock);
+    out_list_begin(&name_list_format);
+    trie_prefix(&names, prefix, limit, visit_name, NULL);
+    out_list_end();
+    pthread_mutex_unlock(&lock);
+}
+
+/* Print to standard output the user names, of any group, closest in spelling
+* to user_name (see trie_suggest), closest first, with how many edits away
+* each is and the number of groups it is in.
+*/
+void directory_suggest(const char *user_name) {
+    struct trie_match matches[TRIE_SUGGEST_LIMIT];
+    char distance[OUT_U64_BUFFER];
+    pthread_mutex_lock(&lock);
+    size_t count = trie_suggest(&names, user_name, matches);
+    out_list_begin(&name_suggest_format);
+    for (size_t i = 0; i < count; i++) {
+        name_row(matches[i].item, out_u64(matches[i].distance, distance));
+    }
+    out_list_end();
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,37 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The user directory: for every interned user name, the groups that have a
+* user of that name. Users register themselves as they are created and leave
+* as they are removed, so questions about one person across every group read
+* only that person's memberships, however many groups there are.
+*
+* Adding and removing memberships may happen on any thread (group commands
+* run on worker threads); a lock keeps them apart. The names themselves are
+* also kept in a trie (see trie.h), to find them by prefix or spelling.
+*/
+
+struct group;
+struct user;
+
+struct membership {
+	struct group *group;
+	struct user *user;
+};
+
+void directory_add(struct group *group, struct user *user);
+void directory_remove(struct user *user);
+void directory_release(void);
+size_t directory_count(void);
+size_t directory_bytes(void);
+int directory_admit(size_t count);
+
+int user_groups(const char *user_name);
+int total_balance(const char *user_name);
+void directory_find(const char *prefix, size_t limit);
+void directory_suggest(const char *user_name);
+
+#endif
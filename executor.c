@@ -0,0 +1,502 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "executor.h"
+#include "output.h"
+#include "trace.h"
+#include "view.h"
+
+#define EXEC_RING_SLOTS 1024		// Commands queued per worker
+#define EXEC_ORDER_SLOTS 8192		// Commands read but not yet written out
+#define EXEC_ARG_BYTES 256		// Longer commands run on the main thread
+#define EXEC_ARGS 6			// Arguments per slot, plus the terminating NULL; bulk commands run on the main thread
+#define EXEC_SPIN 256			// Polls before a waiting thread goes to sleep
+#define EXEC_WAKE_BATCH 64		// Commands queued before a sleeping worker is woken
+#define EXEC_WRITE_BATCH 64		// Entries whose output is written out together
+
+struct exec_slot {
+	Group *group;
+	struct command_args args;	// Pointing into strings below
+	char *cmd_argv[EXEC_ARGS];
+	char strings[EXEC_ARG_BYTES];	// The arguments themselves, copied from the caller
+	OutBuf *out;
+	uint64_t read;			// The read's number, on a reader (see view_pin)
+};
+
+/* The ring between the main thread and one worker. Only the main thread
+* writes head and only the worker writes completed; a slot belongs to the
+* worker from the moment head passes it until completed does.
+*/
+struct exec_worker {
+	pthread_t thread;
+	_Atomic size_t head;		// Slots filled by the main thread
+	_Atomic size_t completed;	// Slots the worker has finished
+	_Atomic int sleeping;		// The worker is, or is about to be, waiting on cond
+	size_t woken_at;		// head when the main thread last woke the worker
+	_Atomic size_t wanted;		// completed value the sleeping main thread needs, or 0
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct exec_slot slots[EXEC_RING_SLOTS];
+};
+
+/* One command, from being read until its output has been written.
+*/
+struct exec_entry {
+	int worker;			// -1 if the main thread ran the command itself
+	size_t ticket;			// Its slot number in the worker's ring
+	OutBuf before;			// Main thread output up to and including the command
+	OutBuf body;			// Output of the command on the worker
+	OutBuf after;			// Main thread output once the command was handed off
+};
+
+static struct exec_worker *workers;
+static int worker_count;
+static int reading;			// The workers are readers, and the main thread the only writer
+static HTable owners;			// Group name -> index of the worker that owns it + 1
+static size_t next_owner;
+static _Atomic int stopping;
+
+static struct exec_entry *entries;
+static size_t entries_begun;
+static size_t entries_written;		// Without workers, commands ended
+static int building;			// The newest entry is still between begin and end
+
+// The main thread sleeps here when it has to wait for a worker
+static pthread_mutex_t main_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t main_cond = PTHREAD_COND_INITIALIZER;
+
+/* Wake worker if it is asleep. The main thread only does this once a batch of
+* commands is waiting, or when it is about to wait for the worker itself.
+*/
+static void wake(struct exec_worker *worker) {
+    if (atomic_load(&worker->sleeping)) {
+        pthread_mutex_lock(&worker->mutex);
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+/* Block the main thread until worker has finished ticket.
+*/
+static void wait_for(struct exec_worker *worker, size_t ticket) {
+    worker->woken_at = atomic_load_explicit(&worker->head, memory_order_relaxed);
+    wake(worker);
+    for (int i = 0; i < EXEC_SPIN; i++) {
+        if (atomic_load_explicit(&worker->completed, memory_order_acquire) > ticket) {
+            return;
+        }
+    }
+    pthread_mutex_lock(&main_mutex);
+    atomic_store(&worker->wanted, ticket + 1);
+    while (atomic_load(&worker->completed) <= ticket) {
+        pthread_cond_wait(&main_cond, &main_mutex);
+    }
+    atomic_store(&worker->wanted, 0);
+    pthread_mutex_unlock(&main_mutex);
+}
+
+static void *work(void *arg) {
+    struct exec_worker *worker = arg;
+    size_t next = 0;
+
+    while (1) {
+        int spins = 0;
+        while (atomic_load(&worker->head) == next && spins < EXEC_SPIN) {
+            spins++;
+        }
+        if (atomic_load(&worker->head) == next) {
+            // Announce the sleep before the final check, so the main thread either
+            // sees sleeping and signals or its new head is seen here
+            pthread_mutex_lock(&worker->mutex);
+            atomic_store(&worker->sleeping, 1);
+            while (atomic_load(&worker->head) == next && !atomic_load(&stopping)) {
+                pthread_cond_wait(&worker->cond, &worker->mutex);
+            }
+            atomic_store(&worker->sleeping, 0);
+            pthread_mutex_unlock(&worker->mutex);
+            if (atomic_load(&worker->head) == next) {
+                break; // Stopping, and nothing left to do
+            }
+        }
+
+        struct exec_slot *slot = &worker->slots[next % EXEC_RING_SLOTS];
+        out_capture(slot->out);
+        process_group_command(&slot->args, slot->group);
+        out_capture(NULL);
+        atomic_store(&worker->completed, ++next);
+
+        size_t wanted = atomic_load(&worker->wanted);
+        if (wanted != 0 && next >= wanted) {
+            pthread_mutex_lock(&main_mutex);
+            pthread_cond_broadcast(&main_cond);
+            pthread_mutex_unlock(&main_mutex);
+        }
+    }
+    return NULL;
+}
+
+/* Start threads workers.
+*/
+static void start_workers(int threads) {
+    worker_count = threads;
+    workers = calloc(threads, sizeof(struct exec_worker));
+    entries = calloc(EXEC_ORDER_SLOTS, sizeof(struct exec_entry));
+    if (workers == NULL || entries == NULL) {
+        perror("Error allocating memory for executor. Exiting...");
+        exit(1);
+    }
+    ht_init(&owners);
+    atomic_store(&stopping, 0);
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&workers[i].mutex, NULL);
+        pthread_cond_init(&workers[i].cond, NULL);
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+            perror("Error starting executor thread. Exiting...");
+            exit(1);
+        }
+    }
+}
+
+/* Start threads workers, each owning some of the groups.
+*/
+void executor_start(int threads) {
+    start_workers(threads);
+}
+
+/* Start readers workers that only run reads, on views of the groups, and
+* leave every change to the main thread.
+*/
+void executor_start_readers(int readers) {
+    reading = 1;
+    start_workers(readers);
+}
+
+/* Write out, in order, the output of every finished entry. With block set,
+* wait for unfinished ones too.
+*/
+static void write_entries(int block) {
+    OutBuf *batch[3 * EXEC_WRITE_BATCH];
+    size_t batched = 0;
+    size_t ready = entries_begun - building;
+    size_t done = entries_written;
+    while (done < ready) {
+        struct exec_entry *entry = &entries[done % EXEC_ORDER_SLOTS];
+        if (entry->worker >= 0) {
+            struct exec_worker *worker = &workers[entry->worker];
+            if (atomic_load_explicit(&worker->completed, memory_order_acquire) <= entry->ticket) {
+                if (!block) {
+                    break;
+                }
+                wait_for(worker, entry->ticket);
+            }
+        }
+        batch[batched++] = &entry->before;
+        batch[batched++] = &entry->body;
+        batch[batched++] = &entry->after;
+        done++;
+        if (batched == 3 * EXEC_WRITE_BATCH) {
+            out_flush_all(batch, batched);
+            entries_written = done;
+            batched = 0;
+        }
+    }
+    // Entries are only given back once their output is out
+    out_flush_all(batch, batched);
+    entries_written = done;
+}
+
+/* Wait until every worker has run everything it has been given.
+*/
+static void drain(void) {
+    for (int i = 0; i < worker_count; i++) {
+        size_t head = atomic_load_explicit(&workers[i].head, memory_order_relaxed);
+        if (head > 0) {
+            wait_for(&workers[i], head - 1);
+        }
+    }
+    if (reading) {
+        view_collect(VIEW_IDLE);
+    }
+}
+
+/* Start capturing the main thread's output for the next command.
+*/
+void executor_begin(void) {
+    if (workers == NULL) {
+        return;
+    }
+    if (entries_begun - entries_written == EXEC_ORDER_SLOTS) {
+        // Out of entries: wait for the older commands and write them out
+        write_entries(1);
+    }
+    struct exec_entry *entry = &entries[entries_begun % EXEC_ORDER_SLOTS];
+    entry->worker = -1;
+    entries_begun++;
+    building = 1;
+    out_capture(&entry->before);
+}
+
+/* Finish the current command's entry and write out whatever is ready.
+*/
+void executor_end(void) {
+    if (workers == NULL) {
+        entries_written++; // Its output is already out
+        return;
+    }
+    out_capture(NULL);
+    building = 0;
+    write_entries(0);
+}
+
+/* Wake every worker that has commands waiting and write out the output of
+* every command that has finished, without waiting for the others. For
+* callers that are idle between commands, so that neither commands short of a
+* wake batch nor finished output are held back until more commands come.
+*/
+void executor_flush(void) {
+    if (workers == NULL || building) {
+        return;
+    }
+    for (int i = 0; i < worker_count; i++) {
+        size_t head = atomic_load_explicit(&workers[i].head, memory_order_relaxed);
+        if (head != workers[i].woken_at) {
+            workers[i].woken_at = head;
+            wake(&workers[i]);
+        }
+    }
+    write_entries(0);
+}
+
+/* Number of commands whose output has been written out, in input order.
+* Without workers that is every command that has ended.
+*/
+size_t executor_written(void) {
+    return entries_written;
+}
+
+static int owner_of(Group *group) {
+    uintptr_t item = (uintptr_t) ht_get(&owners, group->name);
+    if (item == 0) {
+        // Round robin rather than hashing, so a few groups still spread over all workers
+        item = next_owner++ % worker_count + 1;
+        ht_put(&owners, group->name, (void *) item);
+    }
+    return (int) item - 1;
+}
+
+/* Copy the strings of args into slot, pointing slot->args at the copies.
+* Returns -1 if they do not fit.
+*/
+static int copy_args(struct exec_slot *slot, const struct command_args *args) {
+    const char *sources[EXEC_ARGS];
+    size_t lengths[EXEC_ARGS];
+    int count = 0;
+    size_t total = 0;
+
+    if (args->argc >= EXEC_ARGS) {
+        return -1;
+    }
+    if (args->argv != NULL) {
+        for (count = 0; count < args->argc; count++) {
+            sources[count] = args->argv[count];
+        }
+    } else {
+        // A binary command: only the names need copying
+        sources[count++] = args->group;
+        if (args->user != NULL) {
+            sources[count++] = args->user;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        lengths[i] = strlen(sources[i]) + 1;
+        total += lengths[i];
+    }
+    if (total > EXEC_ARG_BYTES) {
+        return -1;
+    }
+
+    char *p = slot->strings;
+    for (int i = 0; i < count; i++) {
+        memcpy(p, sources[i], lengths[i]);
+        slot->cmd_argv[i] = p;
+        p += lengths[i];
+    }
+    slot->cmd_argv[count] = NULL;
+
+    slot->args = *args;
+    if (args->argv != NULL) {
+        slot->args.argv = slot->cmd_argv;
+        slot->args.group = slot->cmd_argv[1];
+        slot->args.user = args->user != NULL ? slot->cmd_argv[2] : NULL;
+    } else {
+        slot->args.group = slot->cmd_argv[0];
+        slot->args.user = args->user != NULL ? slot->cmd_argv[1] : NULL;
+    }
+    return 0;
+}
+
+/* Hand the command to worker owner, to run against group. Returns -1,
+* leaving the command to the caller, if its arguments do not fit in a slot.
+*/
+static int route(int owner, Group *group, const struct command_args *args) {
+    struct exec_worker *worker = &workers[owner];
+    size_t head = atomic_load_explicit(&worker->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&worker->completed, memory_order_acquire) == EXEC_RING_SLOTS) {
+        // Full: let the worker get well ahead rather than trading single slots
+        wait_for(worker, head - EXEC_RING_SLOTS / 2);
+    }
+
+    struct exec_entry *entry = &entries[(entries_begun - 1) % EXEC_ORDER_SLOTS];
+    struct exec_slot *slot = &worker->slots[head % EXEC_RING_SLOTS];
+    if (copy_args(slot, args) == -1) {
+        return -1;
+    }
+    slot->group = group;
+    slot->read = reading ? view_pin() : 0;
+    slot->out = &entry->body;
+    entry->worker = owner;
+    entry->ticket = head;
+
+    atomic_store(&worker->head, head + 1);
+    if (reading || head + 1 - worker->woken_at >= EXEC_WAKE_BATCH) { // A read is worth starting at once
+        worker->woken_at = head + 1;
+        wake(worker);
+    }
+    out_capture(&entry->after);
+    return 0;
+}
+
+/* The number of the oldest read that a reader has not finished, or VIEW_IDLE.
+*/
+static uint64_t oldest_read(void) {
+    uint64_t oldest = VIEW_IDLE;
+    for (int i = 0; i < worker_count; i++) {
+        size_t completed = atomic_load_explicit(&workers[i].completed, memory_order_acquire);
+        size_t head = atomic_load_explicit(&workers[i].head, memory_order_relaxed);
+        if (completed < head && workers[i].slots[completed % EXEC_RING_SLOTS].read < oldest) {
+            oldest = workers[i].slots[completed % EXEC_RING_SLOTS].read;
+        }
+    }
+    return oldest;
+}
+
+/* Hand a read of group to the reader with the least left to do, against a
+* view of group as it is now. Returns -1, leaving the command to the caller,
+* if its arguments do not fit in a slot.
+*/
+static int read_view(Group *group, const struct command_args *args) {
+    int reader = 0;
+    size_t least = SIZE_MAX;
+    for (int i = 0; i < worker_count; i++) {
+        size_t pending = atomic_load_explicit(&workers[i].head, memory_order_relaxed) -
+                         atomic_load_explicit(&workers[i].completed, memory_order_relaxed);
+        if (pending < least) {
+            reader = i;
+            least = pending;
+        }
+    }
+    view_collect(oldest_read());
+
+    int flags = commands[args->op].flags;
+    Group *view = view_take(group, (flags & CMD_VIEW_USERS) != 0, (flags & CMD_VIEW_XCTS) != 0);
+    return route(reader, view, args);
+}
+
+/* Run a parsed command: on its group's worker if possible, otherwise here.
+* Returns what process_command would.
+*/
+int execute_command(const struct command_args *args, Group **group_list_addr) {
+    if (workers == NULL) {
+        return process_command(args, group_list_addr);
+    }
+
+    int flags = commands[args->op].flags;
+    if (reading) {
+        if (flags & (CMD_VIEW_USERS | CMD_VIEW_XCTS)) {
+            Group *group = args->target != NULL ? args->target : find_group(*group_list_addr, args->group);
+            if (group != NULL && read_view(group, args) == 0) {
+                return 0;
+            }
+        }
+        if (flags & CMD_BARRIER) {
+            drain(); // Load frees the groups that views share chunks with
+        }
+        return process_command(args, group_list_addr);
+    }
+
+    if (flags & CMD_GROUP) {
+        Group *group = args->target != NULL ? args->target : find_group(*group_list_addr, args->group);
+        if (group != NULL && route(owner_of(group), group, args) == 0) {
+            return 0;
+        }
+        if (group != NULL) {
+            drain(); // Too long for a slot, so run it here once its group is idle
+        }
+        return process_command(args, group_list_addr);
+    }
+
+    if (flags & CMD_BARRIER) {
+        drain();
+    }
+    int result = process_command(args, group_list_addr);
+    if (args->op == OP_LOAD) {
+        // The groups the owners table names are gone
+        ht_free(&owners);
+        ht_init(&owners);
+    }
+    return result;
+}
+
+/* Run a text command, as execute_command does. Returns what process_args
+* would.
+*/
+int execute(int cmd_argc, char **cmd_argv, Group **group_list_addr) {
+    struct command_args args;
+
+    trace_record(cmd_argc, cmd_argv);
+
+    if (cmd_argc <= 0 || command_parse(cmd_argc, cmd_argv, &args) == -1) {
+        return process_args(cmd_argc, cmd_argv, group_list_addr);
+    }
+    return execute_command(&args, group_list_addr);
+}
+
+/* Run everything still queued, write out all remaining output and stop the
+* workers.
+*/
+void executor_finish(void) {
+    if (workers == NULL) {
+        return;
+    }
+    out_capture(NULL);
+    building = 0;
+    drain();
+    write_entries(1);
+
+    atomic_store(&stopping, 1);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_mutex_lock(&workers[i].mutex);
+        pthread_cond_signal(&workers[i].cond);
+        pthread_mutex_unlock(&workers[i].mutex);
+        pthread_join(workers[i].thread, NULL);
+        pthread_mutex_destroy(&workers[i].mutex);
+        pthread_cond_destroy(&workers[i].cond);
+    }
+    for (size_t i = 0; i < EXEC_ORDER_SLOTS; i++) {
+        out_free(&entries[i].before);
+        out_free(&entries[i].body);
+        out_free(&entries[i].after);
+    }
+    free(entries);
+    free(workers);
+    entries = NULL;
+    workers = NULL;
+    reading = 0;
+    ht_free(&owners);
+    entries_begun = entries_written = 0;
+    next_owner = 0;
+    fflush(stdout);
+}
@@ -0,0 +1,45 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "commands.h"
+
+/* Parallel batch execution, partitioned by group.
+*
+* The main thread keeps reading and parsing commands. Each command that acts
+* on a single existing group (CMD_GROUP in the command table) goes to the worker thread
+* that owns the group, through a single-producer single-consumer ring, so
+* every group's commands still run one at a time and in input order. The main
+* thread runs everything else itself: add_group and list_groups straight away,
+* and commands that look at more than one group (pool_stats, save, load) only
+* once every worker has caught up.
+*
+* Every command's output, including the echo and prompt around it, is
+* captured and written out in input order, so the result is byte for byte
+* what a serial run prints.
+*
+* executor_start_readers starts readers instead, for a single writer: every
+* command runs on the main thread except reads of one group that are marked
+* CMD_VIEW_USERS or CMD_VIEW_XCTS, which go to the least busy reader along
+* with a view of the group as it is at that point (see view.h). The writer
+* goes straight on to the next command without waiting for the read, and the
+* read sees none of the changes made after it, so the output is still that of
+* a serial run.
+*
+* Without either start function all of this is bypassed: executor_begin and
+* executor_end do nothing, execute is just process_args and execute_command
+* is just process_command.
+*/
+
+#define EXECUTOR_MAX_THREADS 256
+
+void executor_start(int threads);
+void executor_start_readers(int readers);
+void executor_begin(void);
+int execute(int cmd_argc, char **cmd_argv, Group **group_list_addr);
+int execute_command(const struct command_args *args, Group **group_list_addr);
+void executor_end(void);
+void executor_flush(void);
+size_t executor_written(void);
+void executor_finish(void);
+
+#endif
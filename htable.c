@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htable.h"
+#include "stats.h"
+
+#define HT_MIN_CAPACITY 16
+
+/* Marks a slot whose entry was removed. Probing continues past it, inserts may
+* reuse it.
+*/
+static const char ht_tombstone_key[] = "";
+#define HT_TOMBSTONE ht_tombstone_key
+
+/* Initialize an empty table. No memory is allocated until the first insert.
+*/
+void ht_init(HTable *table) {
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->used = 0;
+}
+
+/* Release the slot array of table. The items and keys are not touched.
+*/
+void ht_free(HTable *table) {
+    free(table->slots);
+    ht_init(table);
+}
+
+/* 32-bit FNV-1a hash of a NUL terminated key.
+*/
+uint32_t ht_hash(const char *key) {
+    uint32_t hash = 2166136261u;
+    while (*key != '\0') {
+        hash ^= (unsigned char) *key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Return the index of the slot holding key, or of the empty slot where key
+* would be inserted if it is absent. The first tombstone found on the way is
+* preferred for inserts, so *found tells the two cases apart.
+*/
+static size_t ht_probe(const HTable *table, const char *key, uint32_t hash, int *found) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    size_t insert_at = table->capacity; // No tombstone seen yet
+    uint64_t probes = 1;
+
+    stats_add(STAT_HASH_LOOKUPS, 1);
+    while (table->slots[i].key != NULL) {
+        if (table->slots[i].key == HT_TOMBSTONE) {
+            if (insert_at == table->capacity) {
+                insert_at = i;
+            }
+        }
+        else if (table->slots[i].hash == hash && strcmp(table->slots[i].key, key) == 0) {
+            stats_add(STAT_HASH_PROBES, probes);
+            *found = 1;
+            return i;
+        }
+        i = (i + 1) & mask;
+        probes++;
+    }
+
+    stats_add(STAT_HASH_PROBES, probes);
+    *found = 0;
+    return insert_at == table->capacity ? i : insert_at;
+}
+
+/* Move every live entry of table into a fresh slot array with new_capacity
+* slots. Tombstones are dropped on the way.
+*/
+static void ht_resize(HTable *table, size_t new_capacity) {
+    struct htable_slot *old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+
+    table->slots = calloc(new_capacity, sizeof(struct htable_slot));
+    if (table->slots == NULL) {
+        perror("Error allocating memory for hash table. Exiting...");
+        exit(1);
+    }
+    table->capacity = new_capacity;
+    table->used = table->count;
+
+    for (size_t j = 0; j < old_capacity; j++) {
+        if (old_slots[j].key == NULL || old_slots[j].key == HT_TOMBSTONE) {
+            continue;
+        }
+        size_t i = old_slots[j].hash & (new_capacity - 1);
+        while (table->slots[i].key != NULL) {
+            i = (i + 1) & (new_capacity - 1);
+        }
+        table->slots[i] = old_slots[j];
+    }
+    free(old_slots);
+}
+
+/* Return the item stored under key, or NULL if there is none.
+*/
+void *ht_get(const HTable *table, const char *key) {
+    if (table->count == 0) {
+        return NULL;
+    }
+    int found;
+    size_t i = ht_probe(table, key, ht_hash(key), &found);
+    return found ? table->slots[i].item : NULL;
+}
+
+/* Insert item under key. Returns 0 on success and -1 if key is already present.
+*/
+int ht_put(HTable *table, const char *key, void *item) {
+    // Keep the load (live entries and tombstones) under 3/4
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        size_t new_capacity = table->capacity == 0 ? HT_MIN_CAPACITY : table->capacity;
+        while ((table->count + 1) * 2 > new_capacity) {
+            new_capacity *= 2;
+        }
+        ht_resize(table, new_capacity);
+    }
+
+    uint32_t hash = ht_hash(key);
+    int found;
+    size_t i = ht_probe(table, key, hash, &found);
+    if (found) {
+        return -1;
+    }
+
+    if (table->slots[i].key == NULL) {
+        table->used++;
+    }
+    table->slots[i].key = key;
+    table->slots[i].item = item;
+    table->slots[i].hash = hash;
+    table->count++;
+    return 0;
+}
+
+/* Remove key from table and return the item that was stored under it, or NULL
+* if key was not present.
+*/
+void *ht_remove(HTable *table, const char *key) {
+    if (table->count == 0) {
+        return NULL;
+    }
+    int found;
+    size_t i = ht_probe(table, key, ht_hash(key), &found);
+    if (!found) {
+        return NULL;
+    }
+
+    void *item = table->slots[i].item;
+    table->slots[i].key = HT_TOMBSTONE;
+    table->slots[i].item = NULL;
+    table->count--;
+    return item;
+}
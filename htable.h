@@ -0,0 +1,34 @@
+#ifndef HTABLE_H
+#define HTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* An open-addressing (linear probing) hash table mapping a name to an item.
+* The table does not own the keys: each key must point at storage that lives
+* at least as long as the entry (normally the name field of the item itself).
+*/
+struct htable_slot {
+	const char *key;	// NULL for an empty slot, HT_TOMBSTONE for a deleted one
+	void *item;
+	uint32_t hash;
+};
+
+struct htable {
+	struct htable_slot *slots;
+	size_t capacity;	// Always a power of two (or 0 before the first insert)
+	size_t count;		// Live entries
+	size_t used;		// Live entries plus tombstones
+};
+
+typedef struct htable HTable;
+
+void ht_init(HTable *table);
+void ht_free(HTable *table);
+uint32_t ht_hash(const char *key);
+
+void *ht_get(const HTable *table, const char *key);
+int ht_put(HTable *table, const char *key, void *item);
+void *ht_remove(HTable *table, const char *key);
+
+#endif
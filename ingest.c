@@ -0,0 +1,128 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "executor.h"
+#include "ingest.h"
+
+#define INGEST_STDOUT_BUFFER (1 << 20)
+
+/* Split the line [start, end) into arguments by overwriting the spaces after
+* each one with NUL, exactly like strtok with the batch mode delimiters. *end
+* must be writable. Returns the argument count, or -1 if there are too many
+* arguments.
+*/
+int tokenize_line(char *start, char *end, char **cmd_argv) {
+    int cmd_argc = 0;
+    char *p = start;
+
+    while (p < end) {
+        while (p < end && *p == ' ') {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        if (cmd_argc >= INPUT_ARG_MAX_NUM - 1) {
+            return -1;
+        }
+        cmd_argv[cmd_argc++] = p;
+        while (p < end && *p != ' ') {
+            p++;
+        }
+        *p++ = '\0'; // p may be end, which is always a writable '\n' or spare byte
+    }
+    cmd_argv[cmd_argc] = NULL;
+    return cmd_argc;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run every command in the file at path against the groups at
+* group_list_addr, stopping early at quit. Fills in stats (which may be NULL)
+* and returns 0, or -1 if the file cannot be read.
+*/
+int ingest_file(const char *path, Group **group_list_addr, struct ingest_stats *stats) {
+    char *cmd_argv[INPUT_ARG_MAX_NUM];
+    struct stat st;
+    double started = now_seconds();
+    size_t commands = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t) st.st_size;
+    char *data = NULL;
+    if (size > 0) {
+        // A private writable mapping lets the tokenizer write NULs without touching the file
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    setvbuf(stdout, NULL, _IOFBF, INGEST_STDOUT_BUFFER);
+
+    char *p = data;
+    char *end = data + size;
+    char *last_line = NULL;
+    while (p < end) {
+        char *line_end = memchr(p, '\n', end - p);
+        if (line_end == NULL) {
+            // The last line has no newline to overwrite, so give it one in a copy
+            last_line = malloc(end - p + 1);
+            if (last_line == NULL) {
+                perror("Error allocating memory for last line. Exiting...");
+                exit(1);
+            }
+            memcpy(last_line, p, end - p);
+            line_end = last_line + (end - p);
+            *line_end = '\n';
+            p = last_line;
+        }
+
+        int cmd_argc = tokenize_line(p, line_end, cmd_argv);
+        int quit = 0;
+        p = line_end + 1;
+        executor_begin();
+        if (cmd_argc == -1) {
+            error("Too many arguments!");
+        } else if (cmd_argc > 0) {
+            commands++;
+            quit = execute(cmd_argc, cmd_argv, group_list_addr) == -1;
+        }
+        executor_end();
+        if (quit || last_line != NULL) {
+            break; /* quit command was entered, or that was the last line */
+        }
+    }
+
+    fflush(stdout);
+    if (stats != NULL) {
+        stats->commands = commands;
+        stats->bytes = last_line != NULL ? size : (size_t) (p - data);
+        stats->seconds = now_seconds() - started;
+    }
+    free(last_line);
+    if (data != NULL) {
+        munmap(data, size);
+    }
+    return 0;
+}
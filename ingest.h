@@ -0,0 +1,20 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include "lists.h"
+
+/* Fast batch replay: the command file is memory-mapped and tokenized in
+* place, nothing is echoed and no prompts are printed, and command output goes
+* through a large stdout buffer. Commands behave exactly as in batch mode.
+*/
+
+struct ingest_stats {
+	size_t commands;		// Non-empty lines handed to process_args
+	size_t bytes;			// Bytes of the file consumed
+	double seconds;
+};
+
+int tokenize_line(char *start, char *end, char **cmd_argv);
+int ingest_file(const char *path, Group **group_list_addr, struct ingest_stats *stats);
+
+#endif
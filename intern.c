@@ -0,0 +1,213 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htable.h"
+#include "intern.h"
+#include "memory.h"
+
+#define INTERN_MAX_RETIRED 32
+
+static HTable by_name;		// Name -> ID + 1 (so that no item is NULL)
+static const char **_Atomic names;	// ID -> name, or NULL for a free ID, read without the lock
+static uint32_t *refs;			// ID -> users holding the name
+static uint32_t *free_ids;		// IDs whose names were released, handed out again first
+static size_t free_count;
+static size_t count;			// IDs handed out, free ones included
+static size_t capacity;
+static size_t string_bytes;		// Taken by the name strings themselves
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Arrays names has outgrown. They stay allocated until intern_release, so a
+// thread reading an old array in intern_name still finds every ID it can know.
+static const char **retired[INTERN_MAX_RETIRED];
+static size_t retired_count;
+static size_t retired_bytes;
+
+static uint32_t find_locked(const char *name) {
+    uintptr_t item = (uintptr_t) ht_get(&by_name, name);
+    return item == 0 ? INTERN_NONE : (uint32_t) (item - 1);
+}
+
+/* Make room for one more ID than count, returning the ID array. The lock
+* must be held.
+*/
+static const char **grow_locked(void) {
+    const char **current = atomic_load_explicit(&names, memory_order_relaxed);
+    if (count == capacity) {
+        capacity = capacity == 0 ? 256 : capacity * 2;
+        const char **grown = malloc(capacity * sizeof(char *));
+        refs = realloc(refs, capacity * sizeof(uint32_t));
+        free_ids = realloc(free_ids, capacity * sizeof(uint32_t));
+        if (grown == NULL || refs == NULL || free_ids == NULL) {
+            perror("Error allocating memory for interned names. Exiting...");
+            exit(1);
+        }
+        if (current != NULL) {
+            memcpy(grown, current, count * sizeof(char *));
+            retired[retired_count++] = current;
+            retired_bytes += count * sizeof(char *);
+        }
+        atomic_store_explicit(&names, grown, memory_order_release);
+        current = grown;
+    }
+    return current;
+}
+
+/* Give name a free ID, or a new one, with a single reference. The lock must
+* be held and name must not be interned yet.
+*/
+static uint32_t add_locked(const char *name) {
+    const char **current = free_count > 0 ? atomic_load_explicit(&names, memory_order_relaxed) : grow_locked();
+    size_t length = strlen(name) + 1;
+    char *copy = malloc(length);
+    if (copy == NULL) {
+        perror("Error allocating memory for interned names. Exiting...");
+        exit(1);
+    }
+    memcpy(copy, name, length);
+    string_bytes += length;
+    uint32_t id = free_count > 0 ? free_ids[--free_count] : (uint32_t) count++;
+    current[id] = copy;
+    refs[id] = 1;
+    atomic_store_explicit(&names, current, memory_order_release);
+    ht_put(&by_name, copy, (void *) (uintptr_t) (id + 1));
+    return id;
+}
+
+/* Return the ID of name, interning it first if it has not been seen before,
+* and take a reference to it, which intern_unref gives back.
+*/
+uint32_t intern(const char *name) {
+    pthread_mutex_lock(&lock);
+    uint32_t id = find_locked(name);
+    if (id != INTERN_NONE) {
+        refs[id]++;
+        pthread_mutex_unlock(&lock);
+        return id;
+    }
+
+    // The table is shared by every group, so it is charged to none of them
+    size_t bytes = intern_bytes();
+    id = add_locked(name);
+    mem_charge(NULL, MEM_NAME, intern_bytes() - bytes);
+    pthread_mutex_unlock(&lock);
+    return id;
+}
+
+/* Take another reference to the name interned under id.
+*/
+void intern_ref(uint32_t id) {
+    pthread_mutex_lock(&lock);
+    refs[id]++;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Give back a reference to the name interned under id. Once none is left the
+* name is freed and id may be handed out again, so nothing may look it up
+* any more, not even a read view.
+*/
+void intern_unref(uint32_t id) {
+    pthread_mutex_lock(&lock);
+    if (--refs[id] > 0) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    size_t bytes = intern_bytes();
+    const char **current = atomic_load_explicit(&names, memory_order_relaxed);
+    char *name = (char *) current[id];
+    ht_remove(&by_name, name);
+    string_bytes -= strlen(name) + 1;
+    free(name);
+    current[id] = NULL;
+    free_ids[free_count++] = id;
+    mem_credit(NULL, MEM_NAME, bytes - intern_bytes());
+    pthread_mutex_unlock(&lock);
+}
+
+/* Intern the count names of a saved table, which must be empty, under the
+* IDs they had: the ID of each is its position, and an empty name stands for
+* a free ID. Each name gets one reference, held by the caller.
+*/
+void intern_load(const char **saved, size_t saved_count) {
+    pthread_mutex_lock(&lock);
+    size_t bytes = intern_bytes();
+    for (size_t id = 0; id < saved_count; id++) {
+        if (saved[id][0] != '\0') {
+            add_locked(saved[id]);
+        } else {
+            const char **current = grow_locked();
+            current[count] = NULL;
+            refs[count++] = 0;
+        }
+    }
+    // Highest first, so that the lowest free IDs are handed out again first
+    for (size_t id = saved_count; id-- > 0;) {
+        if (saved[id][0] == '\0') {
+            free_ids[free_count++] = (uint32_t) id;
+        }
+    }
+    mem_charge(NULL, MEM_NAME, intern_bytes() - bytes);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Return the ID of name, or INTERN_NONE if it is not interned. Never
+* allocates or takes a reference.
+*/
+uint32_t intern_find(const char *name) {
+    pthread_mutex_lock(&lock);
+    uint32_t id = find_locked(name);
+    pthread_mutex_unlock(&lock);
+    return id;
+}
+
+/* Return the name interned under id.
+*/
+const char *intern_name(uint32_t id) {
+    return atomic_load_explicit(&names, memory_order_acquire)[id];
+}
+
+/* Number of distinct names interned now.
+*/
+size_t intern_count(void) {
+    return count - free_count;
+}
+
+/* One more than the highest ID handed out, free or not.
+*/
+size_t intern_limit(void) {
+    return count;
+}
+
+/* Bytes held by the table, including the strings.
+*/
+size_t intern_bytes(void) {
+    return string_bytes + capacity * (sizeof(char *) + 2 * sizeof(uint32_t)) + retired_bytes +
+           by_name.capacity * sizeof(struct htable_slot);
+}
+
+/* Forget every interned name and free the table.
+*/
+void intern_release(void) {
+    mem_credit(NULL, MEM_NAME, intern_bytes());
+    ht_free(&by_name);
+    for (size_t id = 0; id < count; id++) {
+        free((char *) names[id]);
+    }
+    free((void *) names);
+    names = NULL;
+    free(refs);
+    refs = NULL;
+    free(free_ids);
+    free_ids = NULL;
+    free_count = 0;
+    string_bytes = 0;
+    for (size_t i = 0; i < retired_count; i++) {
+        free((void *) retired[i]);
+    }
+    retired_count = 0;
+    retired_bytes = 0;
+    count = 0;
+    capacity = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INTERN_NONE UINT32_MAX	// Returned by intern_find for unknown names
+
+/* A process-wide table of user names. Every distinct name is stored exactly
+* once and gets a small integer ID, handed out in order from 0. Each user
+* holds a reference to its name; once the last is given back the name is
+* freed and its ID handed out again, so churn through new names
+* does not grow the table. A name's pointer and ID stay valid while it has a
+* reference. intern, intern_ref, intern_unref and intern_find may be called
+* from any thread; intern_name takes no lock at all.
+*/
+
+uint32_t intern(const char *name);
+void intern_ref(uint32_t id);
+void intern_unref(uint32_t id);
+void intern_load(const char **saved, size_t saved_count);
+uint32_t intern_find(const char *name);
+const char *intern_name(uint32_t id);
+size_t intern_count(void);
+size_t intern_limit(void);
+size_t intern_bytes(void);
+void intern_release(void);
+
+#endif
@@ -1,7 +1,24 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "cold.h"
+#include "columns.h"
+#include "directory.h"
 #include "lists.h"
+#include "output.h"
+#include "stats.h"
+#include "view.h"
+
+/* Put item into table under key, charging any growth of the table's slots to
+* account as kind.
+*/
+static void index_put(HTable *table, const char *key, void *item, struct mem_account *account, int kind) {
+    size_t capacity = table->capacity;
+    ht_put(table, key, item);
+    mem_charge(account, kind, (table->capacity - capacity) * sizeof(struct htable_slot));
+}
 
 /* Add a group with name group_name to the group_list referred to by 
 * group_list_ptr. The groups are ordered by the time that the group was 
@@ -27,55 +44,94 @@ int add_group(Group **group_list_ptr, const char *group_name) {
     }
    
     // Initialize Fields
-    int name_length = (int) strlen(group_name); 
-    new_group->name = malloc(name_length + 1);
-    if (new_group == NULL){
-	perror("Error allocating memory for group name. Exiting...");
-	exit(1); 
-    }    
-
-    strncpy(new_group->name, group_name, name_length);
-    new_group->name[name_length] = '\0';
+    // Everything the group allocates from now on comes out of its own arena
+    arena_init(&new_group->arena);
+    slab_init(&new_group->user_slab, &new_group->arena, sizeof(User));
+    slab_init(&new_group->chunk_slab, &new_group->arena, sizeof(struct xct_chunk));
+    slab_init(&new_group->link_slab, &new_group->arena, USER_MAX_LEVEL * sizeof(struct user_link));
+    new_group->name = arena_strdup(&new_group->arena, group_name);
 
     new_group->users = NULL; // Next three will be NULL since Group hasn't been initialized
-    new_group->xcts = NULL;
+    new_group->xct_chunks = NULL;
+    new_group->xct_cold = NULL;
+    new_group->xct_chunk_start = NULL;
+    new_group->xct_chunk_capacity = 0;
+    new_group->xct_cold_count = 0;
+    new_group->xct_cold_bytes = 0;
+    new_group->xct_rows = 0;
+    new_group->xct_live = 0;
+    new_group->xct_last_time = INT64_MIN;
+    new_group->balance_total = 0;
+    new_group->balance_squares = 0;
     new_group->next = NULL;
+    new_group->index = NULL;
+    new_group->view = NULL;
+    new_group->order_version = 0;
+    new_group->view_version = 0;
+    memset(&new_group->memory, 0, sizeof(new_group->memory));
+    mem_charge(&new_group->memory, MEM_GROUP, sizeof(Group));
+    mem_charge(&new_group->memory, MEM_NAME, strlen(group_name) + 1);
+    ht_init(&new_group->user_index);
+    trie_init(&new_group->user_trie);
+    rank_init(new_group);
 
     // Now, let's insert into list.
     // First, check that there actually are elements in the list
     
     if (*group_list_ptr == NULL) {
+	// The first group owns the index for the whole list
+	new_group->index = malloc(sizeof(struct group_index));
+	if (new_group->index == NULL){
+	    perror("Error allocating memory for group index. Exiting...");
+	    exit(1);
+	}
+	mem_charge(NULL, MEM_GROUP, sizeof(struct group_index));
+	ht_init(&new_group->index->by_name);
+	index_put(&new_group->index->by_name, new_group->name, new_group, NULL, MEM_GROUP);
+	new_group->index->tail = new_group;
 	*group_list_ptr = new_group; // Point to this new group, group added!
         return 0;
     }
     
-    Group *current = *group_list_ptr; // To iterate over the list
-
-    while (current->next != NULL) { // Go to the very last element of the list
-        current = current->next;
-    }
-
-    current->next = new_group; // And add the new list!
+    // The index remembers the last group, so there is no need to walk the list
+    struct group_index *index = (*group_list_ptr)->index;
+    index_put(&index->by_name, new_group->name, new_group, NULL, MEM_GROUP);
+    index->tail->next = new_group; // And add the new list!
+    index->tail = new_group;
     return 0;
 }
 
-/* Print to standard output the names of all groups in group_list, one name
-*  per line. Output is in the same order as group_list.
+static const struct out_list group_list_format = {
+    NULL, "%s \n", 1, {"name"}, 0
+};
+
+/* Print to standard output the names of at most count groups in group_list,
+*  one name per line, starting with the one at position cursor (0 for the
+*  first). Output is in the same order as group_list, and ends with the
+*  cursor of the next page if there are groups left.
 */
-void list_groups(Group *group_list) {
+void list_groups(Group *group_list, size_t count, size_t cursor) {
 
-    if (group_list == NULL) { // If list is empty,    
-	printf("No groups have been added yet \n"); 
+    if (group_list == NULL && out_format == OUT_TEXT) { // If list is empty,    
+	out_printf("No groups have been added yet \n"); 
 	return;
     }    
 
     Group *current = group_list; // To iterate over the list	    
+    for (size_t i = 0; i < cursor && current != NULL; i++){
+	current = current->next;
+    }
 
-    while (current != NULL){
-	printf("%s \n", current->name);
+    size_t i;
+    out_list_begin(&group_list_format);
+    for (i = 0; i < count && current != NULL; i++){
+	out_list_row(&group_list_format, (const char *const *) &current->name);
 	current = current->next;
     }
-    
+    if (current != NULL){
+	out_list_cursor(cursor + i);
+    }
+    out_list_end();
 }
 
 /* Search the list of groups for a group with matching group_name
@@ -89,16 +145,120 @@ Group *find_group(Group *group_list, const char *group_name) {
 	return NULL;
     }
 
-    Group *current = group_list; // To iterate over the list
-    
+    return ht_get(&group_list->index->by_name, group_name);
+}
+
+/* Free every group in group_list along with all of its users and transactions,
+* and empty the user directory, which only ever refers to this list.
+* Each group's nodes live in its own arena, so this is one release per group
+* rather than one free per node. No read of a view may be running.
+*/
+void free_groups(Group *group_list) {
+
+    directory_release();
+    view_collect(VIEW_IDLE); // Retired chunks go back to slabs released below
+    if (group_list == NULL){
+	return;
+    }
+
+    mem_credit(NULL, MEM_GROUP, sizeof(struct group_index) + group_list->index->by_name.capacity * sizeof(struct htable_slot));
+    ht_free(&group_list->index->by_name);
+    free(group_list->index);
+
+    Group *current = group_list;
     while (current != NULL){
-	if (strcmp(current->name, group_name) == 0){
-	    return current;
+	Group *next = current->next;
+	view_release(current);
+	ht_free(&current->user_index);
+	trie_free(&current->user_trie);
+	for (size_t i = 0; i < current->xct_chunk_capacity; i++){
+	    free(current->xct_cold[i]);
 	}
-	current = current->next;
+	free(current->xct_chunks);
+	free(current->xct_cold);
+	free(current->xct_chunk_start);
+	slab_release(&current->user_slab);
+	slab_release(&current->chunk_slab);
+	slab_release(&current->link_slab);
+	arena_release(&current->arena);
+	mem_close(&current->memory);
+	free(current);
+	current = next;
+    }
+}
+
+/* Print to standard output how much memory the pools of group hold, or the
+* totals over all groups in group_list if group is NULL, followed by the
+* resident set size of the whole process.
+*/
+void pool_stats(Group *group_list, Group *group) {
+
+    size_t groups = 0, reserved = 0, used = 0;
+    size_t users = 0, free_users = 0, xcts = 0, chunks = 0, tall_links = 0, blocks = 0, block_bytes = 0;
+
+    Group *current = group != NULL ? group : group_list;
+    while (current != NULL){
+	groups++;
+	reserved += current->arena.reserved;
+	used += current->arena.used;
+	users += current->user_slab.live;
+	free_users += current->user_slab.free;
+	xcts += current->xct_live;
+	chunks += current->chunk_slab.live;
+	blocks += current->xct_cold_count;
+	block_bytes += current->xct_cold_bytes;
+	tall_links += current->link_slab.live;
+	current = group != NULL ? NULL : current->next;
     }
 
-    return NULL;
+    out_printf("Groups: %zu \n", groups);
+    out_printf("Arena bytes: %zu reserved, %zu used \n", reserved, used);
+    out_printf("Users: %zu live, %zu free, %zu bytes each, %zu with tall links \n",
+	   users, free_users, group_list != NULL ? group_list->user_slab.object_size : sizeof(User), tall_links);
+    out_printf("Transactions: %zu live in %zu chunks of %d, %zu bytes each \n",
+	   xcts, chunks, XCT_CHUNK_ROWS, (sizeof(struct xct_chunk) - offsetof(struct xct_chunk, uid)) / XCT_CHUNK_ROWS);
+    out_printf("Cold blocks: %zu sealed, %zu bytes, %.1f bytes per row \n",
+	   blocks, block_bytes, blocks > 0 ? (double) block_bytes / (blocks * XCT_CHUNK_ROWS) : 0.0);
+    out_printf("Column kernels: %s \n", col_kernel_name());
+    out_printf("Names: %zu interned, %zu bytes \n", intern_count(), intern_bytes());
+    out_printf("Directory: %zu memberships, %zu bytes \n", directory_count(), directory_bytes());
+    out_printf("Process RSS: %zu bytes \n", process_rss());
+}
+
+/* Print to standard output the memory accounted to group, or to the whole
+* process if group is NULL, as the objects and bytes of each kind, then the
+* total and the budget it is held to. The process also holds the user names
+* every group shares, which no single group is charged for.
+*/
+void memory_usage(Group *group_list, Group *group) {
+
+    size_t objects[MEM_KIND_COUNT] = {0};
+    size_t bytes[MEM_KIND_COUNT];
+
+    Group *current = group != NULL ? group : group_list;
+    while (current != NULL){
+	objects[MEM_GROUP]++;
+	objects[MEM_USER] += current->user_count;
+	objects[MEM_XCT] += current->xct_live;
+	objects[MEM_NAME]++;
+	current = group != NULL ? NULL : current->next;
+    }
+    if (group == NULL){
+	objects[MEM_NAME] += intern_count();
+    }
+    for (int kind = 0; kind < MEM_KIND_COUNT; kind++){
+	bytes[kind] = group != NULL ? group->memory.bytes[kind] : mem_kind_total(kind);
+	out_printf("%s: %zu, %zu bytes \n", mem_kind_names[kind], objects[kind], bytes[kind]);
+    }
+
+    size_t total = group != NULL ? mem_account_bytes(&group->memory) : mem_total();
+    size_t budget = group != NULL ? mem_group_budget : mem_budget;
+    if (budget > 0){
+	out_printf("Total: %zu bytes of a %zu byte budget \n", total, budget);
+    }
+    else {
+	out_printf("Total: %zu bytes, no budget \n", total);
+    }
 }
 
 /* Add a new user with the specified user name to the specified group. Return zero
@@ -110,34 +270,120 @@ int add_user(Group *group, const char *user_name) {
     
     // We assume that the group actually exists
     // Check that user_name is not already in group
-    if (find_prev_user(group, user_name) != NULL) { // find_prev_user returns a pointer if found, NULL if not found
+    if (ht_get(&group->user_index, user_name) != NULL) {
 	return -1;
     } 
 
-    User * new_user = malloc(sizeof(User)); // Setup the user 
-    if (new_user == NULL){ // i.e. malloc failed
-        perror("Error allocating memory for new user. Exiting...");
+    // Setup name, which is stored once however many groups the user is in
+    User * new_user = create_user(group, intern(user_name));
+
+    // Now, to add the new_user in (balance, name) order among the users
+    rank_insert(group, new_user);
+    index_user(group, new_user);
+    // User added!
+    return 0;
+}
+
+/* Add a user for each of the count names in user_names to group, with the
+* same result as calling add_user on each in turn, but putting the new users
+* into the balance order together. Names of users that already exist (or came
+* up earlier in user_names) are skipped. The names that were added are stored
+* in added_names, which has room for count, and their number is returned.
+*/
+size_t add_users(Group *group, char **user_names, size_t count, char **added_names) {
+
+    User **added = malloc(count * sizeof(User *));
+    if (added == NULL){
+	perror("Error allocating memory for users. Exiting...");
 	exit(1);
     }
-    
+    size_t added_count = 0;
+    for (size_t i = 0; i < count; i++){
+	if (ht_get(&group->user_index, user_names[i]) != NULL){
+	    continue;
+	}
+	User * new_user = create_user(group, intern(user_names[i]));
+	index_user(group, new_user);
+	added_names[added_count] = user_names[i];
+	added[added_count++] = new_user;
+    }
+
+    // Few new users go in one at a time; many are merged in with one rebuild
+    if (added_count * RANK_MERGE_RATIO < group->user_count){
+	for (size_t i = 0; i < added_count; i++){
+	    rank_insert(group, added[i]);
+	}
+    }
+    else if (added_count > 0){
+	for (size_t i = 0; i < added_count; i++){
+	    added[i]->unranked = 1;
+	}
+	rank_merge(group, added, added_count);
+    }
+    free(added);
+    return added_count;
+}
+
+/* Return the user of group called user_name, or NULL if there is none.
+*/
+User *find_user(Group *group, const char *user_name) {
+    return ht_get(&group->user_index, user_name);
+}
+
+/* Add user to the name index and the name trie of group.
+*/
+void index_user(Group *group, User *user) {
+    index_put(&group->user_index, user->name, user, &group->memory, MEM_USER);
+    size_t bytes = group->user_trie.bytes;
+    trie_insert(&group->user_trie, user->name, user);
+    mem_charge(&group->memory, MEM_USER, group->user_trie.bytes - bytes);
+}
+
+/* Return 0 if count more users fit in group's memory budget and the
+* process's, or what mem_admit returns if not. Each is reckoned at its User,
+* a share of the name index, which is kept at most half full, and the two
+* trie nodes a name adds at most; the rare tall user's links and the bytes
+* of the trie labels are left out. Their places in the user directory,
+* which no group owns, are admitted against the process budget alone.
+*/
+int user_admit(Group *group, size_t count) {
+    int result = mem_admit(&group->memory, count * (group->user_slab.object_size + 2 * sizeof(struct htable_slot) +
+                                                    2 * sizeof(struct trie_node)));
+    return result != 0 ? result : directory_admit(count);
+}
+
+/* Allocate a User for the name interned as id from group's slabs and
+* initialize it with a zero balance and no transactions, recording it in the
+* user directory. The user takes over a reference to the name that the
+* caller holds, and is not linked into the group's index or balance order
+* yet.
+*/
+User *create_user(Group *group, uint32_t id) {
+
+    User * new_user = slab_alloc(&group->user_slab);
+    mem_charge(&group->memory, MEM_USER, group->user_slab.object_size);
+
     // Initialize fields
-    new_user->balance = 0.00;
-    
-    // Setup name
-    int name_length = (int) strlen(user_name);
-    new_user->name = malloc(name_length + 1);
-    if (new_user->name == NULL){
-        perror("Error allocating memory for user's name. Exiting...");
-	exit(1);
+    new_user->balance = 0;
+    new_user->last_xct = XCT_NONE;
+    new_user->xct_count = 0;
+    new_user->id = id;
+    new_user->unranked = 0;
+    new_user->name = intern_name(id);
+    new_user->next = NULL;
+    new_user->prev = NULL;
+
+    // Setup the skip list links, which only rare tall users keep outside the User
+    new_user->level = rank_random_level();
+    if (new_user->level <= USER_INLINE_LEVELS){
+	new_user->links = new_user->inline_links;
     }
-    strncpy(new_user->name, user_name, name_length); 
-    new_user->name[name_length] = '\0';
-    
-    // Now, to add the new_user to the front of the group (it has the lowest balance)
-    new_user->next = group->users;
-    group->users = new_user;
-    // User added!
-    return 0;
+    else {
+	new_user->links = slab_alloc(&group->link_slab);
+	mem_charge(&group->memory, MEM_USER, group->link_slab.object_size);
+    }
+    directory_add(group, new_user);
+    return new_user;
 }
 
 /* Remove the user with matching user and group name and
@@ -150,60 +396,123 @@ int add_user(Group *group, const char *user_name) {
 int remove_user(Group *group, const char *user_name) {
     
     // Check whether user_name exists in list
-    User * prev_user = find_prev_user(group, user_name);
-    if (prev_user == NULL) {
+    User * to_be_removed = ht_get(&group->user_index, user_name);
+    if (to_be_removed == NULL) {
 	return -1;
     }
 
-    // Now let us find the user that will be removed
-    // Note that to_be_removed is the pointer to user_name, the node that will be removed from the linked list
-    User * to_be_removed;
-    if (strcmp(prev_user->name, user_name) == 0) { // For when user_name is the first in the list
-    	to_be_removed = prev_user;
-	group->users = prev_user->next; // We need users to refer to the node that is next, effectively removing user_name from users list
-    }
-
-    else {
-        to_be_removed = prev_user->next;
-    }
-    
-    User * new_next = to_be_removed->next;
+    // First remove the appropriate transactions done by user_name, by following her own chain
+    remove_xct(group, user_name);
 
-    // Now if new_next is null, then to_be_removed was the last node in the list
-    if (new_next == NULL){
-        prev_user->next = NULL;
+    // Unlink to_be_removed from the index and the balance order, and its balance from the totals
+    ht_remove(&group->user_index, user_name);
+    size_t trie_bytes = group->user_trie.bytes;
+    trie_remove(&group->user_trie, user_name);
+    mem_credit(&group->memory, MEM_USER, trie_bytes - group->user_trie.bytes);
+    rank_remove(group, to_be_removed);
+    track_balance(group, to_be_removed->balance, 0);
+    directory_remove(to_be_removed);
+    // A read view may still show the user, so its name must outlive every read that can see it
+    if (group->view != NULL){
+	view_retire_name(to_be_removed->id);
     }
-    else { // Otherwise just form the missing link
-	prev_user->next = new_next;  
+    else {
+	intern_unref(to_be_removed->id);
     }
 
     // Now to free the memory occupied by to_be_removed
-    free(to_be_removed->name);
-    free(to_be_removed);
-    // And remove the appropriate transactions done by user_name
-    remove_xct(group, user_name);    
+    if (to_be_removed->links != to_be_removed->inline_links){
+	slab_free(&group->link_slab, to_be_removed->links);
+	mem_credit(&group->memory, MEM_USER, group->link_slab.object_size);
+    }
+    slab_free(&group->user_slab, to_be_removed);
+    mem_credit(&group->memory, MEM_USER, group->user_slab.object_size);
     return 0;
 }
 
-/* Print to standard output the names of all the users in group, one
+static const struct out_list user_list_format = {
+    "Name \t Balance \n", "%s \t %s \n", 2, {"name", "balance"}, 1u << 1
+};
+
+/* Print to standard output the names of at most count users in group, one
 * per line, and in the order that users are stored in the list, namely 
-* lowest payer first.
+* lowest payer first (ties in name order), starting with the one at position
+* cursor (0 for the lowest payer). Ends with the cursor of the next page if
+* there are users left.
 */
-void list_users(Group *group) {
+void list_users(Group *group, size_t count, size_t cursor) {
     
     // If list is empty print newline
-    if (group->users == NULL){
-	printf("There are no users in group %s. \n", group->name);
+    if (group->users == NULL && out_format == OUT_TEXT){
+	out_printf("There are no users in group %s. \n", group->name);
 	return;
     }
 
+    // A view's users are one array, with no skip list to find them by rank
     User *user = group->users; // To iterate over the list
+    if (cursor >= group->user_count){
+	user = NULL;
+    }
+    else if (cursor > 0){
+	user = group->rank_level == 0 ? &group->users[cursor] : rank_nth(group, cursor + 1);
+    }
 
-    printf("Name \t Balance \n");
-    while (user != NULL){ 
-	printf("%s \t %.2f \n", user->name, user->balance);
+    char amount[CENTS_BUFFER];
+    const char *fields[2];
+    size_t i;
+    out_list_begin(&user_list_format);
+    for (i = 0; i < count && user != NULL; i++){ 
+	fields[0] = user->name;
+	fields[1] = format_cents(user->balance, amount);
+	out_list_row(&user_list_format, fields);
 	user = user->next;
     }
+    if (user != NULL){
+	out_list_cursor(cursor + i);
+    }
+    out_list_end();
+}
+
+static const struct out_list user_suggest_format = {
+    "Name \t Distance \t Balance \n", "%s \t %s \t %s \n", 3, {"name", "distance", "balance"}, 1u << 1 | 1u << 2
+};
+
+static void visit_user(void *item, void *context) {
+    User *user = item;
+    char amount[CENTS_BUFFER];
+    const char *fields[2] = {user->name, format_cents(user->balance, amount)};
+    out_list_row(&user_list_format, fields);
+}
+
+/* Print to standard output at most limit users of group whose names start
+* with prefix, in name order, with their balances. Only the users found are
+* read, however large the group.
+*/
+void find_users(Group *group, const char *prefix, size_t limit) {
+    out_list_begin(&user_list_format);
+    trie_prefix(&group->user_trie, prefix, limit, visit_user, NULL);
+    out_list_end();
+}
+
+/* Print to standard output the users of group whose names are closest in
+* spelling to user_name (see trie_suggest), closest first, with how many
+* edits away each is and their balances.
+*/
+void suggest_users(Group *group, const char *user_name) {
+    struct trie_match matches[TRIE_SUGGEST_LIMIT];
+    size_t count = trie_suggest(&group->user_trie, user_name, matches);
+    char amount[CENTS_BUFFER];
+    char distance[OUT_U64_BUFFER];
+    const char *fields[3] = {NULL, distance, amount};
+    out_list_begin(&user_suggest_format);
+    for (size_t i = 0; i < count; i++){
+	User *user = matches[i].item;
+	fields[0] = user->name;
+	out_u64(matches[i].distance, distance);
+	format_cents(user->balance, amount);
+	out_list_row(&user_suggest_format, fields);
+    }
+    out_list_end();
 }
 
 /* Print to standard output the balance of the specified user. Return 0
@@ -213,26 +522,21 @@ int user_balance(Group *group, const char *user_name) {
 
     // Assuming group exists...
     // Check whether user_name is absent from the list
-    User * prev_user = find_prev_user(group, user_name);
-    if (prev_user == NULL) {
+    User * user = ht_get(&group->user_index, user_name);
+    if (user == NULL) {
 	return -1;
     }
 
     // If we got here, then user_name exists. Print the balance
-    // Since find_prev_user can return the actual user_name to prev_user when the list consists of just user_name
-    printf("User \t Balance \n");
-    if (strcmp(prev_user->name, user_name) == 0){
-	printf("%s \t %.2f \n", prev_user->name, prev_user->balance);
-    }
-    else {
-	printf("%s \t %.2f \n", prev_user->next->name, prev_user->next->balance);
-    }
+    char amount[CENTS_BUFFER];
+    out_printf("User \t Balance \n");
+    out_printf("%s \t %s \n", user->name, format_cents(user->balance, amount));
     return 0; 
 }
 
 /* Print to standard output the name of the user who has paid the least 
-* If there are several users with equal least amounts, all names are output. 
-* Returns 0 on success, and -1 if the list of users is empty.
+* If there are several users with equal least amounts, all names are output
+* (in name order). Returns 0 on success, and -1 if the list of users is empty.
 * (This should be easy, since your list is sorted by balance). 
 */
 int under_paid(Group *group) {
@@ -244,24 +548,93 @@ int under_paid(Group *group) {
 
     User * current_user = group->users; // Special Case: Only one user registered in group
     if (current_user->next == NULL){ 
-	printf("%s \n", current_user->name);
+	out_printf("%s \n", current_user->name);
 	return 0;
     }
 
     if (current_user->balance != current_user->next->balance) {  // This means the first node has underpaid the most (i.e. no tie)
-	printf("%s \n", current_user->name);
+	out_printf("%s \n", current_user->name);
 	return 0;
     }
 
     // If we got to this point, then there is a tie between several users 
-    printf("%s \n", current_user->name);
+    out_printf("%s \n", current_user->name);
     while (current_user->next != NULL && current_user->balance == current_user->next->balance){ // To find all users who tie 
-	printf("%s \n", current_user->next->name);
+	out_printf("%s \n", current_user->next->name);
 	current_user = current_user->next;
     }
     return 0;
 }
 
+/* Account in group's running totals for a balance that changes from
+* old_balance to new_balance. A user joining or leaving the group is a change
+* from or to 0. Everything is kept in whole cents, so the totals never drift.
+*/
+void track_balance(Group *group, int64_t old_balance, int64_t new_balance) {
+    group->balance_total += new_balance - old_balance;
+    group->balance_squares += (__int128) new_balance * new_balance - (__int128) old_balance * old_balance;
+}
+
+/* The mean balance of a non-empty group, rounded to the nearest cent.
+*/
+static int64_t mean_balance(Group *group) {
+    int64_t count = (int64_t) group->user_count;
+    int64_t mean = group->balance_total / count;
+    int64_t left = group->balance_total % count;
+    if (2 * (left < 0 ? -left : left) >= count){ // Halves round away from zero
+	mean += left < 0 ? -1 : 1;
+    }
+    return mean;
+}
+
+/* Print to standard output a summary of group: how many users and live
+* transactions it has, their total, the mean balance, the lowest and highest
+* payers and the standard deviation of the balances. Everything is read off
+* the running totals and the two ends of the balance order, so this takes
+* the same time however large the group is.
+*/
+void group_summary(Group *group) {
+
+    if (group->users == NULL){
+	out_printf("There are no users in group %s. \n", group->name);
+	return;
+    }
+
+    // n * sum of squares - total^2 is n^2 times the variance, and exact
+    int64_t count = (int64_t) group->user_count;
+    __int128 spread = (__int128) count * group->balance_squares - (__int128) group->balance_total * group->balance_total;
+    int64_t deviation = llroundl(sqrtl((long double) spread) / count);
+
+    char amount[CENTS_BUFFER];
+    out_printf("Users: %zu \n", group->user_count);
+    out_printf("Transactions: %zu \n", group->xct_live);
+    out_printf("Total: %s \n", format_cents(group->balance_total, amount));
+    out_printf("Mean: %s \n", format_cents(mean_balance(group), amount));
+    out_printf("Lowest: %s %s \n", group->users->name, format_cents(group->users->balance, amount));
+    out_printf("Highest: %s %s \n", group->users_last->name, format_cents(group->users_last->balance, amount));
+    out_printf("Standard deviation: %s \n", format_cents(deviation, amount));
+}
+
+/* Print to standard output the balance of the specified user next to the
+* mean balance of the group, which is the user's fair share, and how far
+* above (positive) or below (negative) that share the user is. Return 0 on
+* success, or -1 if the user with the given name is not in the group.
+*/
+int fair_share(Group *group, const char *user_name) {
+
+    User * user = ht_get(&group->user_index, user_name);
+    if (user == NULL) {
+	return -1;
+    }
+
+    int64_t share = mean_balance(group);
+    char balance[CENTS_BUFFER], mean[CENTS_BUFFER], difference[CENTS_BUFFER];
+    out_printf("Name \t Balance \t Share \t Difference \n");
+    out_printf("%s \t %s \t %s \t %s \n", user->name, format_cents(user->balance, balance),
+	       format_cents(share, mean), format_cents(user->balance - share, difference));
+    return 0;
+}
+
 /* Return a pointer to the user prior to the one in group with user_name. If 
 * the matching user is the first in the list (i.e. there is no prior user in 
 * the list), return a pointer to the matching user itself. If no matching user 
@@ -275,114 +648,314 @@ int under_paid(Group *group) {
 User *find_prev_user(Group *group, const char *user_name) {
     
     // We assume that group exists i.e. is not NULL 
-    // First, we will check if the list is empty
-    if (group->users == NULL){
+    User * current_user = ht_get(&group->user_index, user_name);
+    if (current_user == NULL){
         return NULL;
     }
-     
-    User * current_user = group->users;
 
-    // Now, check whether the first user in out list corresponds to user_name
-    if (strcmp(current_user->name, user_name) == 0){
+    // The first user in the list has no prior user, so return it itself
+    if (current_user->prev == NULL){
 	return current_user;
     }
+    return current_user->prev;
+}
 
-    User * prev_user = current_user;
-    while (current_user->next != NULL) { // We will traverse the linked list to find user_name
-	current_user = current_user->next;
-       	if ((strcmp(current_user->name, user_name) == 0)) {
-	    return prev_user;
+/* Start reader off with nothing decoded.
+*/
+void xct_reader_init(struct xct_reader *reader) {
+    reader->index = SIZE_MAX;
+}
+
+/* Return chunk index of group for reading, decoding it into reader first if
+* it is cold, or NULL if it has been released. Every chunk with a live row is
+* still there.
+*/
+const struct xct_chunk *xct_read(Group *group, size_t index, struct xct_reader *reader) {
+    if (group->xct_chunks[index] != NULL){
+	return group->xct_chunks[index];
+    }
+    if (group->xct_cold[index] == NULL){
+	return NULL;
+    }
+    if (reader->index != index){
+	cold_decode(group->xct_cold[index], index, &reader->scratch);
+	reader->index = index;
+	stats_add(STAT_BLOCKS_DECODED, 1);
+    }
+    return &reader->scratch;
+}
+
+/* Grow the chunk directory of group to hold chunk index, if it does not
+* already. Directory entries that have never been filled in are NULL.
+*/
+static void reserve_xct_chunk(Group *group, size_t index) {
+
+    if (index >= group->xct_chunk_capacity){
+	size_t capacity = group->xct_chunk_capacity == 0 ? 4 : group->xct_chunk_capacity;
+	while (capacity <= index){
+	    capacity *= 2;
+	}
+	struct xct_chunk **chunks = realloc(group->xct_chunks, capacity * sizeof(struct xct_chunk *));
+	struct xct_block **cold = realloc(group->xct_cold, capacity * sizeof(struct xct_block *));
+	int64_t *starts = realloc(group->xct_chunk_start, capacity * sizeof(int64_t));
+	if (chunks == NULL || cold == NULL || starts == NULL){
+	    perror("Error allocating memory for transaction chunks. Exiting...");
+	    exit(1);
 	}
-        prev_user = current_user; // If not found, continue traversal
+	memset(chunks + group->xct_chunk_capacity, 0, (capacity - group->xct_chunk_capacity) * sizeof(struct xct_chunk *));
+	memset(cold + group->xct_chunk_capacity, 0, (capacity - group->xct_chunk_capacity) * sizeof(struct xct_block *));
+	mem_charge(&group->memory, MEM_GROUP, (capacity - group->xct_chunk_capacity) *
+		   (sizeof(struct xct_chunk *) + sizeof(struct xct_block *) + sizeof(int64_t)));
+	group->xct_chunks = chunks;
+	group->xct_cold = cold;
+	group->xct_chunk_start = starts;
+	group->xct_chunk_capacity = capacity;
     }
-    
-    // If we have gotten to this point of the algorithm, then the user_name is not present in the group
-    return NULL;
 }
 
-/* Rearrange the list of users found in group after current_user's balance
-* was changed due to a new transaction. The first user in the list must have
-* the lowest balance compared to all other users. Userd as a helper function
-* in add_xct.
+/* Allocate an empty chunk for rows index * XCT_CHUNK_ROWS onwards of group,
+* growing the chunk directory if needed.
 */
-void rearrange_users(Group *group, User *current_user){
-    
-    User * prev_user, *next_user; 
-
-    while (current_user->next != NULL && current_user->balance > current_user->next->balance){
-	// We will excecute a swap if we entered the loop
-        // Swaps must be done in different ways depending on the position in the list
-	prev_user = find_prev_user(group, current_user->name);	
-        next_user = current_user->next;
-       
-	if (strcmp(prev_user->name, current_user->name) == 0){ // i.e. if current_user is the first user in the linked list
-            current_user->next = next_user->next; // Now current_user refers to the third node in the linked list
-            next_user->next = current_user; 
-            group->users = next_user;  // Swap complete!
-        }
-        else {
-            current_user->next = next_user->next;
-            prev_user->next = next_user; 		
-            next_user->next = current_user; // Swap complete!
-        }
-    }
- 
+struct xct_chunk *alloc_xct_chunk(Group *group, size_t index) {
+
+    reserve_xct_chunk(group, index);
+    struct xct_chunk *chunk = slab_alloc(&group->chunk_slab);
+    mem_charge(&group->memory, MEM_XCT, group->chunk_slab.object_size);
+    chunk->live = 0;
+    chunk->version = group->view_version;
+    group->xct_chunks[index] = chunk;
+    stats_add(STAT_CHUNK_ALLOCS, 1);
+    return chunk;
+}
+
+/* Return 0 if rows more transactions fit in group's memory budget and the
+* process's, or what mem_admit returns if not. Only the hot chunks they would
+* start are counted: sealing a chunk only ever gives memory back.
+*/
+int xct_admit(Group *group, size_t rows) {
+    size_t chunks = (group->xct_rows + rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS -
+		    (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+    return mem_admit(&group->memory, chunks * group->chunk_slab.object_size);
+}
+
+/* Give the hot chunk index of group back to the group's slab, or retire it
+* if a read view may still be looking at it.
+*/
+static void free_xct_chunk(Group *group, size_t index) {
+    struct xct_chunk *chunk = group->xct_chunks[index];
+    if (chunk->version < group->view_version){
+	view_retire(&group->chunk_slab, chunk);
+    }
+    else {
+	slab_free(&group->chunk_slab, chunk);
+    }
+    mem_credit(&group->memory, MEM_XCT, group->chunk_slab.object_size);
+    group->xct_chunks[index] = NULL;
+}
+
+/* Release chunk index of group, hot or cold, once every row in it is dead.
+*/
+static void release_xct_chunk(Group *group, size_t index) {
+    struct xct_block *block = group->xct_cold[index];
+    if (block == NULL){
+	free_xct_chunk(group, index);
+    }
+    else {
+	group->xct_cold_count--;
+	group->xct_cold_bytes -= cold_bytes(block);
+	mem_credit(&group->memory, MEM_XCT, cold_bytes(block));
+	if (block->version < group->view_version){
+	    view_retire(NULL, block);
+	}
+	else {
+	    free(block);
+	}
+	group->xct_cold[index] = NULL;
+    }
+    stats_add(STAT_CHUNK_FREES, 1);
+}
+
+/* Seal the hot chunk index of group, which must be full, into a cold block.
+* A chunk whose rows the block cannot record stays hot.
+*/
+static void seal_xct_chunk(Group *group, size_t index) {
+    struct xct_block *block = cold_seal(group->xct_chunks[index], index);
+    if (block == NULL){
+	return;
+    }
+    block->version = group->view_version;
+    group->xct_cold[index] = block;
+    group->xct_cold_count++;
+    group->xct_cold_bytes += cold_bytes(block);
+    mem_charge(&group->memory, MEM_XCT, cold_bytes(block));
+    free_xct_chunk(group, index);
+    stats_add(STAT_BLOCKS_SEALED, 1);
+}
+
+/* Seal every chunk of group older than the newest XCT_HOT_CHUNKS that is
+* still hot, as appending does one chunk at a time.
+*/
+void seal_xct_chunks(Group *group) {
+    size_t chunks = (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+    for (size_t i = 0; i + XCT_HOT_CHUNKS < chunks; i++){
+	if (group->xct_chunks[i] != NULL){
+	    seal_xct_chunk(group, i);
+	}
+    }
+}
+
+/* Make block, already sealed, the cold chunk index of group, as loading a
+* snapshot does. The group takes over block.
+*/
+void load_xct_block(Group *group, size_t index, struct xct_block *block) {
+    reserve_xct_chunk(group, index);
+    block->version = group->view_version;
+    group->xct_cold[index] = block;
+    group->xct_cold_count++;
+    group->xct_cold_bytes += cold_bytes(block);
+    mem_charge(&group->memory, MEM_XCT, cold_bytes(block));
+}
+
+/* Return the chunk that the next transaction of group goes into, allocating
+* it (and growing the chunk directory) when the last chunk is full.
+*/
+static struct xct_chunk *xct_chunk_for_append(Group *group) {
+    size_t index = group->xct_rows / XCT_CHUNK_ROWS;
+
+    if (group->xct_rows % XCT_CHUNK_ROWS != 0){
+	return group->xct_chunks[index];
+    }
+
+    // The previous chunk may have died while it was still being appended to
+    if (index > 0 && group->xct_chunks[index - 1] != NULL && group->xct_chunks[index - 1]->live == 0){
+	release_xct_chunk(group, index - 1);
+    }
+    // And the oldest hot chunk falls out of the hot tier
+    if (index >= XCT_HOT_CHUNKS && group->xct_chunks[index - XCT_HOT_CHUNKS] != NULL){
+	seal_xct_chunk(group, index - XCT_HOT_CHUNKS);
+    }
+
+    return alloc_xct_chunk(group, index);
+}
+
+/* Append a transaction of cents by user at time to the end of group's
+* history and to the front of the user's own chain. time must not be before
+* the group's last transaction. The balance is left to the caller.
+*/
+static void append_xct(Group *group, User *user, int64_t cents, int64_t time) {
+    uint32_t seq = group->xct_rows;
+    struct xct_chunk *chunk = xct_chunk_for_append(group);
+    size_t row = seq % XCT_CHUNK_ROWS;
+    chunk->cents[row] = cents;
+    chunk->uid[row] = user->id;
+    chunk->time[row] = time;
+    if (row == 0){
+	group->xct_chunk_start[seq / XCT_CHUNK_ROWS] = time;
+    }
+    group->xct_last_time = time;
+
+    chunk->user_prev[row] = user->last_xct;
+    user->last_xct = seq + 1;
+    user->xct_count++;
+
+    chunk->live++;
+    group->xct_rows++;
+    group->xct_live++;
 }
 
 /* Add the transaction represented by user_name and amount to the appropriate 
 * transaction list, and update the balances of the corresponding user and group. 
 * Note that updating a user's balance might require the user to be moved to a
-* different position in the list to keep the list in sorted order. Returns 0 on
-* success, and -1 if the specified user does not exist.
+* different position in the list to keep the list in sorted order, which the
+* skip list does in O(log n). The transaction is stamped with time, which
+* xct_now gives for one that is happening now. Returns 0 on success, -1 if the
+* specified user does not exist and -2 if time is before the group's last
+* transaction.
 */
-int add_xct(Group *group, const char *user_name, double amount) {
+int add_xct(Group *group, const char *user_name, int64_t cents, int64_t time) {
    
     // Assuming a negative amount is NOT a problem...
-    User * prev_user = find_prev_user(group, user_name);
+    User * current_user = ht_get(&group->user_index, user_name);
     // First, check that the user_name exists in the group
-    if (prev_user == NULL) {
+    if (current_user == NULL) {
 	return -1;
     }
+    if (time < group->xct_last_time) {
+	return -2;
+    }
 
-    User * current_user; // Find the desired username to update their balance. Prev_user will be current_user if it is first in list.
-    if (strcmp(prev_user->name, user_name) == 0){
-	current_user = prev_user;
-    } 
-    else {
-	current_user = prev_user->next;
-    }
-
-    // Update current_user's information
-    current_user->balance += amount;
-    // Rearrange the list to reflect changes in balance
-    rearrange_users(group, current_user);
- 
-    // Now to set up the new transaction in the xct list
-    Xct * new_xct = malloc(sizeof(Xct));
-    if (new_xct == NULL){
-	perror("Error allocating memory for new transaction. Exiting...");
-	exit(1);
+    // Update current_user's information, moving it to its new place in the balance order
+    User *before = current_user->prev;
+    rank_remove(group, current_user);
+    track_balance(group, current_user->balance, current_user->balance + cents);
+    current_user->balance += cents;
+    rank_insert(group, current_user);
+    if (current_user->prev != before){
+	stats_add(STAT_RANK_MOVES, 1);
     }
 
-    new_xct->amount = amount;
-    
-    // Setup name
-    int name_length = (int) strlen(user_name);
-    new_xct->name = malloc(name_length + 1);
-    if (new_xct->name == NULL){
-        perror("Error allocating memory for new transaction name. Exiting...");
+    // Now to set up the new transaction at the end of the group's history
+    append_xct(group, current_user, cents, time);
+    return 0;
+}
+
+/* Post a transaction of cents[i] by users[i] for each of the count rows, in
+* order, with the same result as calling add_xct on each row in turn. The
+* balance order is only restored once, at the end: each user who appears is
+* unlinked before its first row and put back after the last, or, once they are
+* a good part of the group, all of them are merged back in one rebuild. Every
+* row is stamped with time, which must not be before the group's last
+* transaction.
+*/
+void add_xcts(Group *group, User **users, const int64_t *cents, size_t count, int64_t time) {
+
+    User **moved = malloc(count * sizeof(User *));
+    if (moved == NULL){
+	perror("Error allocating memory for transactions. Exiting...");
 	exit(1);
     }
- 
-    strncpy(new_xct->name, user_name, name_length);
-    new_xct->name[name_length] = '\0';
-    
-    // Now to add to front of xct list (Better for recent_xct)
-    new_xct->next = group->xcts;
-    group->xcts = new_xct;
-    return 0;
+    size_t moved_count = 0;
+    for (size_t i = 0; i < count; i++){
+	if (!users[i]->unranked){
+	    users[i]->unranked = 1;
+	    moved[moved_count++] = users[i];
+	}
+    }
+    int merge = moved_count * RANK_MERGE_RATIO >= group->user_count;
+    if (!merge){
+	// Unlink while the balances are still the ones the order was built on
+	for (size_t i = 0; i < moved_count; i++){
+	    rank_remove(group, moved[i]);
+	}
+    }
+
+    for (size_t i = 0; i < count; i++){
+	track_balance(group, users[i]->balance, users[i]->balance + cents[i]);
+	users[i]->balance += cents[i];
+	append_xct(group, users[i], cents[i], time);
+    }
+
+    if (merge){
+	rank_merge(group, moved, moved_count);
+    }
+    else {
+	for (size_t i = 0; i < moved_count; i++){
+	    moved[i]->unranked = 0;
+	    rank_insert(group, moved[i]);
+	}
+    }
+    stats_add(STAT_RANK_MOVES, moved_count);
+    free(moved);
 }
 
+static const struct out_list xct_list_format = {
+    NULL, "Transaction #%s, User: %s, Transaction amount: %s \n", 3, {"number", "name", "amount"}, 1u << 0 | 1u << 2
+};
+
+static const struct out_list xct_page_format = {
+    "Time \t Name \t Amount \n", "%s \t %s \t %s \n", 3, {"time", "name", "amount"}, 1u << 2
+};
+
 /* Print to standard output the num_xct most recent transactions for the 
 * specified group (or fewer transactions if there are less than num_xct 
 * transactions posted for this group). The output should have one line per 
@@ -393,98 +966,562 @@ void recent_xct(Group *group, long num_xct) {
    
     // First, check if xct_list is empty
     int desired_number = (int) num_xct;
-    if (group->xcts == NULL || num_xct <= 0){ // No negative numbers!
-	printf("\n");
-	return;
+    if (group->xct_live == 0 || num_xct <= 0){ // No negative numbers!
+	if (out_format == OUT_TEXT){
+	    out_printf("\n");
+	    return;
+	}
+	desired_number = 0;
     }
     
     int i = 0;
-    Xct * current_xct = group->xcts;
-    printf("The last %i transactions were: \n", desired_number);
-    while (current_xct->next != NULL && i < desired_number){
-	printf("Transaction #%i, User: %s, Transaction amount: %.2f \n", i + 1, current_xct->name, current_xct->amount);
-        current_xct = current_xct->next;
-        i++;
+    char amount[CENTS_BUFFER];
+    char number[OUT_U64_BUFFER];
+    const char *fields[3] = {number};
+    uint32_t ref = group->xct_rows;
+    uint64_t scanned = 0;
+    struct xct_reader reader;
+    xct_reader_init(&reader);
+    if (out_format == OUT_TEXT){
+	out_printf("The last %i transactions were: \n", desired_number);
     }
-    
-    if (i < desired_number) { // To print the last transaction, if required
-	printf("Transaction #%i, User: %s, Transaction amount: %.2f \n", i + 1, current_xct->name, current_xct->amount);
+    out_list_begin(&xct_list_format);
+    while (ref != XCT_NONE && i < desired_number){
+	const struct xct_chunk *chunk = xct_read(group, (ref - 1) / XCT_CHUNK_ROWS, &reader);
+	if (chunk == NULL){ // Released because all its rows were dead, skip it whole
+	    ref -= (ref - 1) % XCT_CHUNK_ROWS + 1;
+	    continue;
+	}
+	size_t row = (ref - 1) % XCT_CHUNK_ROWS;
+	if (chunk->uid[row] != XCT_DEAD){
+	    out_u64(i + 1, number);
+	    fields[1] = intern_name(chunk->uid[row]);
+	    fields[2] = format_cents(chunk->cents[row], amount);
+	    out_list_row(&xct_list_format, fields);
+	    i++;
+	}
+	ref--;
+	scanned++;
     }
+    out_list_end();
+    stats_add(STAT_ROWS_SCANNED, scanned);
 }
 
-/* Return a pointer to the xct prior to the one in group with current_xct
-* in it. If the matching xct is the first in the list, return a pointer 
-* to the matching xct itself. If no matching xct is found, return NULL.
-* Used as a helper function for remove_xct.
+/* Print to standard output the num_xct most recent transactions of the
+* specified user, in the same format as recent_xct. Only the user's own chain
+* is walked, however many transactions the rest of the group has. Return 0 on
+* success, or -1 if the user with the given name is not in the group.
 */
-Xct * find_prev_xct(Group *group, const char *xct_name) {
+int user_xct(Group *group, const char *user_name, long num_xct) {
 
-    // First check if transactions are empty
-    if (group->xcts == NULL){
-	return NULL;
+    User * user = ht_get(&group->user_index, user_name);
+    if (user == NULL) {
+	return -1;
     }
-    
-    Xct * current_xct = group->xcts;
-    // This will essentially be a copy paste of find_prev_user, but with xct instead 
-    if (strcmp(current_xct->name, xct_name) == 0){
-	return current_xct;
+
+    if (user->last_xct == XCT_NONE || num_xct <= 0){ // No negative numbers!
+	if (out_format == OUT_TEXT){
+	    out_printf("\n");
+	    return 0;
+	}
+	num_xct = 0;
     }
 
-    Xct * prev_xct = current_xct;
-    while (current_xct->next != NULL){
-	current_xct = current_xct->next;
-	if (strcmp(current_xct->name, xct_name) == 0){
-	    return prev_xct;
-        }
-        prev_xct = current_xct;
+    if (out_format == OUT_TEXT){
+	out_printf("The last %li transactions of %s were: \n", num_xct, user->name);
     }
-    
-    return NULL;
+    char amount[CENTS_BUFFER];
+    char number[OUT_U64_BUFFER];
+    const char *fields[3] = {number, user->name};
+    uint32_t ref = user->last_xct;
+    struct xct_reader reader;
+    xct_reader_init(&reader);
+    long i;
+    out_list_begin(&xct_list_format);
+    for (i = 0; i < num_xct && ref != XCT_NONE; i++){
+	const struct xct_chunk *chunk = xct_read(group, (ref - 1) / XCT_CHUNK_ROWS, &reader);
+	size_t row = (ref - 1) % XCT_CHUNK_ROWS;
+	out_u64(i + 1, number);
+	fields[2] = format_cents(chunk->cents[row], amount);
+	out_list_row(&xct_list_format, fields);
+	ref = chunk->user_prev[row];
+    }
+    out_list_end();
+    stats_add(STAT_ROWS_SCANNED, i);
+    return 0;
+}
+
+/* Print to standard output a page of at most num_xct transactions of group,
+* newest first, starting at the row that cursor refers to, or at the newest
+* row if cursor is XCT_NONE. Each line holds the time, the name and the
+* amount, and a last line gives the cursor of the next page if there is one.
+* Returns that cursor, or XCT_NONE once the oldest row has been reached.
+*/
+uint32_t recent_xct_page(Group *group, long num_xct, uint32_t cursor) {
+
+    char amount[CENTS_BUFFER];
+    char stamp[TIME_BUFFER];
+    uint32_t ref = cursor == XCT_NONE ? group->xct_rows : cursor;
+    uint64_t scanned = 0;
+    const char *fields[3] = {stamp};
+    struct xct_reader reader;
+    xct_reader_init(&reader);
+    out_list_begin(&xct_page_format);
+    for (long i = 0; ref != XCT_NONE && i < num_xct; ){
+	const struct xct_chunk *chunk = xct_read(group, (ref - 1) / XCT_CHUNK_ROWS, &reader);
+	if (chunk == NULL){ // Released because all its rows were dead, skip it whole
+	    ref -= (ref - 1) % XCT_CHUNK_ROWS + 1;
+	    continue;
+	}
+	size_t row = (ref - 1) % XCT_CHUNK_ROWS;
+	if (chunk->uid[row] != XCT_DEAD){
+	    format_time(chunk->time[row], stamp);
+	    fields[1] = intern_name(chunk->uid[row]);
+	    fields[2] = format_cents(chunk->cents[row], amount);
+	    out_list_row(&xct_page_format, fields);
+	    i++;
+	}
+	ref--;
+	scanned++;
+    }
+    if (ref != XCT_NONE){
+	out_list_cursor(ref);
+    }
+    out_list_end();
+    stats_add(STAT_ROWS_SCANNED, scanned);
+    return ref;
+}
+
+/* Return the first row of group's history stamped at or after time, or
+* xct_rows if there is none. The chunk is found by a binary search of the
+* chunk start times, which outlive released chunks, and the row by a binary
+* search of that chunk's time column, decoded into reader if it is cold.
+*/
+static uint32_t xct_seek(Group *group, int64_t time, struct xct_reader *reader) {
+
+    size_t chunks = (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+    size_t low = 0, high = chunks;
+    while (low < high){ // First chunk starting at or after time
+	size_t middle = low + (high - low) / 2;
+	if (group->xct_chunk_start[middle] < time){
+	    low = middle + 1;
+	}
+	else {
+	    high = middle;
+	}
+    }
+    if (low == 0){
+	return 0;
+    }
+
+    // Any earlier row at or after time is in the chunk before that one
+    size_t index = low - 1;
+    size_t first = index * XCT_CHUNK_ROWS;
+    size_t rows = group->xct_rows - first < XCT_CHUNK_ROWS ? group->xct_rows - first : XCT_CHUNK_ROWS;
+    const struct xct_chunk *chunk = xct_read(group, index, reader);
+    if (chunk == NULL){ // Every row there is dead, so none of them counts
+	return (uint32_t) (first + rows);
+    }
+    low = 0;
+    high = rows;
+    while (low < high){
+	size_t middle = low + (high - low) / 2;
+	if (chunk->time[middle] < time){
+	    low = middle + 1;
+	}
+	else {
+	    high = middle;
+	}
+    }
+    return (uint32_t) (first + low);
+}
+
+/* Print to standard output every transaction of group stamped at or after
+* from and before to, oldest first, one per line with the time, the name and
+* the amount. Only the transactions in the range are read.
+*/
+void xct_range(Group *group, int64_t from, int64_t to) {
+
+    char amount[CENTS_BUFFER];
+    char stamp[TIME_BUFFER];
+    const char *fields[3] = {stamp};
+    uint64_t scanned = 0;
+    struct xct_reader reader;
+    xct_reader_init(&reader);
+    out_list_begin(&xct_page_format);
+    uint32_t seq = xct_seek(group, from, &reader);
+    while (seq < group->xct_rows){
+	const struct xct_chunk *chunk = xct_read(group, seq / XCT_CHUNK_ROWS, &reader);
+	if (chunk == NULL){ // Released because all its rows were dead, skip it whole
+	    seq += XCT_CHUNK_ROWS - seq % XCT_CHUNK_ROWS;
+	    continue;
+	}
+	size_t row = seq % XCT_CHUNK_ROWS;
+	if (chunk->time[row] >= to){
+	    break;
+	}
+	if (chunk->uid[row] != XCT_DEAD){
+	    format_time(chunk->time[row], stamp);
+	    fields[1] = intern_name(chunk->uid[row]);
+	    fields[2] = format_cents(chunk->cents[row], amount);
+	    out_list_row(&xct_page_format, fields);
+	}
+	seq++;
+	scanned++;
+    }
+    out_list_end();
+    stats_add(STAT_ROWS_SCANNED, scanned);
 }
 
+/* Return the time to stamp a transaction of group that happens now: the
+* current time, or the time of the group's last transaction if the clock
+* is behind it, so that the history stays in time order.
+*/
+int64_t xct_now(Group *group) {
+    int64_t now = (int64_t) time(NULL);
+    return now > group->xct_last_time ? now : group->xct_last_time;
+}
+
+/* Format time, in seconds since the epoch, as an ISO 8601 UTC time such as
+* "2024-03-01T09:30:00Z" into buffer, which must hold TIME_BUFFER bytes.
+* Returns buffer.
+*/
+char *format_time(int64_t time, char *buffer) {
+    // The civil date of the day, by Howard Hinnant's days_from_civil in reverse
+    int64_t days = time / 86400 - (time % 86400 < 0);
+    int64_t second = time - days * 86400;
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int day = (int) (doy - (153 * mp + 2) / 5 + 1);
+    int month = (int) (mp < 10 ? mp + 3 : mp - 9);
+    int64_t year = yoe + era * 400 + (month <= 2);
+
+    if (year >= 1000 && year <= 9999){ // Four digit years, which is every time parse_time takes
+	int values[6] = {(int) year, month, day, (int) (second / 3600), (int) (second / 60 % 60), (int) (second % 60)};
+	char *p = buffer;
+	for (int i = 0; i < 6; i++){
+	    if (i == 0){
+		*p++ = '0' + values[0] / 1000;
+		*p++ = '0' + values[0] / 100 % 10;
+	    }
+	    *p++ = '0' + values[i] / 10 % 10;
+	    *p++ = '0' + values[i] % 10;
+	    *p++ = "--T::Z"[i];
+	}
+	*p = '\0';
+	return buffer;
+    }
+
+    time_t seconds = (time_t) time;
+    struct tm fields;
+    if (gmtime_r(&seconds, &fields) == NULL || strftime(buffer, TIME_BUFFER, "%Y-%m-%dT%H:%M:%SZ", &fields) == 0) {
+	snprintf(buffer, TIME_BUFFER, "%lld", (long long) time); // Years that struct tm cannot hold
+    }
+    return buffer;
+}
+
+/* Format cents as a decimal amount with two places, such as "-12.05", into
+* buffer, which must hold CENTS_BUFFER bytes. Returns buffer.
+*/
+char *format_cents(int64_t cents, char *buffer) {
+    // Negate as unsigned so that INT64_MIN has a magnitude too
+    uint64_t magnitude = cents < 0 ? -(uint64_t) cents : (uint64_t) cents;
+
+    // Digits are written backwards from the end, then moved to the front
+    char digits[CENTS_BUFFER];
+    char *p = digits + sizeof(digits);
+    *--p = '0' + magnitude % 10;
+    *--p = '0' + magnitude / 10 % 10;
+    *--p = '.';
+    magnitude /= 100;
+    do {
+	*--p = '0' + magnitude % 10;
+	magnitude /= 10;
+    } while (magnitude > 0);
+    if (cents < 0){
+	*--p = '-';
+    }
+    size_t length = digits + sizeof(digits) - p;
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+/* Print to standard output the number of live transactions in group and the
+* sum of their amounts, which is read off the amount column chunk by chunk,
+* or off the sum kept with each cold block.
+*/
+void group_total(Group *group) {
+
+    int64_t total = 0;
+    uint64_t scanned = 0;
+    size_t chunks = (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+    for (size_t i = 0; i < chunks; i++){
+	struct xct_chunk *chunk = group->xct_chunks[i];
+	if (chunk == NULL && group->xct_cold[i] != NULL){
+	    total += group->xct_cold[i]->sum;
+	}
+	else if (chunk != NULL){
+	    size_t rows = i + 1 < chunks ? XCT_CHUNK_ROWS : group->xct_rows - i * XCT_CHUNK_ROWS;
+	    total += col_sum(chunk->cents, rows);
+	    scanned += rows;
+	}
+    }
+    stats_add(STAT_ROWS_SCANNED, scanned);
+
+    char amount[CENTS_BUFFER];
+    out_printf("Group \t Transactions \t Total \n");
+    out_printf("%s \t %zu \t %s \n", group->name, group->xct_live, format_cents(total, amount));
+}
+
+/* Print to standard output the number of transactions of the specified user
+* and the sum of their amounts, found by scanning the uid and amount columns
+* of the whole group (or reading the user's entry in each cold block's
+* dictionary) rather than by trusting the user's balance. Return 0 on
+* success, or -1 if the user with the given name is not in the group.
+*/
+int user_total(Group *group, const char *user_name) {
+
+    User * user = ht_get(&group->user_index, user_name);
+    if (user == NULL) {
+	return -1;
+    }
+
+    int64_t total = 0;
+    uint64_t scanned = 0;
+    size_t chunks = (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+    for (size_t i = 0; i < chunks; i++){
+	struct xct_chunk *chunk = group->xct_chunks[i];
+	struct xct_block *block = group->xct_cold[i];
+	if (block != NULL){
+	    int e = cold_find(block, user->id);
+	    if (e >= 0){
+		struct cold_entry entry;
+		cold_entry(block, i, e, &entry);
+		total += entry.sum;
+	    }
+	}
+	else if (chunk != NULL){
+	    size_t rows = i + 1 < chunks ? XCT_CHUNK_ROWS : group->xct_rows - i * XCT_CHUNK_ROWS;
+	    total += col_sum_matching(chunk->uid, chunk->cents, rows, user->id);
+	    scanned += rows;
+	}
+    }
+    stats_add(STAT_ROWS_SCANNED, scanned);
+
+    char amount[CENTS_BUFFER];
+    out_printf("User \t Transactions \t Total \n");
+    out_printf("%s \t %zu \t %s \n", user->name, user->xct_count, format_cents(total, amount));
+    return 0;
+}
+
+static int user_order(const void *a, const void *b) {
+    const User *x = *(User * const *) a;
+    const User *y = *(User * const *) b;
+    return user_cmp(x, y->balance, y->name);
+}
+
+/* Recompute the balance of every user in group from the transaction columns,
+* and the per-user sums in the cold blocks' dictionaries, in one pass over
+* the whole history, and put the users back in balance order if any of them
+* moved. Prints how many balances were checked and how many of them changed.
+*/
+void recompute_balances(Group *group) {
+
+    // Totals are indexed by interned ID, so size them for the group's largest
+    uint32_t limit = 0;
+    for (User *user = group->users; user != NULL; user = user->next){
+	if (user->id >= limit){
+	    limit = user->id + 1;
+	}
+    }
+    int64_t *totals = calloc(limit > 0 ? limit : 1, sizeof(int64_t));
+    if (totals == NULL){
+	perror("Error allocating memory for balances. Exiting...");
+	exit(1);
+    }
+
+    uint64_t scanned = 0;
+    size_t chunks = (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+    for (size_t i = 0; i < chunks; i++){
+	struct xct_chunk *chunk = group->xct_chunks[i];
+	struct xct_block *block = group->xct_cold[i];
+	if (block != NULL){
+	    cold_scatter_add(block, totals, limit);
+	}
+	else if (chunk != NULL){
+	    size_t rows = i + 1 < chunks ? XCT_CHUNK_ROWS : group->xct_rows - i * XCT_CHUNK_ROWS;
+	    col_scatter_add(chunk->uid, chunk->cents, rows, totals, limit);
+	    scanned += rows;
+	}
+    }
+    stats_add(STAT_ROWS_SCANNED, scanned);
+
+    size_t changed = 0;
+    for (User *user = group->users; user != NULL; user = user->next){
+	if (user->balance != totals[user->id]){
+	    track_balance(group, user->balance, totals[user->id]);
+	    user->balance = totals[user->id];
+	    changed++;
+	}
+    }
+    free(totals);
+
+    if (changed > 0){
+	User **sorted = malloc(group->user_count * sizeof(User *));
+	if (sorted == NULL){
+	    perror("Error allocating memory for balances. Exiting...");
+	    exit(1);
+	}
+	size_t count = 0;
+	for (User *user = group->users; user != NULL; user = user->next){
+	    sorted[count++] = user;
+	}
+	qsort(sorted, count, sizeof(User *), user_order);
+	rank_build(group, sorted, count);
+	free(sorted);
+    }
+
+    out_printf("Recomputed %zu balances, %zu changed \n", group->user_count, changed);
+}
+
+/* Print to standard output the rank of the specified user among the users of
+* group, where rank 1 is the user who has paid the most. Return 0 on success,
+* or -1 if the user with the given name is not in the group.
+*/
+int rank_user(Group *group, const char *user_name) {
+
+    User * user = ht_get(&group->user_index, user_name);
+    if (user == NULL) {
+	return -1;
+    }
+
+    // rank_of counts from the lowest payer, so flip it around
+    size_t rank = group->user_count - rank_of(group, user) + 1;
+    char amount[CENTS_BUFFER];
+    out_printf("User \t Rank \t Balance \n");
+    out_printf("%s \t %zu/%zu \t %s \n", user->name, rank, group->user_count, format_cents(user->balance, amount));
+    return 0;
+}
+
+static const struct out_list top_list_format = {
+    "Rank \t Name \t Balance \n", "%s \t %s \t %s \n", 3, {"rank", "name", "balance"}, 1u << 0 | 1u << 2
+};
+
+/* Print to standard output the k users of group who have paid the most,
+* highest payer first. Prints the whole group if it has fewer than k users.
+*/
+void top_paid(Group *group, long k) {
+
+    if ((group->users == NULL || k <= 0) && out_format == OUT_TEXT){
+	out_printf("\n");
+	return;
+    }
+
+    // Jump straight to the highest payer and walk towards the lowest
+    User * user = rank_nth(group, group->user_count);
+    char amount[CENTS_BUFFER];
+    char rank[OUT_U64_BUFFER];
+    const char *fields[3] = {rank};
+    out_list_begin(&top_list_format);
+    for (long i = 1; i <= k && user != NULL; i++){
+	out_u64(i, rank);
+	fields[1] = user->name;
+	fields[2] = format_cents(user->balance, amount);
+	out_list_row(&top_list_format, fields);
+	user = user->prev;
+    }
+    out_list_end();
+}
+
+/* Helper function for remove_xct. Mark every row of the user with ID uid in
+* cold block index of group as dead, by marking their dictionary entry, and
+* return the user's transaction before the block. The block is released once
+* no row in it is live, and copied first if a read view may be looking at it.
+*/
+static uint32_t kill_cold_entry(Group *group, size_t index, uint32_t uid) {
+
+    struct xct_block *block = group->xct_cold[index];
+    struct cold_entry entry;
+    int e = cold_find(block, uid);
+    cold_entry(block, index, e, &entry);
+    if (block->version < group->view_version){
+	struct xct_block *copy = cold_copy(block);
+	copy->version = group->view_version;
+	view_retire(NULL, block);
+	group->xct_cold[index] = block = copy;
+    }
+    block->dead[e / 64] |= (uint64_t) 1 << (e % 64);
+    block->live -= entry.count;
+    block->sum -= entry.sum;
+    group->xct_live -= entry.count;
+    if (block->live == 0){ // Never the chunk being appended to, which is hot
+	release_xct_chunk(group, index);
+    }
+    return entry.prev;
+}
 
 /* Remove all transactions that belong to the user_name from the group's 
 * transaction list. This helper function should be called by remove_user. 
 * If there are no transactions for this user, the function should do nothing.
 * Remember to free memory no longer needed.
+* Only the user's own chain is walked, so this costs O(her transactions).
 */
 void remove_xct(Group *group, const char *user_name) {
-     
-     void rearrange_xct(Group *group, Xct * current_xct);
+
+     void rearrange_xct(Group *group, uint32_t ref);
      // We assume that user_name is in group
-     // First, check if there are transactions in the xct_list
-     if (group->xcts == NULL){
+     User * user = ht_get(&group->user_index, user_name);
+     if (user == NULL){
 	return;
      }
 
-     Xct * current_xct = group->xcts;
-     while (current_xct != NULL){
-     if (strcmp(current_xct->name, user_name) == 0){ // This transaction was done by the user
-         rearrange_xct(group, current_xct);
-     }	
-     current_xct = current_xct->next; 
+     uint32_t ref = user->last_xct;
+     while (ref != XCT_NONE){
+	size_t index = (ref - 1) / XCT_CHUNK_ROWS;
+	if (group->xct_cold[index] != NULL){ // All of the user's rows in the block at once
+	    ref = kill_cold_entry(group, index, user->id);
+	    continue;
+	}
+	uint32_t prev_ref = group->xct_chunks[index]->user_prev[(ref - 1) % XCT_CHUNK_ROWS]; // Read before the row's chunk may be released
+	rearrange_xct(group, ref);
+	ref = prev_ref;
      }
+     user->last_xct = XCT_NONE;
+     user->xct_count = 0;
 }
 
-/* Helper function for remove_xct. Take the current transaction, and delete
-* it from the xct_list in group. Finally, free the memory initially allocated
-* to current_xct.
+/* Helper function for remove_xct. Mark the transaction referred to by ref as
+* dead, zeroing its amount so that column sums can skip the uid check and
+* its link so that it reads the same from either tier, and give its chunk
+* back to the group's slab once no row in it is live any more (unless it is
+* the chunk new transactions are appended to). A chunk shared with a read
+* view is swapped for a copy first.
 */
-void rearrange_xct(Group * group, Xct * current_xct) {
-	
-    Xct *prev_xct, *next_xct;
-    prev_xct = find_prev_xct(group, current_xct->name);
-    next_xct = current_xct->next;
-    if (strcmp(prev_xct->name, current_xct->name) == 0) { // We assume prev_xct is not null as we know current_xct is in the list
-         group->xcts = next_xct;
+void rearrange_xct(Group * group, uint32_t ref) {
+
+    size_t index = (ref - 1) / XCT_CHUNK_ROWS;
+    size_t row = (ref - 1) % XCT_CHUNK_ROWS;
+    struct xct_chunk *chunk = group->xct_chunks[index];
+    if (chunk->version < group->view_version){
+	struct xct_chunk *copy = slab_alloc(&group->chunk_slab);
+	memcpy(copy, chunk, sizeof(struct xct_chunk));
+	copy->version = group->view_version;
+	view_retire(&group->chunk_slab, chunk);
+	group->xct_chunks[index] = chunk = copy;
+	stats_add(STAT_CHUNK_ALLOCS, 1);
     }
-    else {
-	 prev_xct->next = next_xct; 
+    chunk->uid[row] = XCT_DEAD;
+    chunk->user_prev[row] = XCT_NONE;
+    chunk->cents[row] = 0;
+    chunk->live--;
+    group->xct_live--;
+
+    if (chunk->live == 0 && index != (group->xct_rows - 1) / XCT_CHUNK_ROWS){
+	release_xct_chunk(group, index);
     }
-    // Free space allocated for name and xct
-    free(current_xct->name);
-    free(current_xct);
 }
-
-
-
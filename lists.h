@@ -1,44 +1,205 @@
 #ifndef LISTS_H
 #define LISTS_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "htable.h"
+#include "intern.h"
+#include "memory.h"
+#include "pool.h"
+#include "trie.h"
+
+#define USER_MAX_LEVEL 24	// Enough skip list levels for 4^24 users
+#define USER_INLINE_LEVELS 2	// Links stored inside the User itself (15 in 16 users)
+#define XCT_CHUNK_ROWS 1024	// Transactions per chunk of a group's history
+#ifndef XCT_HOT_CHUNKS
+#define XCT_HOT_CHUNKS 4	// Newest chunks kept as plain columns; older ones are sealed into cold blocks
+#endif
+#define XCT_NONE 0		// Sequence reference meaning "no transaction"
+#define XCT_DEAD UINT32_MAX	// uid of a transaction whose user was removed
+#define XCT_MAX_CENTS 2147483647 // Largest amount of one transaction, so no sum can overflow
+#define CENTS_BUFFER 24		// Room for any int64_t amount formatted by format_cents
+#define TIME_BUFFER 32		// Room for any time formatted by format_time
+#define XCT_TIME_NOW INT64_MIN	// Stamp a transaction with the time it is posted
+#define RANK_MERGE_RATIO 8	// Bulk commands rebuild the balance order once 1 in this many users move
+
+/* One forward link of the balance-ordered skip list. span is the number of
+* users passed over (at the bottom level) when following next, which is what
+* lets rank queries run in O(log n).
+*/
+struct user_link {
+	struct user *next;
+	size_t span;
+};
+
 struct group {
 	char *name;
-	struct user *users;
-	struct xct *xcts;
+	struct user *users;		// Lowest (balance, name) first
+	struct user *users_last;	// Highest (balance, name)
+	struct xct_chunk **xct_chunks;	// Transaction history, oldest chunk first
+	size_t xct_chunk_capacity;
+	struct xct_block **xct_cold;	// Sealed chunks, NULL where the chunk is hot or released
+	int64_t *xct_chunk_start;	// Time of each chunk's first row, kept after the chunk is released
+	size_t xct_cold_count;		// Blocks in xct_cold
+	size_t xct_cold_bytes;		// Bytes they take, headers included
+	uint32_t xct_rows;		// Transactions ever appended, live or dead
+	size_t xct_live;
+	int64_t xct_last_time;		// Time of the newest transaction, which no later one may precede
+	int64_t balance_total;		// Sum of the balances, so of the live transactions too
+	__int128 balance_squares;	// Sum of the squares of the balances, exact, for their variance
 	struct group *next;
+	HTable user_index;		// User name -> User, mirrors the users list
+	Trie user_trie;			// User name -> User again, for searches by prefix and spelling
+	struct group_index *index;	// Only set on the head of the group list
+	struct user_link rank_head[USER_MAX_LEVEL]; // Skip list head over users
+	int rank_level;			// Levels of rank_head in use
+	size_t user_count;
+	Arena arena;			// Names and the slabs below, released with the group
+	Slab user_slab;
+	Slab chunk_slab;
+	Slab link_slab;			// Links of users taller than USER_INLINE_LEVELS
+	struct view *view;		// Newest read view, NULL until a reader needs one (see view.h)
+	uint64_t order_version;		// Bumped by every change to the balance order
+	uint32_t view_version;		// Bumped whenever a view takes the transaction history
+	struct mem_account memory;	// Bytes the group holds, by kind (see memory.h)
+};
+
+/* Name index for a whole group list, owned by the first group in the list. 
+* Lets find_group avoid walking the list and add_group append in O(1).
+*/
+struct group_index {
+	HTable by_name;			// Group name -> Group
+	struct group *tail;		// Last group in the list
 };
 
 struct user {
-	char *name;
-	double balance;
+	const char *name;		// Interned, shared by every group the user is in
+	uint32_t id;			// Interned ID of name
+	int unranked;			// Out of the balance order while a bulk command runs
+	uint32_t membership;		// Where the user directory keeps this user (see directory.h)
+	int64_t balance;		// In cents
 	struct user *next;
+	struct user *prev;		// NULL for the first user in the group
+	int level;			// Number of entries in links
+	struct user_link *links;	// links[0].next == next
+	struct user_link inline_links[USER_INLINE_LEVELS];
+	uint32_t last_xct;		// Reference to this user's most recent transaction
+	size_t xct_count;
 };
 
-struct xct{
-	char *name;
-	double amount;
-	struct xct *next;
+/* A transaction is a row in its group's history. Rows are numbered in the
+* order they were added; a reference to row n is stored as n + 1 so that
+* XCT_NONE can be 0. Rows are also in time order, so the history doubles as
+* an index by time. Each chunk stores its rows by column, so a scan over one
+* column (say, summing amounts) reads nothing else. Rows of removed users stay
+* in place with uid XCT_DEAD and zero cents until their whole chunk is dead,
+* at which point the chunk is released. A chunk that a read view shares is
+* copied before any of its rows is changed.
+*/
+struct xct_chunk {
+	size_t live;			// Rows not yet marked XCT_DEAD
+	uint32_t version;		// Its group's view_version when made; older chunks may be in a view
+	uint32_t uid[XCT_CHUNK_ROWS];	// Interned ID of the user's name
+	uint32_t user_prev[XCT_CHUNK_ROWS]; // Reference to the same user's previous transaction
+	int64_t cents[XCT_CHUNK_ROWS];	// Amount in hundredths
+	int64_t time[XCT_CHUNK_ROWS];	// Seconds since the epoch, UTC
+};
+
+/* A chunk that has fallen out of the newest XCT_HOT_CHUNKS is sealed into a
+* cold block: its rows compressed (see cold.h) and never rewritten. Removing
+* a user only sets their dictionary entry in dead, and the amounts of the
+* live rows are summed so that group totals need not decode the block. A
+* shared block is copied before dead is changed, as a shared chunk would be.
+*/
+struct xct_block {
+	uint32_t version;		// Like a chunk's
+	uint32_t live;			// Rows neither dead when sealed nor of an entry in dead
+	int64_t sum;			// Cents of the live rows
+	uint32_t size;			// Bytes of data
+	uint16_t names;			// Dictionary entries, one per user with a row there when sealed
+	uint8_t uid_bytes;		// Widths of the dictionary columns
+	uint8_t gap_bytes;
+	uint8_t count_bytes;
+	uint8_t sum_bytes;
+	uint64_t dead[XCT_CHUNK_ROWS / 64]; // Entries of users removed since the block was sealed
+	uint8_t data[];
+};
+
+/* Where a chunk is read from: the hot chunk itself, or a cold block decoded
+* into scratch. The last block decoded is kept, so rows read in order only
+* decode each block once.
+*/
+struct xct_reader {
+	size_t index;			// Chunk decoded into scratch, or SIZE_MAX
+	struct xct_chunk scratch;
 };
 
 typedef struct group Group;
 typedef struct user User;
-typedef struct xct Xct;
 
 int add_group(Group **group_list, const char *group_name);
-void list_groups(Group *group_list);
+void list_groups(Group *group_list, size_t count, size_t cursor);
 Group *find_group(Group *group_list, const char *group_name);
+void free_groups(Group *group_list);
+void pool_stats(Group *group_list, Group *group);
+void memory_usage(Group *group_list, Group *group);
 
 int add_user(Group *group, const char *user_name);
+size_t add_users(Group *group, char **user_names, size_t count, char **added_names);
+User *find_user(Group *group, const char *user_name);
+User *create_user(Group *group, uint32_t id);
+void index_user(Group *group, User *user);
+int user_admit(Group *group, size_t count);
 int remove_user(Group *group, const char *user_name);
-void list_users(Group *group);
+void list_users(Group *group, size_t count, size_t cursor);
+void find_users(Group *group, const char *prefix, size_t limit);
+void suggest_users(Group *group, const char *user_name);
 int user_balance(Group *group, const char *user_name);
 int under_paid(Group *group);
 User *find_prev_user(Group *group, const char *user_name);
+void track_balance(Group *group, int64_t old_balance, int64_t new_balance);
+void group_summary(Group *group);
+int fair_share(Group *group, const char *user_name);
 
-int add_xct(Group *group, const char *user_name, double amount);
+int add_xct(Group *group, const char *user_name, int64_t cents, int64_t time);
+void add_xcts(Group *group, User **users, const int64_t *cents, size_t count, int64_t time);
+int64_t xct_now(Group *group);
 void recent_xct(Group *group, long nu_xct);
+uint32_t recent_xct_page(Group *group, long num_xct, uint32_t cursor);
+void xct_range(Group *group, int64_t from, int64_t to);
+int user_xct(Group *group, const char *user_name, long num_xct);
 void remove_xct(Group *group, const char *user_name);
+struct xct_chunk *alloc_xct_chunk(Group *group, size_t index);
+int xct_admit(Group *group, size_t rows);
+void seal_xct_chunks(Group *group);
+void load_xct_block(Group *group, size_t index, struct xct_block *block);
+void xct_reader_init(struct xct_reader *reader);
+const struct xct_chunk *xct_read(Group *group, size_t index, struct xct_reader *reader);
+void group_total(Group *group);
+int user_total(Group *group, const char *user_name);
+void recompute_balances(Group *group);
+size_t settle(Group *group, int apply, int64_t time);
+
+int user_cmp(const User *a, int64_t balance, const char *name);
+int rank_user(Group *group, const char *user_name);
+void top_paid(Group *group, long k);
+
+void rank_init(Group *group);
+int rank_random_level(void);
+void rank_insert(Group *group, User *user);
+void rank_remove(Group *group, User *user);
+void rank_build(Group *group, User **sorted, size_t count);
+void rank_merge(Group *group, User **loose, size_t count);
+size_t rank_of(Group *group, User *user);
+User *rank_nth(Group *group, size_t rank);
+
+#define INPUT_ARG_MAX_NUM 1024	// Arguments per command, plus the terminating NULL
 
 void error(const char *msg);
+int parse_cents(const char *text, int64_t *cents);
+char *format_cents(int64_t cents, char *buffer);
+int parse_time(const char *text, int64_t *time);
+char *format_time(int64_t time, char *buffer);
+int process_args(int cmd_argc, char **cmd_argv, Group **group_list_addr);
 
 #endif
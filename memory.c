@@ -0,0 +1,150 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "memory.h"
+
+size_t mem_budget;			// Bytes the process may hold, 0 for no budget
+size_t mem_group_budget;		// Bytes each group may hold, 0 for no budget
+
+const char *const mem_kind_names[MEM_KIND_COUNT] = {
+    [MEM_GROUP] = "Groups",
+    [MEM_USER] = "Users",
+    [MEM_XCT] = "Transactions",
+    [MEM_NAME] = "Names",
+};
+
+static _Atomic size_t totals[MEM_KIND_COUNT];	// Every account's bytes by kind, and the shared names
+static _Atomic size_t committed;		// Every charge, plus what mem_admit set aside for commands still running
+static _Thread_local size_t set_aside;		// What this thread's command has left of what mem_admit set aside
+
+/* Charge bytes of kind to account, which may be NULL for memory no group
+* owns, and to the process total.
+*/
+void mem_charge(struct mem_account *account, int kind, size_t bytes) {
+    if (account != NULL) {
+        account->bytes[kind] += bytes;
+    }
+    atomic_fetch_add_explicit(&totals[kind], bytes, memory_order_relaxed);
+    // Bytes the command was admitted for are already committed
+    size_t covered = bytes < set_aside ? bytes : set_aside;
+    set_aside -= covered;
+    if (bytes > covered) {
+        atomic_fetch_add_explicit(&committed, bytes - covered, memory_order_relaxed);
+    }
+}
+
+/* Give back bytes of kind charged to account (or to no group, if NULL).
+*/
+void mem_credit(struct mem_account *account, int kind, size_t bytes) {
+    if (account != NULL) {
+        account->bytes[kind] -= bytes;
+    }
+    atomic_fetch_sub_explicit(&totals[kind], bytes, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&committed, bytes, memory_order_relaxed);
+}
+
+/* Give back everything charged to account, whose owner is being freed.
+*/
+void mem_close(struct mem_account *account) {
+    for (int kind = 0; kind < MEM_KIND_COUNT; kind++) {
+        mem_credit(account, kind, account->bytes[kind]);
+    }
+}
+
+/* Bytes charged to account, of every kind.
+*/
+size_t mem_account_bytes(const struct mem_account *account) {
+    size_t bytes = 0;
+    for (int kind = 0; kind < MEM_KIND_COUNT; kind++) {
+        bytes += account->bytes[kind];
+    }
+    return bytes;
+}
+
+/* Bytes of kind charged in the whole process.
+*/
+size_t mem_kind_total(int kind) {
+    return atomic_load_explicit(&totals[kind], memory_order_relaxed);
+}
+
+/* Bytes charged in the whole process, of every kind.
+*/
+size_t mem_total(void) {
+    size_t bytes = 0;
+    for (int kind = 0; kind < MEM_KIND_COUNT; kind++) {
+        bytes += mem_kind_total(kind);
+    }
+    return bytes;
+}
+
+/* Return 0 if bytes more may be charged to account (NULL for a new group)
+* without going over a budget, or MEM_OVER_GROUP or MEM_OVER_TOTAL if not.
+* Charging nothing is always allowed, even once a budget has been passed.
+*
+* Admitted bytes are set aside in the process total in the same atomic step
+* as the check, so commands running on other threads cannot all pass it with
+* room for only one of them. The command's charges use them up, and
+* mem_settle gives back whatever it did not charge.
+*/
+int mem_admit(const struct mem_account *account, size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    if (mem_group_budget > 0 && (account != NULL ? mem_account_bytes(account) : 0) + bytes > mem_group_budget) {
+        return MEM_OVER_GROUP;
+    }
+    return mem_admit_shared(bytes);
+}
+
+/* Like mem_admit, for bytes that will be charged to no group, so only the
+* process budget applies: returns 0 or MEM_OVER_TOTAL.
+*/
+int mem_admit_shared(size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    size_t current = atomic_load_explicit(&committed, memory_order_relaxed);
+    do {
+        if (mem_budget > 0 && current + bytes > mem_budget) {
+            return MEM_OVER_TOTAL;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&committed, &current, current + bytes,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    set_aside += bytes;
+    return 0;
+}
+
+/* Give back what mem_admit set aside for the command this thread has just
+* finished and that it did not charge.
+*/
+void mem_settle(void) {
+    if (set_aside > 0) {
+        atomic_fetch_sub_explicit(&committed, set_aside, memory_order_relaxed);
+        set_aside = 0;
+    }
+}
+
+/* Parse text as a number of bytes, optionally followed by K, M or G for
+* kibibytes, mebibytes or gibibytes. Returns 0, or -1 if text is not such a
+* number or the number does not fit.
+*/
+int parse_bytes(const char *text, size_t *bytes) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || *text == '-' || errno != 0) {
+        return -1;
+    }
+    int shift = 0;
+    switch (*end) {
+    case 'K': shift = 10; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || value > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    *bytes = (size_t) value << shift;
+    return 0;
+}
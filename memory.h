@@ -0,0 +1,51 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+
+/* Memory accounting and budgets. Each group keeps an account of the bytes it
+* holds, by kind, and every charge to a group also goes to a process-wide
+* total, which the interned names and the user directory that all groups
+* share are charged to as well. Only what outlives a command is counted: a
+* group's users, its hot chunks and cold blocks, its name and its indexes, at
+* the size they were allocated with. Scratch buffers and read views are not.
+*
+* A budget caps the bytes of every group (mem_group_budget) or of the whole
+* process (mem_budget); 0 means no cap. A command that would allocate asks
+* mem_admit first and fails with an error, changing nothing, rather than grow
+* past a budget, and calls mem_settle once it is done. Group accounts are only
+* touched by the thread running that group's commands; the process total is
+* atomic, and mem_admit reserves its share of it before the command allocates.
+*/
+
+enum mem_kind {
+	MEM_GROUP,			// Group headers, chunk directories
+	MEM_USER,			// Users, their tall links, the name index and the user directory
+	MEM_XCT,			// Hot chunks and cold blocks
+	MEM_NAME,			// Group names, interned user names and the directory's trie
+	MEM_KIND_COUNT
+};
+
+#define MEM_OVER_GROUP -1		// mem_admit: the group's budget would be exceeded
+#define MEM_OVER_TOTAL -2		// mem_admit: the process budget would be exceeded
+
+struct mem_account {
+	size_t bytes[MEM_KIND_COUNT];
+};
+
+extern size_t mem_budget;
+extern size_t mem_group_budget;
+extern const char *const mem_kind_names[MEM_KIND_COUNT];
+
+void mem_charge(struct mem_account *account, int kind, size_t bytes);
+void mem_credit(struct mem_account *account, int kind, size_t bytes);
+void mem_close(struct mem_account *account);
+size_t mem_account_bytes(const struct mem_account *account);
+size_t mem_kind_total(int kind);
+size_t mem_total(void);
+int mem_admit(const struct mem_account *account, size_t bytes);
+int mem_admit_shared(size_t bytes);
+void mem_settle(void);
+int parse_bytes(const char *text, size_t *bytes);
+
+#endif
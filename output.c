@@ -0,0 +1,410 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "output.h"
+
+#define OUT_MIN_CAPACITY 256
+#define OUT_IOV_MAX 64			// Spans gathered into one writev
+#define OUT_WRITEV_MIN (64 * 1024)	// Smaller flushes go through stdio's buffer instead
+
+int out_format = OUT_TEXT;		// How listings are written
+
+static _Thread_local OutBuf *sink;	// Where this thread's output goes, or NULL for the real streams
+
+// This thread's listing rows not yet passed to out_write
+static _Thread_local char rows[OUT_LIST_BUFFER];
+static _Thread_local size_t rows_used;
+
+/* Send this thread's output to buffer from now on, or back to stdout and
+* stderr if buffer is NULL.
+*/
+void out_capture(OutBuf *buffer) {
+    sink = buffer;
+}
+
+static void out_reserve(OutBuf *buffer, size_t size) {
+    if (buffer->used + size <= buffer->capacity) {
+        return;
+    }
+    size_t capacity = buffer->capacity == 0 ? OUT_MIN_CAPACITY : buffer->capacity;
+    while (buffer->used + size > capacity) {
+        capacity *= 2;
+    }
+    buffer->data = realloc(buffer->data, capacity);
+    if (buffer->data == NULL) {
+        perror("Error allocating memory for output. Exiting...");
+        exit(1);
+    }
+    buffer->capacity = capacity;
+}
+
+/* Record that the buffer's text up to used belongs to stream.
+*/
+static void out_mark(OutBuf *buffer, int stream) {
+    if (buffer->span_count > 0 && buffer->spans[buffer->span_count - 1].stream == stream) {
+        buffer->spans[buffer->span_count - 1].end = buffer->used;
+        return;
+    }
+    if (buffer->span_count == buffer->span_capacity) {
+        buffer->span_capacity = buffer->span_capacity == 0 ? 4 : buffer->span_capacity * 2;
+        buffer->spans = realloc(buffer->spans, buffer->span_capacity * sizeof(struct out_span));
+        if (buffer->spans == NULL) {
+            perror("Error allocating memory for output. Exiting...");
+            exit(1);
+        }
+    }
+    buffer->spans[buffer->span_count].stream = stream;
+    buffer->spans[buffer->span_count].end = buffer->used;
+    buffer->span_count++;
+}
+
+static void out_vappend(OutBuf *buffer, int stream, const char *format, va_list args) {
+    va_list retry;
+    va_copy(retry, args);
+    int length = vsnprintf(buffer->data + buffer->used, buffer->capacity - buffer->used, format, args);
+    if (length < 0) {
+        va_end(retry);
+        return;
+    }
+    if ((size_t) length >= buffer->capacity - buffer->used) {
+        out_reserve(buffer, length + 1);
+        vsnprintf(buffer->data + buffer->used, length + 1, format, retry);
+    }
+    va_end(retry);
+    buffer->used += length;
+    out_mark(buffer, stream);
+}
+
+/* printf to stdout, or to this thread's capture buffer.
+*/
+void out_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (sink == NULL) {
+        vprintf(format, args);
+    } else {
+        out_reserve(sink, 1); // vsnprintf needs somewhere to write even when measuring
+        out_vappend(sink, OUT_STDOUT, format, args);
+    }
+    va_end(args);
+}
+
+/* printf to stderr, or to this thread's capture buffer.
+*/
+void out_eprintf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (sink == NULL) {
+        vfprintf(stderr, format, args);
+    } else {
+        out_reserve(sink, 1);
+        out_vappend(sink, OUT_STDERR, format, args);
+    }
+    va_end(args);
+}
+
+/* Write size bytes of data to stdout, or to this thread's capture buffer.
+* Unlike out_printf, data may contain NULs.
+*/
+void out_write(const char *data, size_t size) {
+    if (sink == NULL) {
+        fwrite(data, 1, size, stdout);
+        return;
+    }
+    out_reserve(sink, size);
+    memcpy(sink->data + sink->used, data, size);
+    sink->used += size;
+    out_mark(sink, OUT_STDOUT);
+}
+
+/* Empty buffer without writing it anywhere, keeping its memory for reuse.
+*/
+void out_reset(OutBuf *buffer) {
+    buffer->used = 0;
+    buffer->span_count = 0;
+}
+
+/* Write everything captured in buffer to the streams it was meant for and
+* empty it, keeping its memory for reuse.
+*/
+void out_flush(OutBuf *buffer) {
+    out_flush_all(&buffer, 1);
+}
+
+/* writev all of iov[0, count) to fd, however many calls that takes. Output
+* that cannot be written is dropped, as stdio would.
+*/
+static void write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+/* out_flush each of buffers[0, count) in turn. Large batches skip stdio: its
+* buffers are flushed first, and then each run of spans bound for the same
+* stream, across buffers, goes out in one writev.
+*/
+void out_flush_all(OutBuf **buffers, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += buffers[i]->used;
+    }
+
+    if (total < OUT_WRITEV_MIN) {
+        for (size_t i = 0; i < count; i++) {
+            size_t start = 0;
+            for (size_t j = 0; j < buffers[i]->span_count; j++) {
+                FILE *stream = buffers[i]->spans[j].stream == OUT_STDERR ? stderr : stdout;
+                fwrite(buffers[i]->data + start, 1, buffers[i]->spans[j].end - start, stream);
+                start = buffers[i]->spans[j].end;
+            }
+            out_reset(buffers[i]);
+        }
+        return;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    struct iovec iov[OUT_IOV_MAX];
+    int iov_count = 0, fd = STDOUT_FILENO;
+    for (size_t i = 0; i < count; i++) {
+        size_t start = 0;
+        for (size_t j = 0; j < buffers[i]->span_count; j++) {
+            int span_fd = buffers[i]->spans[j].stream == OUT_STDERR ? STDERR_FILENO : STDOUT_FILENO;
+            size_t end = buffers[i]->spans[j].end;
+            if (end == start) {
+                continue;
+            }
+            if (iov_count > 0 && (span_fd != fd || iov_count == OUT_IOV_MAX)) {
+                write_all(fd, iov, iov_count);
+                iov_count = 0;
+            }
+            fd = span_fd;
+            iov[iov_count].iov_base = buffers[i]->data + start;
+            iov[iov_count].iov_len = end - start;
+            iov_count++;
+            start = end;
+        }
+    }
+    write_all(fd, iov, iov_count);
+    for (size_t i = 0; i < count; i++) {
+        out_reset(buffers[i]);
+    }
+}
+
+void out_free(OutBuf *buffer) {
+    free(buffer->data);
+    free(buffer->spans);
+    buffer->data = NULL;
+    buffer->spans = NULL;
+    buffer->used = buffer->capacity = 0;
+    buffer->span_count = buffer->span_capacity = 0;
+}
+
+/* Set *format from its name: text, csv or json. Returns 0, or -1 if there is
+* no such format.
+*/
+int out_parse_format(const char *name, int *format) {
+    static const char *const names[] = {
+        [OUT_TEXT] = "text",
+        [OUT_CSV] = "csv",
+        [OUT_JSON] = "json",
+    };
+    for (int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *format = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Write value in decimal into buffer, which must hold OUT_U64_BUFFER bytes.
+* Returns buffer.
+*/
+char *out_u64(uint64_t value, char *buffer) {
+    char digits[OUT_U64_BUFFER];
+    char *p = digits + sizeof(digits);
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    size_t length = digits + sizeof(digits) - p;
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+static void rows_flush(void) {
+    out_write(rows, rows_used);
+    rows_used = 0;
+}
+
+static void rows_put(const char *data, size_t size) {
+    if (rows_used + size > sizeof(rows)) {
+        rows_flush();
+        if (size > sizeof(rows)) {
+            out_write(data, size);
+            return;
+        }
+    }
+    memcpy(rows + rows_used, data, size);
+    rows_used += size;
+}
+
+static void rows_putc(char c) {
+    if (rows_used == sizeof(rows)) {
+        rows_flush();
+    }
+    rows[rows_used++] = c;
+}
+
+/* A CSV field, quoted if it holds anything that would otherwise end it.
+*/
+static void put_csv(const char *field) {
+    if (strpbrk(field, ",\"\r\n") == NULL) {
+        rows_put(field, strlen(field));
+        return;
+    }
+    rows_putc('"');
+    for (const char *p = field; *p != '\0'; p++) {
+        if (*p == '"') {
+            rows_putc('"');
+        }
+        rows_putc(*p);
+    }
+    rows_putc('"');
+}
+
+/* A JSON string, with its quotes.
+*/
+static void put_json(const char *field) {
+    static const char hex[] = "0123456789abcdef";
+    rows_putc('"');
+    const char *run = field;
+    for (const char *p = field; *p != '\0'; p++) {
+        unsigned char c = (unsigned char) *p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        rows_put(run, p - run);
+        run = p + 1;
+        char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        switch (c) {
+        case '"': case '\\': rows_putc('\\'); rows_putc(c); break;
+        case '\n': rows_put("\\n", 2); break;
+        case '\r': rows_put("\\r", 2); break;
+        case '\t': rows_put("\\t", 2); break;
+        default: rows_put(escape, sizeof(escape)); break;
+        }
+    }
+    rows_put(run, strlen(run));
+    rows_putc('"');
+}
+
+/* Start writing a listing: its text header or its CSV header row.
+*/
+void out_list_begin(const struct out_list *list) {
+    if (out_format == OUT_TEXT) {
+        if (list->text_header != NULL) {
+            rows_put(list->text_header, strlen(list->text_header));
+        }
+    } else if (out_format == OUT_CSV) {
+        for (int i = 0; i < list->columns; i++) {
+            if (i > 0) {
+                rows_putc(',');
+            }
+            put_csv(list->names[i]);
+        }
+        rows_putc('\n');
+    }
+}
+
+/* Write a row of list->columns fields.
+*/
+void out_list_row(const struct out_list *list, const char *const *fields) {
+    if (out_format == OUT_TEXT) {
+        const char *run = list->text_row;
+        int column = 0;
+        for (const char *p = run; *p != '\0'; p++) {
+            if (p[0] == '%' && p[1] == 's') {
+                rows_put(run, p - run);
+                rows_put(fields[column], strlen(fields[column]));
+                column++;
+                run = ++p + 1;
+            }
+        }
+        rows_put(run, strlen(run));
+    } else if (out_format == OUT_CSV) {
+        for (int i = 0; i < list->columns; i++) {
+            if (i > 0) {
+                rows_putc(',');
+            }
+            put_csv(fields[i]);
+        }
+        rows_putc('\n');
+    } else {
+        rows_putc('{');
+        for (int i = 0; i < list->columns; i++) {
+            if (i > 0) {
+                rows_putc(',');
+            }
+            put_json(list->names[i]);
+            rows_putc(':');
+            if (list->numeric & (1u << i)) {
+                rows_put(fields[i], strlen(fields[i]));
+            } else {
+                put_json(fields[i]);
+            }
+        }
+        rows_put("}\n", 2);
+    }
+}
+
+/* Write the cursor that continues a listing that stopped short of its end.
+* In CSV it goes on a comment line, as it has none of the rows' columns.
+*/
+void out_list_cursor(uint64_t cursor) {
+    char number[OUT_U64_BUFFER];
+    static const char *const before[] = {
+        [OUT_TEXT] = "Next cursor: ",
+        [OUT_CSV] = "# next_cursor ",
+        [OUT_JSON] = "{\"next_cursor\":",
+    };
+    static const char *const after[] = {
+        [OUT_TEXT] = " \n",
+        [OUT_CSV] = "\n",
+        [OUT_JSON] = "}\n",
+    };
+    rows_put(before[out_format], strlen(before[out_format]));
+    out_u64(cursor, number);
+    rows_put(number, strlen(number));
+    rows_put(after[out_format], strlen(after[out_format]));
+}
+
+/* Finish a listing, passing whatever is left of it to out_write.
+*/
+void out_list_end(void) {
+    if (rows_used > 0) {
+        rows_flush();
+    }
+}
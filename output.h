@@ -0,0 +1,77 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* All command output goes through out_printf and out_eprintf. Normally they
+* write straight to stdout and stderr, but a thread can capture its output in
+* an OutBuf instead, which keeps track of which stream each piece of text was
+* meant for so that out_flush can replay it later, in order. out_flush_all
+* replays many buffers at once, gathering their text into as few vectored
+* writes as the order of the streams allows.
+*
+* Listings (users, groups, transactions) are written a row at a time through
+* out_list_row, in the format chosen by out_format: the text each command has
+* always printed, CSV with a header row, or JSON lines with one object per
+* row. Rows are assembled into a buffer of OUT_LIST_BUFFER bytes without any
+* printf, and only a full buffer is passed on to out_write.
+*/
+
+#define OUT_STDOUT 0
+#define OUT_STDERR 1
+
+#define OUT_TEXT 0
+#define OUT_CSV 1
+#define OUT_JSON 2
+
+#define OUT_LIST_BUFFER (64 * 1024)
+#define OUT_LIST_MAX_COLUMNS 8
+#define OUT_U64_BUFFER 21		// Room for any uint64_t formatted by out_u64
+
+struct out_span {
+	int stream;
+	size_t end;			// The span runs from the previous span's end to here
+};
+
+struct outbuf {
+	char *data;
+	size_t used;
+	size_t capacity;
+	struct out_span *spans;
+	size_t span_count;
+	size_t span_capacity;
+};
+
+typedef struct outbuf OutBuf;
+
+/* The shape of a listing. Columns whose bit is set in numeric are written
+* unquoted in JSON, so they must always be valid JSON numbers.
+*/
+struct out_list {
+	const char *text_header;	// Printed before the rows in text format, or NULL
+	const char *text_row;		// A row in text format, with %s for each column in turn
+	int columns;
+	const char *names[OUT_LIST_MAX_COLUMNS]; // For the CSV header and the JSON keys
+	unsigned numeric;		// Bit i set if column i is a number
+};
+
+extern int out_format;
+
+void out_capture(OutBuf *buffer);
+void out_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void out_eprintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void out_write(const char *data, size_t size);
+void out_reset(OutBuf *buffer);
+void out_flush(OutBuf *buffer);
+void out_flush_all(OutBuf **buffers, size_t count);
+void out_free(OutBuf *buffer);
+
+int out_parse_format(const char *name, int *format);
+void out_list_begin(const struct out_list *list);
+void out_list_row(const struct out_list *list, const char *const *fields);
+void out_list_cursor(uint64_t cursor);
+void out_list_end(void);
+char *out_u64(uint64_t value, char *buffer);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pool.h"
+#include "stats.h"
+
+#define POOL_ALIGN 16
+#define ARENA_MIN_BLOCK 1024		// Small groups stay small
+#define ARENA_MAX_BLOCK (1 << 20)
+#define SLAB_MIN_REFILL 8
+#define SLAB_MAX_REFILL 1024
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;			// Usable bytes after the header
+};
+
+/* With POOL_USE_MALLOC every slab object is its own malloc block, linked into
+* its slab so that slab_release can still free them all.
+*/
+struct slab_object {
+	struct slab_object *next;
+	struct slab_object *prev;
+};
+
+/* Size of the block header, rounded so the data after it stays aligned.
+*/
+#define ARENA_HEADER ((sizeof(struct arena_block) + POOL_ALIGN - 1) & ~(size_t) (POOL_ALIGN - 1))
+
+static size_t align_up(size_t size) {
+    return (size + POOL_ALIGN - 1) & ~(size_t) (POOL_ALIGN - 1);
+}
+
+/* Initialize an empty arena. No memory is allocated until the first request.
+*/
+void arena_init(Arena *arena) {
+    arena->blocks = NULL;
+    arena->cursor = NULL;
+    arena->limit = NULL;
+    arena->next_block_size = ARENA_MIN_BLOCK;
+    arena->reserved = 0;
+    arena->used = 0;
+}
+
+/* Link a new block of at least size usable bytes in front of the arena's
+* chain and return a pointer to its data.
+*/
+static char *arena_new_block(Arena *arena, size_t size) {
+    struct arena_block *block = malloc(ARENA_HEADER + size);
+    if (block == NULL) {
+        perror("Error allocating memory for arena. Exiting...");
+        exit(1);
+    }
+    block->next = arena->blocks;
+    block->size = size;
+    arena->blocks = block;
+    arena->reserved += ARENA_HEADER + size;
+    stats_add(STAT_ARENA_BLOCKS, 1);
+    return (char *) block + ARENA_HEADER;
+}
+
+/* Return size bytes of 16-byte aligned memory that stays valid until the
+* arena is released. Individual allocations cannot be freed.
+*/
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size);
+    arena->used += size;
+
+#ifdef POOL_USE_MALLOC
+    // Every allocation becomes its own block, so release still frees them all
+    return arena_new_block(arena, size);
+#else
+    if (arena->cursor == NULL || (size_t) (arena->limit - arena->cursor) < size) {
+        size_t block_size = arena->next_block_size;
+        if (size > block_size) {
+            // Oversized requests get a block of their own and leave the current one alone
+            return arena_new_block(arena, size);
+        }
+        arena->cursor = arena_new_block(arena, block_size);
+        arena->limit = arena->cursor + block_size;
+        if (arena->next_block_size < ARENA_MAX_BLOCK) {
+            arena->next_block_size *= 2;
+        }
+    }
+
+    void *result = arena->cursor;
+    arena->cursor += size;
+    return result;
+#endif
+}
+
+/* Copy str into the arena.
+*/
+char *arena_strdup(Arena *arena, const char *str) {
+    size_t length = strlen(str);
+    char *copy = arena_alloc(arena, length + 1);
+    memcpy(copy, str, length + 1);
+    return copy;
+}
+
+/* Free every block of the arena in one go and leave it empty and reusable.
+*/
+void arena_release(Arena *arena) {
+    struct arena_block *block = arena->blocks;
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(arena);
+}
+
+/* Initialize a slab of objects of object_size bytes drawn from arena.
+*/
+void slab_init(Slab *slab, Arena *arena, size_t object_size) {
+    if (object_size < sizeof(void *)) {
+        object_size = sizeof(void *); // Free objects hold the free list link
+    }
+    slab->arena = arena;
+    slab->object_size = align_up(object_size);
+    slab->refill = SLAB_MIN_REFILL;
+    slab->free_list = NULL;
+    slab->live = 0;
+    slab->free = 0;
+    slab->objects = NULL;
+}
+
+/* Return an object, reusing a released one when possible. The object is not
+* zeroed.
+*/
+void *slab_alloc(Slab *slab) {
+    slab->live++;
+    stats_add(STAT_SLAB_ALLOCS, 1);
+
+#ifdef POOL_USE_MALLOC
+    struct slab_object *header = malloc(align_up(sizeof(struct slab_object)) + slab->object_size);
+    if (header == NULL) {
+        perror("Error allocating memory for object. Exiting...");
+        exit(1);
+    }
+    header->prev = NULL;
+    header->next = slab->objects;
+    if (slab->objects != NULL) {
+        slab->objects->prev = header;
+    }
+    slab->objects = header;
+    return (char *) header + align_up(sizeof(struct slab_object));
+#else
+    if (slab->free_list == NULL) {
+        // Carve a run of objects from the arena onto the free list
+        char *run = arena_alloc(slab->arena, slab->object_size * slab->refill);
+        for (size_t i = 0; i < slab->refill; i++) {
+            void *object = run + i * slab->object_size;
+            *(void **) object = slab->free_list;
+            slab->free_list = object;
+        }
+        slab->free += slab->refill;
+        if (slab->refill < SLAB_MAX_REFILL) {
+            slab->refill *= 2;
+        }
+    }
+
+    void *object = slab->free_list;
+    slab->free_list = *(void **) object;
+    slab->free--;
+    return object;
+#endif
+}
+
+/* Give object back to the slab it came from.
+*/
+void slab_free(Slab *slab, void *object) {
+    slab->live--;
+
+#ifdef POOL_USE_MALLOC
+    struct slab_object *header = (void *) ((char *) object - align_up(sizeof(struct slab_object)));
+    if (header->prev == NULL) {
+        slab->objects = header->next;
+    }
+    else {
+        header->prev->next = header->next;
+    }
+    if (header->next != NULL) {
+        header->next->prev = header->prev;
+    }
+    free(header);
+#else
+    *(void **) object = slab->free_list;
+    slab->free_list = object;
+    slab->free++;
+#endif
+}
+
+/* Forget every object of the slab. The memory itself belongs to the arena and
+* goes away with arena_release (with POOL_USE_MALLOC it is freed here).
+*/
+void slab_release(Slab *slab) {
+#ifdef POOL_USE_MALLOC
+    struct slab_object *header = slab->objects;
+    while (header != NULL) {
+        struct slab_object *next = header->next;
+        free(header);
+        header = next;
+    }
+#endif
+    slab_init(slab, slab->arena, slab->object_size);
+}
+
+/* Return the resident set size of this process in bytes, or 0 if it cannot be
+* read.
+*/
+size_t process_rss(void) {
+    unsigned long pages_total, pages_resident;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%lu %lu", &pages_total, &pages_resident) != 2) {
+        pages_resident = 0;
+    }
+    fclose(statm);
+    return (size_t) pages_resident * (size_t) sysconf(_SC_PAGESIZE);
+}
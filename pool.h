@@ -0,0 +1,52 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/* Arenas hand out memory by bumping a pointer through a chain of blocks and
+* give all of it back at once in arena_release. Slabs carve fixed-size objects
+* out of an arena and recycle released objects through a free list, so a
+* group's nodes sit next to each other and cost no malloc header each.
+*
+* Building with -DPOOL_USE_MALLOC turns both into plain malloc/free per object,
+* which is handy for comparing memory use and throughput against the pools.
+*/
+
+struct arena_block;
+struct slab_object;
+
+struct arena {
+	struct arena_block *blocks;	// Most recent block first
+	char *cursor;			// Next free byte of the current block
+	char *limit;			// End of the current block
+	size_t next_block_size;		// Blocks double in size up to ARENA_MAX_BLOCK
+	size_t reserved;		// Bytes obtained from malloc
+	size_t used;			// Bytes handed out
+};
+
+struct slab {
+	struct arena *arena;		// Where new objects are carved from
+	size_t object_size;
+	size_t refill;			// Objects carved per trip to the arena
+	void *free_list;		// Released objects, linked through their first word
+	size_t live;			// Objects currently handed out
+	size_t free;			// Objects waiting on the free list
+	struct slab_object *objects;	// Live objects, only tracked with POOL_USE_MALLOC
+};
+
+typedef struct arena Arena;
+typedef struct slab Slab;
+
+void arena_init(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *str);
+void arena_release(Arena *arena);
+
+void slab_init(Slab *slab, Arena *arena, size_t object_size);
+void *slab_alloc(Slab *slab);
+void slab_free(Slab *slab, void *object);
+void slab_release(Slab *slab);
+
+size_t process_rss(void);
+
+#endif
@@ -0,0 +1,306 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lists.h"
+#include "stats.h"
+
+/* The users of a group are kept in an indexable skip list ordered by
+* (balance, name). The bottom level doubles as the group's users list, so
+* list_users and under_paid keep walking next pointers, while inserts, removals
+* and rank lookups cost O(log n).
+*/
+
+/* Order users by balance, breaking ties by name so that the order is total.
+*/
+int user_cmp(const User *a, int64_t balance, const char *name) {
+    if (a->balance < balance) {
+        return -1;
+    }
+    if (a->balance > balance) {
+        return 1;
+    }
+    return strcmp(a->name, name);
+}
+
+/* The links leaving node, where NULL stands for the head of the list.
+*/
+static struct user_link *links_of(Group *group, User *node) {
+    return node == NULL ? group->rank_head : node->links;
+}
+
+/* Reset the skip list of an empty group.
+*/
+void rank_init(Group *group) {
+    for (int i = 0; i < USER_MAX_LEVEL; i++) {
+        group->rank_head[i].next = NULL;
+        group->rank_head[i].span = 0;
+    }
+    group->rank_level = 1;
+    group->user_count = 0;
+    group->users = NULL;
+    group->users_last = NULL;
+    group->order_version++;
+}
+
+/* Pick the level of a new node: level i+1 with probability 1/4^i.
+*/
+int rank_random_level(void) {
+    static _Thread_local uint64_t state = 0x9e3779b97f4a7c15ull; // Per thread, so executor workers never share it
+    int level = 1;
+
+    // xorshift64, good enough for balancing and reproducible between runs
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint64_t bits = state;
+    while (level < USER_MAX_LEVEL && (bits & 3) == 0) {
+        level++;
+        bits >>= 2;
+    }
+    return level;
+}
+
+/* Insert user into the skip list of group at the position given by its
+* current balance and name. user->level and user->links must already be set.
+*/
+void rank_insert(Group *group, User *user) {
+    User *update[USER_MAX_LEVEL];
+    size_t rank[USER_MAX_LEVEL];
+    User *x = NULL;
+    uint64_t steps = 0;
+
+    // Find the last node before user on every level, and its rank
+    for (int i = group->rank_level - 1; i >= 0; i--) {
+        rank[i] = (i == group->rank_level - 1) ? 0 : rank[i + 1];
+        struct user_link *links = links_of(group, x);
+        while (links[i].next != NULL && user_cmp(links[i].next, user->balance, user->name) < 0) {
+            rank[i] += links[i].span;
+            x = links[i].next;
+            links = x->links;
+            steps++;
+        }
+        update[i] = x;
+    }
+    stats_add(STAT_RANK_STEPS, steps);
+
+    if (user->level > group->rank_level) {
+        for (int i = group->rank_level; i < user->level; i++) {
+            rank[i] = 0;
+            update[i] = NULL;
+            group->rank_head[i].span = group->user_count;
+        }
+        group->rank_level = user->level;
+    }
+
+    for (int i = 0; i < user->level; i++) {
+        struct user_link *prev_links = links_of(group, update[i]);
+        user->links[i].next = prev_links[i].next;
+        prev_links[i].next = user;
+        user->links[i].span = prev_links[i].span - (rank[0] - rank[i]);
+        prev_links[i].span = (rank[0] - rank[i]) + 1;
+    }
+    for (int i = user->level; i < group->rank_level; i++) {
+        links_of(group, update[i])[i].span++;
+    }
+
+    // Keep the bottom level doubly linked
+    user->prev = update[0];
+    user->next = user->links[0].next;
+    if (user->next != NULL) {
+        user->next->prev = user;
+    }
+    else {
+        group->users_last = user;
+    }
+    if (user->prev == NULL) {
+        group->users = user;
+    }
+    else {
+        user->prev->next = user;
+    }
+    group->user_count++;
+    group->order_version++;
+}
+
+/* Rebuild the skip list of group from count users that are already in
+* (balance, name) order, in O(count). Every user must have its level and
+* links set; the group's previous users are forgotten.
+*/
+void rank_build(Group *group, User **sorted, size_t count) {
+    User *last[USER_MAX_LEVEL];
+    size_t last_rank[USER_MAX_LEVEL];
+
+    rank_init(group);
+    for (int i = 0; i < USER_MAX_LEVEL; i++) {
+        last[i] = NULL;
+        last_rank[i] = 0;
+    }
+
+    for (size_t k = 1; k <= count; k++) {
+        User *user = sorted[k - 1];
+        for (int i = 0; i < user->level; i++) {
+            struct user_link *links = links_of(group, last[i]);
+            links[i].next = user;
+            links[i].span = k - last_rank[i];
+            last[i] = user;
+            last_rank[i] = k;
+        }
+        if (user->level > group->rank_level) {
+            group->rank_level = user->level;
+        }
+        user->prev = k > 1 ? sorted[k - 2] : NULL;
+        user->next = k < count ? sorted[k] : NULL;
+    }
+
+    // Close every level, with spans reaching to the end of the list
+    for (int i = 0; i < group->rank_level; i++) {
+        struct user_link *links = links_of(group, last[i]);
+        links[i].next = NULL;
+        links[i].span = count - last_rank[i];
+    }
+    group->users = count > 0 ? sorted[0] : NULL;
+    group->users_last = count > 0 ? sorted[count - 1] : NULL;
+    group->user_count = count;
+}
+
+static int loose_order(const void *a, const void *b) {
+    const User *x = *(User * const *) a;
+    const User *y = *(User * const *) b;
+    return user_cmp(x, y->balance, y->name);
+}
+
+/* Put count users marked unranked into the balance order of group, along with
+* every user already there, and clear their marks. Marked users may still be
+* linked in at their old place, which is ignored, so a bulk command can change
+* balances without unlinking anyone. The users in loose are sorted and merged
+* with the rest in one walk before the skip list is rebuilt, which costs
+* O(n + count log count) instead of the O(count log n) of inserting them one
+* by one, and is the cheaper of the two once count is a fair part of n.
+*/
+void rank_merge(Group *group, User **loose, size_t count) {
+    User **sorted = malloc((group->user_count + count) * sizeof(User *));
+    if (sorted == NULL) {
+        perror("Error allocating memory for balance order. Exiting...");
+        exit(1);
+    }
+    qsort(loose, count, sizeof(User *), loose_order);
+
+    size_t total = 0, j = 0;
+    for (User *user = group->users; user != NULL; user = user->next) {
+        if (user->unranked) {
+            continue;
+        }
+        while (j < count && user_cmp(loose[j], user->balance, user->name) < 0) {
+            sorted[total++] = loose[j++];
+        }
+        sorted[total++] = user;
+    }
+    while (j < count) {
+        sorted[total++] = loose[j++];
+    }
+    for (size_t i = 0; i < count; i++) {
+        loose[i]->unranked = 0;
+    }
+
+    rank_build(group, sorted, total);
+    free(sorted);
+}
+
+/* Unlink user from the skip list of group. The user keeps its level and links
+* array so it can be inserted again after a balance change.
+*/
+void rank_remove(Group *group, User *user) {
+    User *x = NULL;
+    uint64_t steps = 0;
+
+    for (int i = group->rank_level - 1; i >= 0; i--) {
+        struct user_link *links = links_of(group, x);
+        while (links[i].next != NULL && links[i].next != user &&
+               user_cmp(links[i].next, user->balance, user->name) < 0) {
+            x = links[i].next;
+            links = x->links;
+            steps++;
+        }
+        if (links[i].next == user) {
+            links[i].span += user->links[i].span - 1;
+            links[i].next = user->links[i].next;
+        }
+        else {
+            links[i].span--;
+        }
+    }
+    stats_add(STAT_RANK_STEPS, steps);
+
+    while (group->rank_level > 1 && group->rank_head[group->rank_level - 1].next == NULL) {
+        group->rank_level--;
+    }
+
+    if (user->prev == NULL) {
+        group->users = user->next;
+    }
+    else {
+        user->prev->next = user->next;
+    }
+    if (user->next != NULL) {
+        user->next->prev = user->prev;
+    }
+    else {
+        group->users_last = user->prev;
+    }
+    user->next = NULL;
+    user->prev = NULL;
+    group->user_count--;
+    group->order_version++;
+}
+
+/* Return the 1-based position of user in the (balance, name) order, i.e. 1
+* for the lowest payer.
+*/
+size_t rank_of(Group *group, User *user) {
+    User *x = NULL;
+    size_t rank = 0;
+    uint64_t steps = 0;
+
+    for (int i = group->rank_level - 1; i >= 0; i--) {
+        struct user_link *links = links_of(group, x);
+        while (links[i].next != NULL && user_cmp(links[i].next, user->balance, user->name) <= 0) {
+            rank += links[i].span;
+            x = links[i].next;
+            links = x->links;
+            steps++;
+        }
+        if (x == user) {
+            break;
+        }
+    }
+    stats_add(STAT_RANK_STEPS, steps);
+    return x == user ? rank : 0;
+}
+
+/* Return the user at 1-based position rank in the (balance, name) order, or
+* NULL if rank is out of range.
+*/
+User *rank_nth(Group *group, size_t rank) {
+    User *x = NULL;
+    size_t traversed = 0;
+    uint64_t steps = 0;
+
+    if (rank == 0 || rank > group->user_count) {
+        return NULL;
+    }
+    for (int i = group->rank_level - 1; i >= 0; i--) {
+        struct user_link *links = links_of(group, x);
+        while (links[i].next != NULL && traversed + links[i].span <= rank) {
+            traversed += links[i].span;
+            x = links[i].next;
+            links = x->links;
+            steps++;
+        }
+        if (traversed == rank) {
+            break;
+        }
+    }
+    stats_add(STAT_RANK_STEPS, steps);
+    return traversed == rank ? x : NULL;
+}
@@ -0,0 +1,399 @@
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "commands.h"
+#include "ingest.h"
+#include "output.h"
+#include "server.h"
+#include "trace.h"
+
+#define SERVER_MAX_EVENTS 256
+#define SERVER_READ_SIZE (64 * 1024)	// Bytes read per wakeup, so busy clients take turns
+#define SERVER_MAX_LINE (64 * 1024)	// Longer lines get an error and the connection is closed
+#define SERVER_UNIX_PREFIX "unix:"
+
+enum { KIND_LISTENER, KIND_CONN };
+
+struct listener {
+	int kind;
+	int fd;
+	const char *path;		// Socket file to remove on shutdown, for Unix sockets
+};
+
+struct conn {
+	int kind;
+	int fd;
+	char *in;			// Bytes received but not yet run
+	size_t in_used;
+	size_t in_capacity;
+	OutBuf out;			// Responses not yet sent
+	size_t out_sent;
+	uint32_t events;		// What epoll is currently watching for
+	int eof;			// The client has finished sending
+	int quit;			// The client sent quit
+	struct conn *next;
+	struct conn *prev;
+};
+
+static volatile sig_atomic_t stopping;
+static struct conn *conns;		// Every open connection, so shutdown can close them
+
+static void on_signal(int signal) {
+    (void) signal;
+    stopping = 1;
+}
+
+static int open_unix(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    unlink(path); // A socket left behind by an earlier run
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_tcp(const char *address) {
+    char host[256];
+    const char *port = strrchr(address, ':');
+    struct addrinfo hints, *results;
+
+    if (port == NULL) {
+        port = address;
+        host[0] = '\0';
+    } else {
+        size_t length = port - address;
+        if (length >= sizeof(host)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(host, address, length);
+        host[length] = '\0';
+        port++;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    // Without a host, only this machine can connect; 0.0.0.0 or :: listens everywhere
+    if (getaddrinfo(host[0] == '\0' ? "127.0.0.1" : host, port, &hints, &results) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = results; ai != NULL && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1 || listen(fd, SOMAXCONN) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    return fd;
+}
+
+static void watch(int epoll_fd, int op, int fd, uint32_t events, void *item) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = item;
+    if (epoll_ctl(epoll_fd, op, fd, &event) == -1) {
+        perror("Error updating epoll. Exiting...");
+        exit(1);
+    }
+}
+
+static void accept_all(int epoll_fd, struct listener *listener) {
+    while (1) {
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Error accepting connection");
+            }
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+
+        struct conn *conn = calloc(1, sizeof(struct conn));
+        if (conn == NULL) {
+            perror("Error allocating memory for connection. Exiting...");
+            exit(1);
+        }
+        conn->kind = KIND_CONN;
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        conn->next = conns;
+        if (conns != NULL) {
+            conns->prev = conn;
+        }
+        conns = conn;
+        watch(epoll_fd, EPOLL_CTL_ADD, fd, conn->events, conn);
+    }
+}
+
+static void conn_close(struct conn *conn) {
+    close(conn->fd); // Also removes it from epoll
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        conns = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    free(conn->in);
+    out_free(&conn->out);
+    free(conn);
+}
+
+static void reserve_input(struct conn *conn, size_t size) {
+    if (conn->in_capacity - conn->in_used >= size) {
+        return;
+    }
+    size_t capacity = conn->in_capacity == 0 ? SERVER_READ_SIZE : conn->in_capacity;
+    while (capacity - conn->in_used < size) {
+        capacity *= 2;
+    }
+    conn->in = realloc(conn->in, capacity);
+    if (conn->in == NULL) {
+        perror("Error allocating memory for connection. Exiting...");
+        exit(1);
+    }
+    conn->in_capacity = capacity;
+}
+
+/* Read once from the client. Returns -1 if the connection has failed.
+*/
+static int conn_read(struct conn *conn) {
+    reserve_input(conn, SERVER_READ_SIZE);
+    ssize_t count;
+    do {
+        count = read(conn->fd, conn->in + conn->in_used, SERVER_READ_SIZE);
+    } while (count == -1 && errno == EINTR);
+
+    if (count > 0) {
+        conn->in_used += count;
+    } else if (count == 0) {
+        conn->eof = 1;
+        if (conn->in_used > 0 && conn->in[conn->in_used - 1] != '\n') {
+            // Run an unterminated last command too
+            reserve_input(conn, 1);
+            conn->in[conn->in_used++] = '\n';
+        }
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Run every complete line received so far, unless the client already has too
+* much output waiting.
+*/
+static void conn_run(struct conn *conn, Group **group_list_addr) {
+    char *cmd_argv[INPUT_ARG_MAX_NUM];
+    size_t start = 0;
+    int op;
+
+    out_capture(&conn->out);
+    while (!conn->quit && conn->out.used - conn->out_sent < SERVER_OUTPUT_LIMIT) {
+        char *line = conn->in + start;
+        char *line_end = memchr(line, '\n', conn->in_used - start);
+        if (line_end == NULL) {
+            if (conn->in_used - start > SERVER_MAX_LINE) {
+                error("Line too long");
+                out_write("", 1);
+                conn->quit = 1;
+            }
+            break;
+        }
+        start = line_end + 1 - conn->in;
+        if (line_end > line && line_end[-1] == '\r') {
+            line_end--;
+        }
+
+        int cmd_argc = tokenize_line(line, line_end, cmd_argv);
+        if (cmd_argc == -1) {
+            error("Too many arguments!");
+        } else if (cmd_argc == 0) {
+            continue; // Blank lines get no response
+        } else if ((op = command_lookup(cmd_argv[0], cmd_argc)) != OP_NONE && (commands[op].flags & CMD_FILE)) {
+            error("Command not allowed over a connection");
+        } else {
+            trace_record(cmd_argc, cmd_argv);
+            if (process_args(cmd_argc, cmd_argv, group_list_addr) == -1) {
+                conn->quit = 1;
+                break;
+            }
+        }
+        out_write("", 1);
+    }
+    out_capture(NULL);
+
+    memmove(conn->in, conn->in + start, conn->in_used - start);
+    conn->in_used -= start;
+}
+
+/* Send as much pending output as the socket takes. Returns -1 if the
+* connection has failed.
+*/
+static int conn_write(struct conn *conn) {
+    while (conn->out_sent < conn->out.used) {
+        ssize_t count = send(conn->fd, conn->out.data + conn->out_sent,
+                             conn->out.used - conn->out_sent, MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        conn->out_sent += count;
+    }
+    out_reset(&conn->out);
+    conn->out_sent = 0;
+    return 0;
+}
+
+static void conn_handle(int epoll_fd, struct conn *conn, uint32_t events, Group **group_list_addr) {
+    if ((events & EPOLLIN) && conn_read(conn) == -1) {
+        conn_close(conn);
+        return;
+    }
+    if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        conn_close(conn);
+        return;
+    }
+    // Lines held back by the output limit get another turn whenever the socket takes it
+    size_t pending;
+    do {
+        conn_run(conn, group_list_addr);
+        if (conn_write(conn) == -1) {
+            conn_close(conn);
+            return;
+        }
+        pending = conn->out.used - conn->out_sent;
+    } while (!conn->quit && pending < SERVER_OUTPUT_LIMIT && memchr(conn->in, '\n', conn->in_used) != NULL);
+
+    if (pending == 0 && (conn->quit || (conn->eof && conn->in_used == 0))) {
+        conn_close(conn);
+        return;
+    }
+    uint32_t wanted = 0;
+    if (!conn->quit && !conn->eof && pending < SERVER_OUTPUT_LIMIT) {
+        wanted |= EPOLLIN;
+    }
+    if (pending > 0) {
+        wanted |= EPOLLOUT;
+    }
+    if (wanted != conn->events) {
+        conn->events = wanted;
+        watch(epoll_fd, EPOLL_CTL_MOD, conn->fd, wanted, conn);
+    }
+}
+
+/* Serve clients on every address until SIGINT or SIGTERM. Returns 0, or -1 if
+* an address cannot be listened on.
+*/
+int serve(const char **addresses, int count, Group **group_list_addr) {
+    struct listener listeners[SERVER_MAX_LISTENERS];
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int opened = 0;
+    int result = 0;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("Error creating epoll instance");
+        return -1;
+    }
+
+    for (int i = 0; i < count && i < SERVER_MAX_LISTENERS; i++) {
+        struct listener *listener = &listeners[opened];
+        listener->kind = KIND_LISTENER;
+        listener->path = NULL;
+        if (strncmp(addresses[i], SERVER_UNIX_PREFIX, strlen(SERVER_UNIX_PREFIX)) == 0) {
+            listener->path = addresses[i] + strlen(SERVER_UNIX_PREFIX);
+            listener->fd = open_unix(listener->path);
+        } else {
+            listener->fd = open_tcp(addresses[i]);
+        }
+        if (listener->fd == -1) {
+            fprintf(stderr, "Error: Could not listen on %s: %s\n", addresses[i], strerror(errno));
+            result = -1;
+            break;
+        }
+        watch(epoll_fd, EPOLL_CTL_ADD, listener->fd, EPOLLIN, listener);
+        fprintf(stderr, "Listening on %s\n", addresses[i]);
+        opened++;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    stopping = 0;
+    while (result == 0 && !stopping) {
+        int ready = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for events");
+            result = -1;
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            int kind = *(int *) events[i].data.ptr;
+            if (kind == KIND_LISTENER) {
+                accept_all(epoll_fd, events[i].data.ptr);
+            } else {
+                conn_handle(epoll_fd, events[i].data.ptr, events[i].events, group_list_addr);
+            }
+        }
+    }
+
+    while (conns != NULL) {
+        conn_close(conns);
+    }
+    for (int i = 0; i < opened; i++) {
+        close(listeners[i].fd);
+        if (listeners[i].path != NULL) {
+            unlink(listeners[i].path);
+        }
+    }
+    close(epoll_fd);
+    return result;
+}
@@ -0,0 +1,25 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "lists.h"
+
+/* Network server mode: one thread, non-blocking sockets and epoll.
+*
+* Clients send the same text commands as batch mode, one per line, and may
+* send as many as they like without waiting for answers. Commands run in the
+* order each connection sent them. Every response is the command's output,
+* errors included, followed by a single NUL byte (quit has no response and
+* closes the connection). A connection with SERVER_OUTPUT_LIMIT bytes of
+* unsent responses is not read from until the client catches up.
+*
+* Addresses are "[host:]port" for TCP or "unix:<path>" for a Unix socket.
+* Without a host, TCP listens on 127.0.0.1 only. save and load name files on
+* the server's machine, so clients get an error instead of running them.
+*/
+
+#define SERVER_MAX_LISTENERS 8
+#define SERVER_OUTPUT_LIMIT (1 << 20)
+
+int serve(const char **addresses, int count, Group **group_list_addr);
+
+#endif
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "lists.h"
+#include "output.h"
+
+/* Settling up a group: a set of transfers after which every user has paid
+* the same, the group mean. Cents do not always divide evenly, so the
+* remainder goes a cent each to the users who have paid the most, who are
+* then owed a cent less.
+*
+* Users are matched greedily, the largest debt against the largest credit,
+* using two heaps. Each transfer settles at least one of the two users, so
+* there are at most n - 1 of them and the whole match is O(n log n). The
+* heaps are 4-ary and laid out so that the children of an entry share one
+* cache line, which halves the depth of a sift and so its cache misses.
+*/
+
+#define SETTLE_CACHE_LINE 64
+#define SETTLE_HEAP_PAD 3		// Entries before the root, so that children start a cache line
+
+struct settle_entry {
+	int64_t cents;			// How far from the mean, always positive
+	size_t position;		// In the balance order, which also breaks ties in name order
+};
+
+struct settle_heap {
+	struct settle_entry *entries;	// SETTLE_HEAP_PAD entries into a cache-aligned block
+	size_t count;
+};
+
+struct settle_transfer {
+	size_t from;			// Positions in the balance order
+	size_t to;
+	int64_t cents;
+};
+
+// Larger amounts first, ties in name order, so the transfers are reproducible
+static int before(const struct settle_entry *a, const struct settle_entry *b) {
+    if (a->cents != b->cents) {
+        return a->cents > b->cents;
+    }
+    return a->position < b->position;
+}
+
+static void heap_init(struct settle_heap *heap, size_t capacity) {
+    size_t size = (capacity + SETTLE_HEAP_PAD) * sizeof(struct settle_entry);
+    size = (size + SETTLE_CACHE_LINE - 1) / SETTLE_CACHE_LINE * SETTLE_CACHE_LINE;
+    struct settle_entry *block = aligned_alloc(SETTLE_CACHE_LINE, size);
+    if (block == NULL) {
+        perror("Error allocating memory for settlement. Exiting...");
+        exit(1);
+    }
+    heap->entries = block + SETTLE_HEAP_PAD;
+    heap->count = 0;
+}
+
+static void heap_free(struct settle_heap *heap) {
+    free(heap->entries - SETTLE_HEAP_PAD);
+}
+
+/* Put entry at index i of heap, or as far below it as it belongs.
+*/
+static void sift_down(struct settle_heap *heap, size_t i, struct settle_entry entry) {
+    struct settle_entry *e = heap->entries;
+    while (4 * i + 1 < heap->count) {
+        size_t child = 4 * i + 1;
+        size_t end = child + 4 < heap->count ? child + 4 : heap->count;
+        size_t first = child;
+        for (size_t c = child + 1; c < end; c++) {
+            if (before(&e[c], &e[first])) {
+                first = c;
+            }
+        }
+        if (!before(&e[first], &entry)) {
+            break;
+        }
+        e[i] = e[first];
+        i = first;
+    }
+    e[i] = entry;
+}
+
+static void heapify(struct settle_heap *heap) {
+    for (size_t i = heap->count / 4 + 1; i-- > 0;) {
+        if (i < heap->count) {
+            sift_down(heap, i, heap->entries[i]);
+        }
+    }
+}
+
+/* Replace the top of heap with entry, or just remove it if entry is settled.
+*/
+static void replace_top(struct settle_heap *heap, struct settle_entry entry) {
+    if (entry.cents == 0) {
+        entry = heap->entries[--heap->count];
+    }
+    if (heap->count > 0) {
+        sift_down(heap, 0, entry);
+    }
+}
+
+/* Print to standard output the transfers that settle up group, one per line
+* as the one who pays, the one who is paid and the amount. With apply set,
+* also post every transfer as a pair of transactions stamped with time, a
+* payment by the one who pays and a refund to the one who is paid, leaving
+* every balance at the mean. Returns the number of transfers.
+*/
+size_t settle(Group *group, int apply, int64_t time) {
+    if (group->users == NULL) {
+        out_printf("There are no users in group %s. \n", group->name);
+        return 0;
+    }
+
+    // One walk of the users, which are scattered in memory, and the rest works on arrays
+    size_t n = group->user_count;
+    User **order = malloc(n * sizeof(User *));
+    struct settle_transfer *transfers = malloc(n * sizeof(struct settle_transfer));
+    if (order == NULL || transfers == NULL) {
+        perror("Error allocating memory for settlement. Exiting...");
+        exit(1);
+    }
+    struct settle_heap owing, owed;
+    heap_init(&owing, n);
+    heap_init(&owed, n);
+
+    int64_t total = 0;
+    size_t position = 0;
+    for (User *user = group->users; user != NULL; user = user->next) {
+        order[position++] = user;
+        total += user->balance;
+    }
+    int64_t mean = total / (int64_t) n;
+    if (mean * (int64_t) n > total) { // Round toward minus infinity
+        mean--;
+    }
+    size_t extra = (size_t) (total - mean * (int64_t) n); // Cents left over, fewer than n
+
+    // Users come lowest payer first, so the last extra users get the spare cents
+    for (size_t i = 0; i < n; i++) {
+        int64_t balance = order[i]->balance;
+        int64_t target = mean + (i >= n - extra);
+        if (balance < target) {
+            owing.entries[owing.count++] = (struct settle_entry) { target - balance, i };
+        } else if (balance > target) {
+            owed.entries[owed.count++] = (struct settle_entry) { balance - target, i };
+        }
+    }
+    heapify(&owing);
+    heapify(&owed);
+
+    char amount[CENTS_BUFFER];
+    size_t count = 0;
+    out_printf("From \t To \t Amount \n");
+    while (owing.count > 0) { // Debts and credits add up to the same, so both run out together
+        struct settle_entry from = owing.entries[0], to = owed.entries[0];
+        int64_t cents = from.cents < to.cents ? from.cents : to.cents;
+        out_printf("%s \t %s \t %s \n", order[from.position]->name, order[to.position]->name,
+                   format_cents(cents, amount));
+        transfers[count++] = (struct settle_transfer) { from.position, to.position, cents };
+
+        from.cents -= cents;
+        to.cents -= cents;
+        replace_top(&owing, from);
+        replace_top(&owed, to);
+    }
+    heap_free(&owing);
+    heap_free(&owed);
+
+    if (apply) {
+        // Two rows per transfer, more if an amount is too large for one transaction
+        size_t rows = 0;
+        for (size_t i = 0; i < count; i++) {
+            rows += 2 * ((transfers[i].cents + XCT_MAX_CENTS - 1) / XCT_MAX_CENTS);
+        }
+        User **users = malloc(rows * sizeof(User *));
+        int64_t *cents = malloc(rows * sizeof(int64_t));
+        if (rows > 0 && (users == NULL || cents == NULL)) {
+            perror("Error allocating memory for settlement. Exiting...");
+            exit(1);
+        }
+        size_t row = 0;
+        for (size_t i = 0; i < count; i++) {
+            for (int64_t left = transfers[i].cents; left > 0; left -= XCT_MAX_CENTS) {
+                int64_t part = left < XCT_MAX_CENTS ? left : XCT_MAX_CENTS;
+                users[row] = order[transfers[i].from];
+                cents[row++] = part;
+                users[row] = order[transfers[i].to];
+                cents[row++] = -part;
+            }
+        }
+        if (rows > 0) {
+            add_xcts(group, users, cents, rows, time);
+        }
+        free(users);
+        free(cents);
+        out_printf("Posted %zu transfers as %zu transactions \n", count, rows);
+    } else {
+        out_printf("%zu transfers settle %zu users to a mean of %s \n", count, n, format_cents(mean, amount));
+    }
+    free(order);
+    free(transfers);
+    return count;
+}
@@ -0,0 +1,624 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cold.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "BUXSNAP"
+#define SNAPSHOT_END "BUXEND"
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_WRITE_BUFFER (1 << 20)
+
+/* On-disk records. Every record is a multiple of 8 bytes and names are padded
+* to 8 bytes, so the rows of a mapped file stay aligned.
+*/
+struct snap_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;		// Snapshots are only read on machines of the same endianness
+	uint64_t name_count;
+	uint64_t name_bytes;		// NUL terminated names back to back, padded to 8
+	uint64_t group_count;
+};
+
+struct snap_group {
+	uint64_t name_length;
+	uint64_t user_count;
+	uint64_t xct_rows;
+	uint64_t xct_live;
+	uint64_t chunk_count;		// Chunks stored; released (all dead) chunks are skipped
+};
+
+struct snap_user {
+	uint32_t id;
+	uint32_t last_xct;
+	uint64_t xct_count;
+	int64_t balance;		// In cents
+};
+
+struct snap_chunk {
+	uint64_t index;
+	uint64_t live;
+	uint64_t block_bytes;		// 0 if the chunk's uid, user_prev, cents and time columns follow, each
+					// padded to 8, or else the size of the cold block that does, padded to 8
+};
+
+struct snap_trailer {
+	char magic[8];
+};
+
+static size_t pad8(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+/* Number of rows of a group with xct_rows transactions stored in chunk index.
+*/
+static size_t chunk_rows(uint64_t xct_rows, uint64_t index) {
+    uint64_t left = xct_rows - index * XCT_CHUNK_ROWS;
+    return left < XCT_CHUNK_ROWS ? (size_t) left : XCT_CHUNK_ROWS;
+}
+
+/* Bytes taken by the columns of a chunk with rows rows.
+*/
+static size_t chunk_bytes(size_t rows) {
+    return 2 * pad8(rows * sizeof(uint32_t)) + 2 * rows * sizeof(int64_t);
+}
+
+static int write_padded(FILE *file, const void *data, size_t size) {
+    static const char zeros[8];
+    if (fwrite(data, 1, size, file) != size) {
+        return -1;
+    }
+    size_t padding = pad8(size) - size;
+    return fwrite(zeros, 1, padding, file) == padding ? 0 : -1;
+}
+
+static int write_group(FILE *file, Group *group) {
+    struct snap_group record;
+    size_t chunks = (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+
+    memset(&record, 0, sizeof(record));
+    record.name_length = strlen(group->name);
+    record.user_count = group->user_count;
+    record.xct_rows = group->xct_rows;
+    record.xct_live = group->xct_live;
+    for (size_t i = 0; i < chunks; i++) {
+        record.chunk_count += group->xct_chunks[i] != NULL || group->xct_cold[i] != NULL;
+    }
+    if (fwrite(&record, sizeof(record), 1, file) != 1 ||
+        write_padded(file, group->name, record.name_length + 1) == -1) {
+        return -1;
+    }
+
+    // Users in balance order, so loading never has to sort
+    for (User *user = group->users; user != NULL; user = user->next) {
+        struct snap_user entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.id = user->id;
+        entry.last_xct = user->last_xct;
+        entry.xct_count = user->xct_count;
+        entry.balance = user->balance;
+        if (fwrite(&entry, sizeof(entry), 1, file) != 1) {
+            return -1;
+        }
+    }
+
+    // Cold blocks are written as they are, so loading them takes no decoding or sealing
+    for (size_t i = 0; i < chunks; i++) {
+        const struct xct_block *block = group->xct_cold[i];
+        if (block != NULL) {
+            struct snap_chunk chunk = { i, block->live, cold_bytes(block) };
+            if (fwrite(&chunk, sizeof(chunk), 1, file) != 1 || write_padded(file, block, cold_bytes(block)) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        const struct xct_chunk *columns = group->xct_chunks[i];
+        if (columns == NULL) {
+            continue;
+        }
+        struct snap_chunk chunk = { i, columns->live, 0 };
+        size_t rows = chunk_rows(group->xct_rows, i);
+        if (fwrite(&chunk, sizeof(chunk), 1, file) != 1 ||
+            write_padded(file, columns->uid, rows * sizeof(uint32_t)) == -1 ||
+            write_padded(file, columns->user_prev, rows * sizeof(uint32_t)) == -1 ||
+            fwrite(columns->cents, sizeof(int64_t), rows, file) != rows ||
+            fwrite(columns->time, sizeof(int64_t), rows, file) != rows) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Write every group in group_list to a snapshot at path. The snapshot is
+* written to a temporary file first and renamed over path once it is complete
+* and synced, so a crash never leaves a half-written snapshot behind.
+* Returns 0 on success and -1 if the file cannot be written.
+*/
+int snapshot_save(Group *group_list, const char *path) {
+    size_t tmp_length = strlen(path) + sizeof(".tmp");
+    char *tmp_path = malloc(tmp_length);
+    if (tmp_path == NULL) {
+        perror("Error allocating memory for snapshot path. Exiting...");
+        exit(1);
+    }
+    snprintf(tmp_path, tmp_length, "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        free(tmp_path);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_WRITE_BUFFER);
+
+    struct snap_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    // IDs whose names were released are kept as empty names, so that every other ID stays the same
+    header.name_count = intern_limit();
+    for (size_t id = 0; id < header.name_count; id++) {
+        header.name_bytes += (intern_name(id) != NULL ? strlen(intern_name(id)) : 0) + 1;
+    }
+    header.name_bytes = pad8(header.name_bytes);
+    for (Group *group = group_list; group != NULL; group = group->next) {
+        header.group_count++;
+    }
+
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    size_t written = 0;
+    for (size_t id = 0; id < header.name_count && !failed; id++) {
+        const char *name = intern_name(id) != NULL ? intern_name(id) : "";
+        size_t size = strlen(name) + 1;
+        failed = fwrite(name, 1, size, file) != size;
+        written += size;
+    }
+    while (written < header.name_bytes && !failed) {
+        failed = fputc('\0', file) == EOF;
+        written++;
+    }
+    for (Group *group = group_list; group != NULL && !failed; group = group->next) {
+        failed = write_group(file, group) == -1;
+    }
+
+    struct snap_trailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    memcpy(trailer.magic, SNAPSHOT_END, sizeof(SNAPSHOT_END));
+    if (!failed) {
+        failed = fwrite(&trailer, sizeof(trailer), 1, file) != 1;
+    }
+    if (fflush(file) == EOF || fsync(fileno(file)) == -1) {
+        failed = 1;
+    }
+    if (fclose(file) == EOF) {
+        failed = 1;
+    }
+
+    if (failed || rename(tmp_path, path) == -1) {
+        unlink(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    free(tmp_path);
+    return 0;
+}
+
+/* A bounds-checked cursor over the mapped snapshot.
+*/
+struct reader {
+	const char *data;
+	size_t size;
+	size_t offset;
+};
+
+/* Return a pointer to the next size bytes and move past them, or NULL if the
+* file is too short.
+*/
+static const void *take(struct reader *reader, size_t size) {
+    if (size > reader->size - reader->offset) {
+        return NULL;
+    }
+    const void *result = reader->data + reader->offset;
+    reader->offset += size;
+    return result;
+}
+
+/* A chunk of the group being checked, and where its columns, or else its
+* cold block, are in the file.
+*/
+struct chunk_ref {
+	uint64_t index;
+	const char *columns;
+	const struct xct_block *block;
+};
+
+/* The uid of row ref among the first count chunks stored for a group with
+* xct_rows rows, or XCT_DEAD if its chunk was released or has not been read
+* yet.
+*/
+static uint32_t row_uid(const struct chunk_ref *stored, size_t count, uint64_t xct_rows, uint32_t ref) {
+    uint64_t index = (ref - 1) / XCT_CHUNK_ROWS;
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (stored[middle].index < index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == count || stored[low].index != index || ref > xct_rows) {
+        return XCT_DEAD;
+    }
+    if (stored[low].block != NULL) {
+        return cold_row_uid(stored[low].block, (ref - 1) % XCT_CHUNK_ROWS);
+    }
+    uint32_t uid;
+    memcpy(&uid, stored[low].columns + (ref - 1) % XCT_CHUNK_ROWS * sizeof(uid), sizeof(uid));
+    return uid;
+}
+
+/* Walk the whole snapshot and check that it is well formed without building
+* anything: sizes stay within the file, names other than the empty ones that
+* stand for free IDs are unique, every group's users are in strict (balance,
+* name) order with no user twice, every cold block is well formed (see
+* cold_check) and older than the chunk being appended to, every row refers
+* to a user of its group, every amount is in range (zero for dead rows), and
+* each user's last_xct and every user_prev link lead to a live row of the
+* same user.
+* names receives a pointer to each name, by ID. Returns 0 if the snapshot can
+* be loaded safely and -1 otherwise.
+*/
+static int validate(struct reader *reader, const struct snap_header *header, const char **names) {
+    HTable seen;
+    int result = -1;
+    struct chunk_ref *stored = NULL;
+    size_t stored_capacity = 0;
+
+    ht_init(&seen);
+    // Cold blocks are decoded here to check their rows like any other chunk's
+    struct xct_chunk *scratch = malloc(sizeof(struct xct_chunk));
+    // member[id] is one more than the last group the name was a user of
+    uint64_t *member = calloc(header->name_count + 1, sizeof(uint64_t));
+    if (member == NULL || scratch == NULL) {
+        perror("Error allocating memory for snapshot names. Exiting...");
+        exit(1);
+    }
+
+    // Names
+    const char *name_data = take(reader, header->name_bytes);
+    if (name_data == NULL) {
+        goto done;
+    }
+    size_t offset = 0;
+    for (uint64_t id = 0; id < header->name_count; id++) {
+        const char *end = memchr(name_data + offset, '\0', header->name_bytes - offset);
+        if (end == NULL) {
+            goto done;
+        }
+        names[id] = name_data + offset;
+        if (names[id][0] != '\0' && ht_put(&seen, names[id], NULL) == -1) {
+            goto done; // Duplicate name
+        }
+        offset = end - name_data + 1;
+    }
+    ht_free(&seen);
+
+    // Groups
+    for (uint64_t g = 0; g < header->group_count; g++) {
+        struct snap_group group;
+        const void *record = take(reader, sizeof(group));
+        if (record == NULL) {
+            goto done;
+        }
+        memcpy(&group, record, sizeof(group));
+        const char *group_name = take(reader, pad8(group.name_length + 1));
+        if (group_name == NULL || group_name[group.name_length] != '\0' ||
+            strlen(group_name) != group.name_length || group.xct_rows >= UINT32_MAX ||
+            ht_put(&seen, group_name, NULL) == -1) {
+            goto done;
+        }
+
+        if (group.user_count > (reader->size - reader->offset) / sizeof(struct snap_user)) {
+            goto done;
+        }
+        const char *users = reader->data + reader->offset;
+        struct snap_user prev_user;
+        memset(&prev_user, 0, sizeof(prev_user));
+        for (uint64_t u = 0; u < group.user_count; u++) {
+            struct snap_user user;
+            const void *entry = take(reader, sizeof(user));
+            if (entry == NULL) {
+                goto done;
+            }
+            memcpy(&user, entry, sizeof(user));
+            if (user.id >= header->name_count || names[user.id][0] == '\0' || user.last_xct > group.xct_rows ||
+                member[user.id] == g + 1) {
+                goto done;
+            }
+            member[user.id] = g + 1;
+            if (u > 0 && (prev_user.balance > user.balance ||
+                          (prev_user.balance == user.balance && strcmp(names[prev_user.id], names[user.id]) >= 0))) {
+                goto done; // Out of order, or the same user twice
+            }
+            prev_user = user;
+        }
+
+        uint64_t chunks = (group.xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+        uint64_t next_index = 0, live = 0;
+        int64_t last_time = INT64_MIN;
+        if (group.chunk_count > (reader->size - reader->offset) / sizeof(struct snap_chunk)) {
+            goto done;
+        }
+        if (group.chunk_count > stored_capacity) {
+            stored_capacity = group.chunk_count;
+            free(stored);
+            stored = malloc(stored_capacity * sizeof(struct chunk_ref));
+            if (stored == NULL) {
+                perror("Error allocating memory for snapshot chunks. Exiting...");
+                exit(1);
+            }
+        }
+        for (uint64_t c = 0; c < group.chunk_count; c++) {
+            struct snap_chunk chunk;
+            const void *header_bytes = take(reader, sizeof(chunk));
+            if (header_bytes == NULL) {
+                goto done;
+            }
+            memcpy(&chunk, header_bytes, sizeof(chunk));
+            if (chunk.index < next_index || chunk.index >= chunks) {
+                goto done;
+            }
+            size_t rows = chunk_rows(group.xct_rows, chunk.index);
+            const char *column_data, *prev_data, *cents_data, *time_data;
+            stored[c].index = chunk.index;
+            stored[c].block = NULL;
+            if (chunk.block_bytes != 0) {
+                const struct xct_block *block = take(reader, pad8(chunk.block_bytes));
+                if (chunk.index + 1 >= chunks || chunk.block_bytes > SIZE_MAX - 7 || block == NULL ||
+                    cold_check(block, chunk.block_bytes, chunk.index, scratch) == -1) {
+                    goto done;
+                }
+                stored[c].block = block;
+                column_data = (const char *) scratch->uid;
+                prev_data = (const char *) scratch->user_prev;
+                cents_data = (const char *) scratch->cents;
+                time_data = (const char *) scratch->time;
+            } else {
+                column_data = take(reader, chunk_bytes(rows));
+                if (column_data == NULL) {
+                    goto done;
+                }
+                stored[c].columns = column_data;
+                prev_data = column_data + pad8(rows * sizeof(uint32_t));
+                cents_data = prev_data + pad8(rows * sizeof(uint32_t));
+                time_data = cents_data + rows * sizeof(int64_t);
+            }
+            uint64_t chunk_live = 0;
+            for (size_t i = 0; i < rows; i++) {
+                uint32_t uid, user_prev;
+                int64_t cents, time;
+                memcpy(&uid, column_data + i * sizeof(uid), sizeof(uid));
+                memcpy(&user_prev, prev_data + i * sizeof(user_prev), sizeof(user_prev));
+                memcpy(&cents, cents_data + i * sizeof(cents), sizeof(cents));
+                memcpy(&time, time_data + i * sizeof(time), sizeof(time));
+                uint32_t ref = (uint32_t) (chunk.index * XCT_CHUNK_ROWS + i + 1);
+                if (time < last_time) {
+                    goto done; // The history is searched by time, so it must be in time order
+                }
+                last_time = time;
+                if (uid == XCT_DEAD) {
+                    if (cents != 0) {
+                        goto done;
+                    }
+                    continue;
+                }
+                if (uid >= header->name_count || member[uid] != g + 1 || user_prev >= ref ||
+                    cents < -XCT_MAX_CENTS || cents > XCT_MAX_CENTS) {
+                    goto done;
+                }
+                // A block decodes each of its rows' links to the same user's row before, so only
+                // links out of the block need checking
+                if (user_prev != XCT_NONE && (stored[c].block == NULL || user_prev <= chunk.index * XCT_CHUNK_ROWS) &&
+                    row_uid(stored, c + 1, group.xct_rows, user_prev) != uid) {
+                    goto done; // A user's history must only lead through its own live rows
+                }
+                chunk_live++;
+            }
+            if (chunk_live != chunk.live) {
+                goto done;
+            }
+            live += chunk_live;
+            next_index = chunk.index + 1;
+        }
+        // The chunk being appended to is never released
+        if (live != group.xct_live || (chunks > 0 && next_index != chunks)) {
+            goto done;
+        }
+        for (uint64_t u = 0; u < group.user_count; u++) {
+            struct snap_user user;
+            memcpy(&user, users + u * sizeof(user), sizeof(user));
+            if (user.last_xct != XCT_NONE &&
+                row_uid(stored, group.chunk_count, group.xct_rows, user.last_xct) != user.id) {
+                goto done;
+            }
+        }
+    }
+
+    const struct snap_trailer *trailer = take(reader, sizeof(struct snap_trailer));
+    if (trailer != NULL && memcmp(trailer->magic, SNAPSHOT_END, sizeof(SNAPSHOT_END)) == 0 &&
+        reader->offset == reader->size) {
+        result = 0;
+    }
+
+done:
+    ht_free(&seen);
+    free(member);
+    free(stored);
+    free(scratch);
+    return result;
+}
+
+/* Build the groups of an already validated snapshot at group_list_addr.
+*/
+static void build(struct reader *reader, const struct snap_header *header,
+                  const char **names, Group **group_list_addr) {
+    User **sorted = NULL;
+    size_t sorted_capacity = 0;
+
+    // The names keep the IDs the rows refer to, with a reference each until every user has taken its own
+    reader->offset += header->name_bytes;
+    intern_load(names, header->name_count);
+
+    for (uint64_t g = 0; g < header->group_count; g++) {
+        struct snap_group record;
+        memcpy(&record, take(reader, sizeof(record)), sizeof(record));
+        const char *group_name = take(reader, pad8(record.name_length + 1));
+        add_group(group_list_addr, group_name);
+        Group *group = find_group(*group_list_addr, group_name);
+
+        if (record.user_count > sorted_capacity) {
+            sorted_capacity = record.user_count;
+            free(sorted);
+            sorted = malloc(sorted_capacity * sizeof(User *));
+            if (sorted == NULL) {
+                perror("Error allocating memory for snapshot users. Exiting...");
+                exit(1);
+            }
+        }
+        for (uint64_t u = 0; u < record.user_count; u++) {
+            struct snap_user entry;
+            memcpy(&entry, take(reader, sizeof(entry)), sizeof(entry));
+            intern_ref(entry.id);
+            User *user = create_user(group, entry.id);
+            user->balance = entry.balance;
+            track_balance(group, 0, entry.balance);
+            user->last_xct = entry.last_xct;
+            user->xct_count = entry.xct_count;
+            index_user(group, user);
+            sorted[u] = user;
+        }
+        rank_build(group, sorted, record.user_count);
+
+        for (uint64_t c = 0; c < record.chunk_count; c++) {
+            struct snap_chunk entry;
+            memcpy(&entry, take(reader, sizeof(entry)), sizeof(entry));
+            size_t rows = chunk_rows(record.xct_rows, entry.index);
+            if (entry.block_bytes != 0) {
+                struct xct_block *block = malloc(entry.block_bytes);
+                if (block == NULL) {
+                    perror("Error allocating memory for cold block. Exiting...");
+                    exit(1);
+                }
+                memcpy(block, take(reader, pad8(entry.block_bytes)), entry.block_bytes);
+                load_xct_block(group, entry.index, block);
+                continue;
+            }
+            struct xct_chunk *chunk = alloc_xct_chunk(group, entry.index);
+            const char *column_data = take(reader, chunk_bytes(rows));
+            memcpy(chunk->uid, column_data, rows * sizeof(uint32_t));
+            column_data += pad8(rows * sizeof(uint32_t));
+            memcpy(chunk->user_prev, column_data, rows * sizeof(uint32_t));
+            column_data += pad8(rows * sizeof(uint32_t));
+            memcpy(chunk->cents, column_data, rows * sizeof(int64_t));
+            column_data += rows * sizeof(int64_t);
+            memcpy(chunk->time, column_data, rows * sizeof(int64_t));
+            chunk->live = entry.live;
+        }
+        group->xct_rows = (uint32_t) record.xct_rows;
+        group->xct_live = record.xct_live;
+
+        // Released chunks start no later than the next chunk, which is all a search needs
+        size_t chunks = (record.xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+        if (chunks > 0) {
+            struct xct_chunk *last = group->xct_chunks[chunks - 1];
+            group->xct_last_time = last->time[chunk_rows(record.xct_rows, chunks - 1) - 1];
+        }
+        for (size_t i = chunks; i-- > 0;) {
+            struct xct_chunk *chunk = group->xct_chunks[i];
+            if (chunk != NULL) {
+                group->xct_chunk_start[i] = chunk->time[0];
+            } else if (group->xct_cold[i] != NULL) {
+                group->xct_chunk_start[i] = cold_start(group->xct_cold[i]);
+            } else {
+                group->xct_chunk_start[i] = group->xct_chunk_start[i + 1];
+            }
+        }
+        // Only chunks that could not be sealed, or that a build keeping fewer hot chunks would seal
+        seal_xct_chunks(group);
+    }
+    free(sorted);
+    for (uint64_t id = 0; id < header->name_count; id++) {
+        if (names[id][0] != '\0') {
+            intern_unref((uint32_t) id);
+        }
+    }
+}
+
+/* Replace the groups at group_list_addr (and every interned name) with the
+* contents of the snapshot at path. The snapshot is checked in full before
+* anything is replaced. Returns 0 on success, -1 if the file cannot be read
+* and -2 if it is not a valid snapshot, leaving the current groups untouched
+* in both cases.
+*/
+int snapshot_load(Group **group_list_addr, const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t) sizeof(struct snap_header)) {
+        close(fd);
+        return -2;
+    }
+    size_t size = (size_t) st.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+
+    struct reader reader = { data, size, 0 };
+    struct snap_header header;
+    memcpy(&header, take(&reader, sizeof(header)), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.byte_order != SNAPSHOT_BYTE_ORDER ||
+        header.name_count >= XCT_DEAD || header.name_count > header.name_bytes ||
+        header.name_bytes > size - sizeof(header)) {
+        munmap((void *) data, size);
+        return -2;
+    }
+
+    const char **names = malloc((header.name_count + 1) * sizeof(char *));
+    if (names == NULL) {
+        perror("Error allocating memory for snapshot names. Exiting...");
+        exit(1);
+    }
+    if (validate(&reader, &header, names) == -1) {
+        free(names);
+        munmap((void *) data, size);
+        return -2;
+    }
+
+    // Only now is it safe to throw the current state away
+    free_groups(*group_list_addr);
+    *group_list_addr = NULL;
+    intern_release();
+
+    reader.offset = sizeof(header);
+    build(&reader, &header, names, group_list_addr);
+
+    free(names);
+    munmap((void *) data, size);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "lists.h"
+
+/* Binary snapshots of every group, user and transaction.
+*
+* The file holds the interned names in ID order, then each group with its
+* users already in balance order, its hot transaction chunks as raw columns
+* and its cold blocks as they are. Loading interns the names in the same
+* order, so the stored user IDs (and therefore the rows and blocks) can be
+* copied straight in, and the balance order is rebuilt in one linear pass
+* instead of re-running any commands.
+*/
+
+#define SNAPSHOT_VERSION 4
+
+int snapshot_save(Group *group_list, const char *path);
+int snapshot_load(Group **group_list_addr, const char *path);
+
+#endif
@@ -0,0 +1,405 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "commands.h"
+#include "output.h"
+#include "stats.h"
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+#define STATS_MIN_CALIBRATION_NS 10000000	// Measure the tick rate over at least 10 ms
+
+struct stats_op {
+	_Atomic uint64_t count;
+	_Atomic uint64_t total_ticks;
+	_Atomic uint64_t max_ticks;
+	_Atomic uint64_t buckets[STATS_BUCKETS];
+};
+
+/* One thread's counters. Only that thread writes them, so an update is a
+* relaxed load and store rather than an atomic read-modify-write; readers
+* on other threads always see whole values.
+*/
+struct stats_block {
+	struct stats_op ops[OP_COUNT];
+	_Atomic uint64_t events[STAT_EVENT_COUNT];
+};
+
+/* The sum of every thread's counters at one moment, with the tick rate
+* needed to turn them into nanoseconds.
+*/
+struct stats_totals {
+	uint64_t count[OP_COUNT];
+	uint64_t total_ticks[OP_COUNT];
+	uint64_t max_ticks[OP_COUNT];
+	uint64_t buckets[OP_COUNT][STATS_BUCKETS];
+	uint64_t events[STAT_EVENT_COUNT];
+	double ticks_per_ns;
+};
+
+static const char *event_names[STAT_EVENT_COUNT] = {
+    [STAT_ERRORS] = "errors",
+    [STAT_HASH_LOOKUPS] = "hash_lookups",
+    [STAT_HASH_PROBES] = "hash_probes",
+    [STAT_RANK_MOVES] = "rank_moves",
+    [STAT_RANK_STEPS] = "rank_steps",
+    [STAT_SLAB_ALLOCS] = "slab_allocs",
+    [STAT_ARENA_BLOCKS] = "arena_blocks",
+    [STAT_CHUNK_ALLOCS] = "chunk_allocs",
+    [STAT_CHUNK_FREES] = "chunk_frees",
+    [STAT_ROWS_SCANNED] = "rows_scanned",
+    [STAT_BLOCKS_SEALED] = "blocks_sealed",
+    [STAT_BLOCKS_DECODED] = "blocks_decoded",
+};
+
+static struct stats_block *blocks[STATS_MAX_THREADS];
+static int block_count;
+static struct stats_block shared;	// For threads beyond STATS_MAX_THREADS, which may lose counts
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local struct stats_block *mine;
+static uint64_t base_ticks, base_ns;	// When the first thread registered, to calibrate ticks
+_Thread_local _Atomic uint64_t *stats_events;
+
+// The --stats-file writer
+static char *file_path;
+static long file_interval_ms;
+static pthread_t writer;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake;
+static int closing;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Call with lock held
+static void start_clock(void) {
+    if (base_ns == 0) {
+        base_ticks = stats_now();
+        base_ns = monotonic_ns();
+    }
+}
+
+static struct stats_block *my_block(void) {
+    if (mine != NULL) {
+        return mine;
+    }
+    pthread_mutex_lock(&lock);
+    start_clock();
+    if (block_count < STATS_MAX_THREADS) {
+        mine = calloc(1, sizeof(struct stats_block));
+        if (mine == NULL) {
+            perror("Error allocating memory for statistics. Exiting...");
+            exit(1);
+        }
+        blocks[block_count++] = mine;
+    } else {
+        mine = &shared;
+    }
+    pthread_mutex_unlock(&lock);
+    return mine;
+}
+
+static void bump(_Atomic uint64_t *counter, uint64_t amount) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount,
+                          memory_order_relaxed);
+}
+
+/* Histogram bucket of ticks: exact below 16, then 8 per power of two.
+*/
+static int bucket_of(uint64_t ticks) {
+    if (ticks < 16) {
+        return (int) ticks;
+    }
+    int exponent = 63 - __builtin_clzll(ticks);
+    return 16 + (exponent - 4) * 8 + (int) ((ticks >> (exponent - 3)) & 7);
+}
+
+/* Largest value that lands in bucket.
+*/
+static uint64_t bucket_high(int bucket) {
+    if (bucket < 16) {
+        return (uint64_t) bucket;
+    }
+    int exponent = (bucket - 16) / 8 + 4;
+    uint64_t step = (uint64_t) 1 << (exponent - 3);
+    return (uint64_t) (8 + (bucket - 16) % 8) * step + (step - 1);
+}
+
+/* A timestamp in ticks. On x86-64 that is the time stamp counter, which is
+* several times cheaper to read than the clock and, on any CPU recent enough
+* for AVX2, runs at a constant rate on every core; elsewhere it is the
+* monotonic clock in nanoseconds. Ticks are only turned into nanoseconds when
+* the counters are read.
+*/
+uint64_t stats_now(void) {
+#ifdef __x86_64__
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+/* Record that a command with opcode op took ticks (a difference of two
+* stats_now timestamps).
+*/
+void stats_command(int op, uint64_t ticks) {
+    struct stats_op *counters = &my_block()->ops[op];
+    bump(&counters->count, 1);
+    bump(&counters->total_ticks, ticks);
+    bump(&counters->buckets[bucket_of(ticks)], 1);
+    if (ticks > atomic_load_explicit(&counters->max_ticks, memory_order_relaxed)) {
+        atomic_store_explicit(&counters->max_ticks, ticks, memory_order_relaxed);
+    }
+}
+
+/* Set up the counters of the calling thread and return its event counts.
+*/
+_Atomic uint64_t *stats_register(void) {
+    stats_events = my_block()->events;
+    return stats_events;
+}
+
+/* Ticks per nanosecond, measured against the clock since the first thread
+* registered.
+*/
+static double tick_rate(void) {
+#ifdef __x86_64__
+    pthread_mutex_lock(&lock);
+    start_clock();
+    pthread_mutex_unlock(&lock);
+    uint64_t elapsed_ns = monotonic_ns() - base_ns;
+    if (elapsed_ns < STATS_MIN_CALIBRATION_NS) {
+        struct timespec pause = { 0, STATS_MIN_CALIBRATION_NS - elapsed_ns };
+        nanosleep(&pause, NULL);
+    }
+    uint64_t ticks = stats_now();
+    return (double) (ticks - base_ticks) / (monotonic_ns() - base_ns);
+#else
+    return 1.0;
+#endif
+}
+
+static uint64_t to_ns(const struct stats_totals *totals, uint64_t ticks) {
+    return (uint64_t) (ticks / totals->ticks_per_ns);
+}
+
+static struct stats_totals *collect(void) {
+    struct stats_totals *totals = calloc(1, sizeof(struct stats_totals));
+    if (totals == NULL) {
+        perror("Error allocating memory for statistics. Exiting...");
+        exit(1);
+    }
+    totals->ticks_per_ns = tick_rate();
+
+    pthread_mutex_lock(&lock);
+    for (int b = 0; b <= block_count; b++) {
+        struct stats_block *block = b < block_count ? blocks[b] : &shared;
+        for (int op = 0; op < OP_COUNT; op++) {
+            struct stats_op *counters = &block->ops[op];
+            totals->count[op] += atomic_load_explicit(&counters->count, memory_order_relaxed);
+            totals->total_ticks[op] += atomic_load_explicit(&counters->total_ticks, memory_order_relaxed);
+            uint64_t max = atomic_load_explicit(&counters->max_ticks, memory_order_relaxed);
+            if (max > totals->max_ticks[op]) {
+                totals->max_ticks[op] = max;
+            }
+            for (int i = 0; i < STATS_BUCKETS; i++) {
+                totals->buckets[op][i] += atomic_load_explicit(&counters->buckets[i], memory_order_relaxed);
+            }
+        }
+        for (int e = 0; e < STAT_EVENT_COUNT; e++) {
+            totals->events[e] += atomic_load_explicit(&block->events[e], memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return totals;
+}
+
+/* Latency in nanoseconds below which fraction of op's runs fell, to within a
+* bucket.
+*/
+static uint64_t percentile(const struct stats_totals *totals, int op, double fraction) {
+    uint64_t seen = 0;
+    double wanted = totals->count[op] * fraction;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += totals->buckets[op][i];
+        if (seen > 0 && seen >= wanted) {
+            uint64_t high = bucket_high(i);
+            return to_ns(totals, high < totals->max_ticks[op] ? high : totals->max_ticks[op]);
+        }
+    }
+    return to_ns(totals, totals->max_ticks[op]);
+}
+
+/* Print to standard output every command that has run, with its latency
+* percentiles, followed by the internal event counts.
+*/
+void stats_print(void) {
+    struct stats_totals *totals = collect();
+
+    out_printf("Command \t Count \t Mean ns \t p50 ns \t p99 ns \t p99.9 ns \t Max ns \n");
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (totals->count[op] == 0) {
+            continue;
+        }
+        out_printf("%s \t %llu \t %llu \t %llu \t %llu \t %llu \t %llu \n", commands[op].name,
+                   (unsigned long long) totals->count[op],
+                   (unsigned long long) to_ns(totals, totals->total_ticks[op] / totals->count[op]),
+                   (unsigned long long) percentile(totals, op, 0.5),
+                   (unsigned long long) percentile(totals, op, 0.99),
+                   (unsigned long long) percentile(totals, op, 0.999),
+                   (unsigned long long) to_ns(totals, totals->max_ticks[op]));
+    }
+    out_printf("Event \t Count \n");
+    for (int e = 0; e < STAT_EVENT_COUNT; e++) {
+        out_printf("%s \t %llu \n", event_names[e], (unsigned long long) totals->events[e]);
+    }
+    free(totals);
+}
+
+/* Write every counter to stream as one JSON object, including the non-empty
+* histogram buckets of each command as [highest ns, count] pairs. Buckets are
+* kept in ticks, so their bounds in nanoseconds depend on the tick rate.
+*/
+void stats_write_json(FILE *stream) {
+    struct stats_totals *totals = collect();
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    fprintf(stream, "{\"time\":%lld.%03ld,\"commands\":{", (long long) now.tv_sec, now.tv_nsec / 1000000);
+    const char *separator = "";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (totals->count[op] == 0) {
+            continue;
+        }
+        fprintf(stream, "%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+                "\"p999_ns\":%llu,\"max_ns\":%llu,\"histogram\":[", separator, commands[op].name,
+                (unsigned long long) totals->count[op],
+                (unsigned long long) to_ns(totals, totals->total_ticks[op]),
+                (unsigned long long) percentile(totals, op, 0.5),
+                (unsigned long long) percentile(totals, op, 0.99),
+                (unsigned long long) percentile(totals, op, 0.999),
+                (unsigned long long) to_ns(totals, totals->max_ticks[op]));
+        const char *bucket_separator = "";
+        for (int i = 0; i < STATS_BUCKETS; i++) {
+            if (totals->buckets[op][i] != 0) {
+                fprintf(stream, "%s[%llu,%llu]", bucket_separator,
+                        (unsigned long long) to_ns(totals, bucket_high(i)),
+                        (unsigned long long) totals->buckets[op][i]);
+                bucket_separator = ",";
+            }
+        }
+        fprintf(stream, "]}");
+        separator = ",";
+    }
+    fprintf(stream, "},\"events\":{");
+    for (int e = 0; e < STAT_EVENT_COUNT; e++) {
+        fprintf(stream, "%s\"%s\":%llu", e > 0 ? "," : "", event_names[e], (unsigned long long) totals->events[e]);
+    }
+    fprintf(stream, "}}\n");
+    free(totals);
+}
+
+/* Replace the stats file with the current counters. It is written beside
+* the file and renamed over it, so readers never see half of it.
+*/
+static int write_file(void) {
+    size_t length = strlen(file_path) + sizeof(".tmp");
+    char tmp_path[length];
+    snprintf(tmp_path, length, "%s.tmp", file_path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    stats_write_json(file);
+    if (fclose(file) != 0 || rename(tmp_path, file_path) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static void *write_loop(void *unused) {
+    pthread_mutex_lock(&writer_lock);
+    while (!closing) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += file_interval_ms / 1000;
+        deadline.tv_nsec += (file_interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!closing && pthread_cond_timedwait(&writer_wake, &writer_lock, &deadline) != ETIMEDOUT) {
+        }
+        if (closing) {
+            break; // stats_close writes the final counters itself
+        }
+        pthread_mutex_unlock(&writer_lock);
+        write_file();
+        pthread_mutex_lock(&writer_lock);
+    }
+    pthread_mutex_unlock(&writer_lock);
+    return unused;
+}
+
+/* Write the counters to path now, every interval_ms from now on and once more
+* in stats_close. Returns 0, or -1 if path cannot be written.
+*/
+int stats_start_file(const char *path, long interval_ms) {
+    file_path = strdup(path);
+    if (file_path == NULL) {
+        perror("Error allocating memory for statistics. Exiting...");
+        exit(1);
+    }
+    if (write_file() == -1) {
+        free(file_path);
+        file_path = NULL;
+        return -1;
+    }
+    file_interval_ms = interval_ms;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&writer_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&writer, NULL, write_loop, NULL) != 0) {
+        perror("Error starting statistics thread. Exiting...");
+        exit(1);
+    }
+    return 0;
+}
+
+/* Stop the stats file writer after a final write, and release every
+* thread's counters.
+*/
+void stats_close(void) {
+    if (file_path != NULL) {
+        pthread_mutex_lock(&writer_lock);
+        closing = 1;
+        pthread_cond_signal(&writer_wake);
+        pthread_mutex_unlock(&writer_lock);
+        pthread_join(writer, NULL);
+        pthread_cond_destroy(&writer_wake);
+        // Here rather than in the writer, which may be told to close before it first runs
+        write_file();
+        free(file_path);
+        file_path = NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (int b = 0; b < block_count; b++) {
+        free(blocks[b]);
+    }
+    block_count = 0;
+    pthread_mutex_unlock(&lock);
+    mine = NULL;
+    stats_events = NULL;
+}
@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Always-on instrumentation: how many times each command ran, a latency
+* histogram per command, and counts of internal events.
+*
+* Every thread records into its own block, so recording is a plain store
+* with no lock and no shared cache line; reading adds up all the blocks.
+* Latencies are measured in ticks of the cheapest clock available (see
+* stats_now) and turned into nanoseconds only when read. Histograms are
+* log-linear, HDR style: exact below 16 ticks, then 8 buckets per power of
+* two, so any reported latency is within 12.5% of the true one.
+*/
+
+#define STATS_BUCKETS 496		// Enough for any 64-bit number of ticks
+#define STATS_MAX_THREADS 1024
+#define STATS_DEFAULT_INTERVAL_MS 1000
+
+enum stats_event {
+	STAT_ERRORS,			// Error messages printed
+	STAT_HASH_LOOKUPS,		// Hash table lookups, inserts and removals
+	STAT_HASH_PROBES,		// Slots examined by those
+	STAT_RANK_MOVES,		// Users moved in the balance order by a transaction
+	STAT_RANK_STEPS,		// Skip list links followed
+	STAT_SLAB_ALLOCS,		// Objects handed out by slabs
+	STAT_ARENA_BLOCKS,		// Blocks arenas got from malloc
+	STAT_CHUNK_ALLOCS,		// Transaction chunks allocated
+	STAT_CHUNK_FREES,		// Transaction chunks released once all their rows died
+	STAT_ROWS_SCANNED,		// Transaction rows read by listings and column scans
+	STAT_BLOCKS_SEALED,		// Chunks compressed into cold blocks
+	STAT_BLOCKS_DECODED,		// Cold blocks decoded to be read
+	STAT_EVENT_COUNT
+};
+
+extern _Thread_local _Atomic uint64_t *stats_events;	// This thread's event counts, once it has recorded any
+
+uint64_t stats_now(void);
+void stats_command(int op, uint64_t ticks);
+_Atomic uint64_t *stats_register(void);
+void stats_print(void);
+void stats_write_json(FILE *stream);
+int stats_start_file(const char *path, long interval_ms);
+void stats_close(void);
+
+/* Count count occurrences of event. Events are counted in hot loops, so this
+* is inlined even in unoptimized builds.
+*/
+__attribute__((always_inline)) static inline void stats_add(int event, uint64_t count) {
+    _Atomic uint64_t *events = stats_events != NULL ? stats_events : stats_register();
+    atomic_store_explicit(&events[event], atomic_load_explicit(&events[event], memory_order_relaxed) + count,
+                          memory_order_relaxed);
+}
+
+#endif
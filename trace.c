@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "executor.h"
+#include "trace.h"
+
+#define TRACE_MAGIC "BUXTRC"
+#define TRACE_FILE_BUFFER (1 << 20)
+#define TRACE_STDOUT_BUFFER (1 << 20)
+#define TRACE_POLL_NS 50000		// How often finished output is written out while waiting
+
+// The --record writer
+static FILE *file;
+static HTable numbers;			// Argument text -> its number + 1
+static Arena strings;			// The texts, which the table's keys point to
+static uint32_t name_count;
+static uint64_t last_ns;		// When the last record was written
+
+/* A command read back from a trace.
+*/
+struct trace_command {
+	uint64_t due_ns;		// Since the first command, at the recorded speed
+	size_t first_arg;		// Where its arguments start in the argument array
+	int argc;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns) {
+    struct timespec ts = { (time_t) (ns / 1000000000), (long) (ns % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void put_varint(uint64_t value) {
+    while (value >= 0x80) {
+        putc((int) (value & 0x7f) | 0x80, file);
+        value >>= 7;
+    }
+    putc((int) value, file);
+}
+
+/* Read a varint at *p, before end, into *value and move *p past it. Returns
+* -1 if it runs past end or is too long for 64 bits.
+*/
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p == end) {
+            return -1;
+        }
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Start recording every command passed to trace_record into a new trace at
+* path. Returns 0, or -1 if the file cannot be written.
+*/
+int trace_start(const char *path) {
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, TRACE_FILE_BUFFER);
+
+    struct trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        file = NULL;
+        return -1;
+    }
+    ht_init(&numbers);
+    arena_init(&strings);
+    name_count = 0;
+    last_ns = now_ns();
+    return 0;
+}
+
+/* Append a command to the trace, stamped with the time now. Does nothing
+* unless trace_start has been called. Only ever called from one thread.
+*/
+void trace_record(int cmd_argc, char **cmd_argv) {
+    if (file == NULL) {
+        return;
+    }
+    uint64_t now = now_ns();
+    put_varint(now - last_ns);
+    last_ns = now;
+
+    put_varint((uint64_t) cmd_argc);
+    for (int i = 0; i < cmd_argc; i++) {
+        uintptr_t item = (uintptr_t) ht_get(&numbers, cmd_argv[i]);
+        if (item != 0) {
+            put_varint(2 * (uint64_t) (item - 1));
+            continue;
+        }
+        size_t length = strlen(cmd_argv[i]);
+        put_varint(2 * (uint64_t) length + 1);
+        fwrite(cmd_argv[i], 1, length, file);
+        if (name_count < TRACE_MAX_NAMES) {
+            ht_put(&numbers, arena_strdup(&strings, cmd_argv[i]), (void *) (uintptr_t) (name_count + 1));
+            name_count++;
+        }
+    }
+}
+
+/* Finish the trace, if one is being recorded.
+*/
+void trace_close(void) {
+    if (file == NULL) {
+        return;
+    }
+    if (ferror(file) || fclose(file) != 0) {
+        error("Could not write trace");
+    }
+    file = NULL;
+    ht_free(&numbers);
+    arena_release(&strings);
+}
+
+/* The latency fraction of the way through the count sorted latencies in ns.
+*/
+static uint64_t percentile(const uint64_t *ns, size_t count, double fraction) {
+    size_t index = (size_t) (count * fraction);
+    return ns[index < count ? index : count - 1];
+}
+
+static int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Grow the array at *items, of *capacity items of size bytes, to hold at
+* least count.
+*/
+static void reserve(void **items, size_t *capacity, size_t count, size_t size) {
+    if (count <= *capacity) {
+        return;
+    }
+    *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+    *items = realloc(*items, *capacity * size);
+    if (*items == NULL) {
+        perror("Error allocating memory for trace. Exiting...");
+        exit(1);
+    }
+}
+
+/* Decode the trace in [data, end) into *commands and *args, with the text of
+* every argument in texts. Returns the number of commands, or -1 if the trace
+* is not well formed.
+*/
+static long decode(const uint8_t *data, const uint8_t *end, struct trace_command **commands, char ***args,
+                   Arena *texts) {
+    const uint8_t *p = data + sizeof(struct trace_header);
+    size_t count = 0, command_capacity = 0, arg_count = 0, arg_capacity = 0;
+    char **names = NULL;
+    size_t names_used = 0, name_capacity = 0;
+    uint64_t at = 0;
+    long result = 0;
+
+    while (p < end && result == 0) {
+        uint64_t gap, argc;
+        if (get_varint(&p, end, &gap) == -1 || get_varint(&p, end, &argc) == -1 ||
+            argc == 0 || argc > INPUT_ARG_MAX_NUM - 1) {
+            result = -1;
+            break;
+        }
+        at = count == 0 ? 0 : at + gap;
+        reserve((void **) commands, &command_capacity, count + 1, sizeof(struct trace_command));
+        reserve((void **) args, &arg_capacity, arg_count + argc + 1, sizeof(char *));
+        (*commands)[count].due_ns = at;
+        (*commands)[count].first_arg = arg_count;
+        (*commands)[count].argc = (int) argc;
+
+        for (uint64_t i = 0; i < argc; i++) {
+            uint64_t code;
+            if (get_varint(&p, end, &code) == -1) {
+                result = -1;
+                break;
+            }
+            if (code % 2 == 0) {
+                if (code / 2 >= names_used) {
+                    result = -1;
+                    break;
+                }
+                (*args)[arg_count++] = names[code / 2];
+                continue;
+            }
+            uint64_t length = code / 2;
+            if (length > (uint64_t) (end - p) || memchr(p, '\0', length) != NULL) {
+                result = -1;
+                break;
+            }
+            char *text = arena_alloc(texts, length + 1);
+            memcpy(text, p, length);
+            text[length] = '\0';
+            p += length;
+            (*args)[arg_count++] = text;
+            if (names_used < TRACE_MAX_NAMES) {
+                reserve((void **) &names, &name_capacity, names_used + 1, sizeof(char *));
+                names[names_used++] = text;
+            }
+        }
+        (*args)[arg_count++] = NULL;
+        count++;
+    }
+    free(names);
+    return result == -1 ? -1 : (long) count;
+}
+
+/* Write out finished output and turn the due times stored in
+* latencies[finished..] into latencies for every command whose output is now
+* out. Returns the new finished count.
+*/
+static size_t stamp_written(uint64_t *latencies, size_t finished, size_t first_written) {
+    executor_flush();
+    size_t written = executor_written() - first_written;
+    uint64_t now = now_ns();
+    for (; finished < written; finished++) {
+        latencies[finished] = now - latencies[finished];
+    }
+    return finished;
+}
+
+/* Replay the trace at path against the groups at group_list_addr, open
+* loop at speed times the recorded pace, stopping early at quit. Fills in
+* stats (which may be NULL). Returns 0, -1 if the file cannot be read and -2
+* if it is not a valid trace, in which case nothing has been run.
+*/
+int trace_replay(const char *path, double speed, Group **group_list_addr, struct trace_replay_stats *stats) {
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t) sizeof(struct trace_header)) {
+        close(fd);
+        return -2;
+    }
+    size_t size = (size_t) st.st_size;
+    const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+
+    // Everything is decoded up front, so that decoding takes none of the replay's time
+    struct trace_header header;
+    memcpy(&header, data, sizeof(header));
+    struct trace_command *commands = NULL;
+    char **args = NULL;
+    Arena texts;
+    arena_init(&texts);
+    long count = -1;
+    if (memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 && header.version == TRACE_VERSION) {
+        count = decode(data, data + size, &commands, &args, &texts);
+    }
+    munmap((void *) data, size);
+    if (count == -1) {
+        free(commands);
+        free(args);
+        arena_release(&texts);
+        return -2;
+    }
+
+    setvbuf(stdout, NULL, _IOFBF, TRACE_STDOUT_BUFFER);
+    uint64_t *latencies = malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+    if (latencies == NULL) {
+        perror("Error allocating memory for trace latencies. Exiting...");
+        exit(1);
+    }
+
+    // A command's latency runs until its output is written out, which with workers is after it is handed off
+    size_t ran = 0, finished = 0, behind = 0;
+    size_t first_written = executor_written();
+    uint64_t started = now_ns();
+    for (long i = 0; i < count; i++) {
+        uint64_t due = started + (uint64_t) (commands[i].due_ns / speed);
+        uint64_t now = now_ns();
+        while (now < due) {
+            sleep_until(due - now > TRACE_POLL_NS ? now + TRACE_POLL_NS : due);
+            finished = stamp_written(latencies, finished, first_written);
+            now = now_ns();
+        }
+        behind += now - due > TRACE_LATE_NS;
+
+        latencies[ran++] = due;
+        executor_begin();
+        int quit = execute(commands[i].argc, args + commands[i].first_arg, group_list_addr) == -1;
+        executor_end();
+        finished = stamp_written(latencies, finished, first_written);
+        if (quit) {
+            break; /* quit command was replayed */
+        }
+    }
+    while (finished < ran) {
+        sleep_until(now_ns() + TRACE_POLL_NS);
+        finished = stamp_written(latencies, finished, first_written);
+    }
+    double seconds = (now_ns() - started) / 1e9;
+    fflush(stdout);
+
+    if (stats != NULL) {
+        qsort(latencies, ran, sizeof(uint64_t), compare_ns);
+        stats->commands = ran;
+        stats->behind = behind;
+        stats->seconds = seconds;
+        stats->p50_ns = ran > 0 ? percentile(latencies, ran, 0.5) : 0;
+        stats->p99_ns = ran > 0 ? percentile(latencies, ran, 0.99) : 0;
+        stats->p999_ns = ran > 0 ? percentile(latencies, ran, 0.999) : 0;
+        stats->max_ns = ran > 0 ? latencies[ran - 1] : 0;
+    }
+    free(latencies);
+    free(commands);
+    free(args);
+    arena_release(&texts);
+    return 0;
+}
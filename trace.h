@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "lists.h"
+
+/* Command traces: every text command as it arrives, with when it arrived,
+* so that real traffic can be replayed against another build at its
+* recorded pace, or a multiple of it.
+*
+* After a header, a trace is a sequence of records, each made of LEB128
+* varints: the nanoseconds since the record before (or since recording
+* started), the argument count, and then each argument. An argument is
+* coded as twice the number of an earlier argument with the same text, or as
+* twice its length plus one followed by its bytes, in which case it gets the
+* next number (until TRACE_MAX_NAMES have been given out). Group and user
+* names, amounts and commands keep recurring, so most arguments are a byte
+* or two.
+*
+* Replaying is open loop: each command is due at its recorded offset from the
+* first, divided by the speed, whether or not the ones before have finished.
+* Its latency runs from when it was due to when its output was written out,
+* which with --threads or --readers is after a worker has run it, so time
+* spent waiting behind a slow command counts, and a command that starts more than
+* TRACE_LATE_NS after it was due is counted as behind schedule.
+*/
+
+#define TRACE_VERSION 1
+#define TRACE_MAX_NAMES (1 << 20)	// Distinct arguments given numbers, which bounds both sides' tables
+#define TRACE_LATE_NS 1000000		// Starting later than this after it was due is falling behind
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+struct trace_replay_stats {
+	size_t commands;
+	size_t behind;			// Commands that started over TRACE_LATE_NS late
+	double seconds;
+	uint64_t p50_ns;		// Latency percentiles, from when each command was due until its output was out
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+};
+
+int trace_start(const char *path);
+void trace_record(int cmd_argc, char **cmd_argv);
+void trace_close(void);
+int trace_replay(const char *path, double speed, Group **group_list_addr, struct trace_replay_stats *stats);
+
+#endif
@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trie.h"
+
+/* A node with no item and no children, and room for a label of length
+* bytes, which the caller fills in.
+*/
+static struct trie_node *node_alloc(Trie *trie, size_t length) {
+    struct trie_node *node = malloc(sizeof(struct trie_node) + length);
+    if (node == NULL) {
+        perror("Error allocating memory for name trie. Exiting...");
+        exit(1);
+    }
+    node->item = NULL;
+    node->children = NULL;
+    node->child_count = 0;
+    node->child_capacity = 0;
+    node->length = (uint32_t) length;
+    trie->bytes += sizeof(struct trie_node) + length;
+    return node;
+}
+
+static struct trie_node *node_new(Trie *trie, const char *label, size_t length) {
+    struct trie_node *node = node_alloc(trie, length);
+    memcpy(node->label, label, length);
+    return node;
+}
+
+/* Free node alone, not its children, which it has either none of or handed
+* over (with their array, whose bytes stay counted) to another node.
+*/
+static void node_free(Trie *trie, struct trie_node *node) {
+    trie->bytes -= sizeof(struct trie_node) + node->length + node->child_capacity * sizeof(struct trie_node *);
+    free(node->children);
+    free(node);
+}
+
+static void subtree_free(Trie *trie, struct trie_node *node) {
+    for (uint32_t i = 0; i < node->child_count; i++) {
+        subtree_free(trie, node->children[i]);
+    }
+    node_free(trie, node);
+}
+
+void trie_init(Trie *trie) {
+    trie->root = NULL;
+    trie->count = 0;
+    trie->bytes = 0;
+}
+
+void trie_free(Trie *trie) {
+    if (trie->root != NULL) {
+        subtree_free(trie, trie->root);
+    }
+    trie_init(trie);
+}
+
+/* The position among node's children of the one whose label starts with
+* byte, or where it would go. Sets *found if there is one.
+*/
+static uint32_t child_index(const struct trie_node *node, unsigned char byte, int *found) {
+    uint32_t low = 0, high = node->child_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        unsigned char first = (unsigned char) node->children[middle]->label[0];
+        if (first == byte) {
+            *found = 1;
+            return middle;
+        }
+        if (first < byte) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *found = 0;
+    return low;
+}
+
+static void child_insert(Trie *trie, struct trie_node *node, uint32_t index, struct trie_node *child) {
+    if (node->child_count == node->child_capacity) {
+        uint32_t capacity = node->child_capacity == 0 ? 2 : node->child_capacity * 2;
+        struct trie_node **children = realloc(node->children, capacity * sizeof(struct trie_node *));
+        if (children == NULL) {
+            perror("Error allocating memory for name trie. Exiting...");
+            exit(1);
+        }
+        trie->bytes += (capacity - node->child_capacity) * sizeof(struct trie_node *);
+        node->children = children;
+        node->child_capacity = capacity;
+    }
+    memmove(node->children + index + 1, node->children + index, (node->child_count - index) * sizeof(struct trie_node *));
+    node->children[index] = child;
+    node->child_count++;
+}
+
+/* Replace the node at *slot by one whose label is its first at bytes, with
+* the rest of the node below it.
+*/
+static void split(Trie *trie, struct trie_node **slot, uint32_t at) {
+    struct trie_node *old = *slot;
+    struct trie_node *head = node_new(trie, old->label, at);
+    struct trie_node *tail = node_new(trie, old->label + at, old->length - at);
+    tail->item = old->item;
+    tail->children = old->children;
+    tail->child_count = old->child_count;
+    tail->child_capacity = old->child_capacity;
+    old->children = NULL;
+    old->child_capacity = 0;
+    node_free(trie, old);
+    child_insert(trie, head, 0, tail);
+    *slot = head;
+}
+
+/* Add key, which must not be in trie yet, with item, which must not be NULL.
+*/
+void trie_insert(Trie *trie, const char *key, void *item) {
+    if (trie->root == NULL) {
+        trie->root = node_new(trie, "", 0);
+    }
+    struct trie_node *node = trie->root;
+    const char *p = key;
+    while (*p != '\0') {
+        int found;
+        uint32_t index = child_index(node, (unsigned char) *p, &found);
+        if (!found) {
+            child_insert(trie, node, index, node_new(trie, p, strlen(p)));
+            node = node->children[index];
+            break;
+        }
+        struct trie_node *child = node->children[index];
+        uint32_t common = 1;
+        while (common < child->length && p[common] == child->label[common]) {
+            common++;
+        }
+        if (common < child->length) {
+            split(trie, &node->children[index], common);
+        }
+        node = node->children[index];
+        p += common;
+    }
+    node->item = item;
+    trie->count++;
+}
+
+/* Merge the node at *slot, which ends no name, into its only child.
+*/
+static void merge(Trie *trie, struct trie_node **slot) {
+    struct trie_node *node = *slot;
+    struct trie_node *child = node->children[0];
+    struct trie_node *merged = node_alloc(trie, node->length + child->length);
+    memcpy(merged->label, node->label, node->length);
+    memcpy(merged->label + node->length, child->label, child->length);
+    merged->item = child->item;
+    merged->children = child->children;
+    merged->child_count = child->child_count;
+    merged->child_capacity = child->child_capacity;
+    child->children = NULL;
+    child->child_capacity = 0;
+    node_free(trie, child);
+    node_free(trie, node);
+    *slot = merged;
+}
+
+/* Remove the name at p from below node, whose own label has been matched,
+* and tidy up the child it was under. Returns its item, or NULL if it is
+* not there.
+*/
+static void *remove_below(Trie *trie, struct trie_node *node, const char *p) {
+    if (*p == '\0') {
+        void *item = node->item;
+        node->item = NULL;
+        return item;
+    }
+    int found;
+    uint32_t index = child_index(node, (unsigned char) *p, &found);
+    if (!found) {
+        return NULL;
+    }
+    struct trie_node *child = node->children[index];
+    if (strncmp(p, child->label, child->length) != 0) {
+        return NULL;
+    }
+    void *item = remove_below(trie, child, p + child->length);
+    if (item == NULL || child->item != NULL) {
+        return item;
+    }
+    // A node that ends no name must have two children to be worth keeping
+    if (child->child_count == 0) {
+        node_free(trie, child);
+        node->child_count--;
+        memmove(node->children + index, node->children + index + 1, (node->child_count - index) * sizeof(struct trie_node *));
+    } else if (child->child_count == 1) {
+        merge(trie, &node->children[index]);
+    }
+    return item;
+}
+
+/* Remove key from trie, returning its item, or NULL if it is not there.
+*/
+void *trie_remove(Trie *trie, const char *key) {
+    if (trie->root == NULL) {
+        return NULL;
+    }
+    void *item = remove_below(trie, trie->root, key);
+    if (item != NULL) {
+        trie->count--;
+    }
+    return item;
+}
+
+/* Visit the items below node, node's first, until limit have been visited.
+* Returns how many were.
+*/
+static size_t visit_below(const struct trie_node *node, size_t limit, void (*visit)(void *item, void *context),
+                          void *context) {
+    size_t visited = 0;
+    if (node->item != NULL && limit > 0) {
+        visit(node->item, context);
+        visited++;
+    }
+    for (uint32_t i = 0; i < node->child_count && visited < limit; i++) {
+        visited += visit_below(node->children[i], limit - visited, visit, context);
+    }
+    return visited;
+}
+
+/* Call visit on the items of at most limit names that start with prefix, in
+* name order. Returns how many were visited.
+*/
+size_t trie_prefix(const Trie *trie, const char *prefix, size_t limit, void (*visit)(void *item, void *context),
+                   void *context) {
+    const struct trie_node *node = trie->root;
+    if (node == NULL) {
+        return 0;
+    }
+    const char *p = prefix;
+    while (*p != '\0') {
+        int found;
+        uint32_t index = child_index(node, (unsigned char) *p, &found);
+        if (!found) {
+            return 0;
+        }
+        node = node->children[index];
+        uint32_t matched = 1;
+        while (matched < node->length && p[matched] != '\0') {
+            if (p[matched] != node->label[matched]) {
+                return 0;
+            }
+            matched++;
+        }
+        p += matched; // Stops at the end of the prefix, even partway down an edge
+    }
+    return visit_below(node, limit, visit, context);
+}
+
+#define SUGGEST_BAND (2 * TRIE_SUGGEST_DISTANCE + 1)
+#define SUGGEST_FAR (TRIE_SUGGEST_DISTANCE + 1)	// Stands for every distance past the bound
+
+/* What trie_suggest carries down the trie. Row d of rows holds the edit
+* distances between the first d bytes of the path and the prefixes of key
+* whose lengths are within TRIE_SUGGEST_DISTANCE of d, as no other prefix can
+* lead to a match: cell i of row d is for the prefix of length
+* d + i - TRIE_SUGGEST_DISTANCE. Rows are added as the walk goes deeper, so
+* they never outnumber the bytes of the longest name.
+*/
+struct suggestion {
+    const char *key;
+    size_t length;			// Of key
+    int *rows;				// SUGGEST_BAND cells each
+    size_t capacity;			// Rows there is room for
+    struct trie_match *matches;		// Closest first, ties in name order
+    size_t found;
+};
+
+/* Keep item among the closest matches, if it is close enough.
+*/
+static void suggest_match(struct suggestion *s, void *item, int distance) {
+    size_t at = s->found;
+    while (at > 0 && s->matches[at - 1].distance > distance) {
+        at--;
+    }
+    if (at == TRIE_SUGGEST_LIMIT) {
+        return;
+    }
+    size_t kept = s->found < TRIE_SUGGEST_LIMIT ? s->found : TRIE_SUGGEST_LIMIT - 1;
+    memmove(s->matches + at + 1, s->matches + at, (kept - at) * sizeof(struct trie_match));
+    s->matches[at].item = item;
+    s->matches[at].distance = distance;
+    s->found = kept + 1;
+}
+
+/* Make room for row d. Returns -1, leaving the rows as they were, if there is
+* no memory for it.
+*/
+static int suggest_reserve(struct suggestion *s, size_t d) {
+    if (d < s->capacity) {
+        return 0;
+    }
+    size_t capacity = s->capacity == 0 ? 16 : s->capacity * 2;
+    int *rows = realloc(s->rows, capacity * SUGGEST_BAND * sizeof(int));
+    if (rows == NULL) {
+        return -1;
+    }
+    s->rows = rows;
+    s->capacity = capacity;
+    return 0;
+}
+
+/* Fill row d + 1 from row d for the path byte c. Returns the smallest
+* distance in it.
+*/
+static int suggest_row(struct suggestion *s, size_t d, char c) {
+    const int *above = s->rows + d * SUGGEST_BAND;
+    int *row = s->rows + (d + 1) * SUGGEST_BAND;
+    int best = SUGGEST_FAR;
+    for (int i = 0; i < SUGGEST_BAND; i++) {
+        // The prefix of key this cell is for, which is one longer than the one in the same cell above
+        long j = (long) (d + 1) + i - TRIE_SUGGEST_DISTANCE;
+        int cost = SUGGEST_FAR;
+        if (j >= 0 && j <= (long) s->length) {
+            if (j > 0) {
+                cost = above[i] + (s->key[j - 1] != c);
+            }
+            if (i + 1 < SUGGEST_BAND && above[i + 1] + 1 < cost) {
+                cost = above[i + 1] + 1;
+            }
+            if (i > 0 && row[i - 1] + 1 < cost) {
+                cost = row[i - 1] + 1;
+            }
+            if (cost > SUGGEST_FAR) {
+                cost = SUGGEST_FAR;
+            }
+        }
+        row[i] = cost;
+        best = cost < best ? cost : best;
+    }
+    return best;
+}
+
+static void suggest_below(struct suggestion *s, const struct trie_node *node, size_t depth) {
+    // The cell of the whole key, if it is in the band
+    long end = (long) s->length - (long) depth + TRIE_SUGGEST_DISTANCE;
+    if (node->item != NULL && end >= 0 && end < SUGGEST_BAND &&
+        s->rows[depth * SUGGEST_BAND + end] <= TRIE_SUGGEST_DISTANCE) {
+        suggest_match(s, node->item, s->rows[depth * SUGGEST_BAND + end]);
+    }
+    for (uint32_t i = 0; i < node->child_count; i++) {
+        const struct trie_node *child = node->children[i];
+        size_t d = depth;
+        int close = 1;
+        for (uint32_t k = 0; k < child->length && close; k++) {
+            if (suggest_reserve(s, d + 1) == -1) {
+                close = 0; // Out of memory: leave this branch out rather than fail the query
+                break;
+            }
+            close = suggest_row(s, d, child->label[k]) <= TRIE_SUGGEST_DISTANCE;
+            d++;
+        }
+        if (close) {
+            suggest_below(s, child, d);
+        }
+    }
+}
+
+/* Fill matches, which has room for TRIE_SUGGEST_LIMIT, with the names at
+* most TRIE_SUGGEST_DISTANCE insertions, deletions or substitutions away from
+* key, closest first and ties in name order. Only the branches of the trie
+* that stay within the bound are walked, and only the band of each row that
+* can still match is computed, so a long key costs no more than a short one.
+* Returns the number of matches, which leaves out any that could not be
+* looked for for lack of memory.
+*/
+size_t trie_suggest(const Trie *trie, const char *key, struct trie_match *matches) {
+    struct suggestion s = { key, strlen(key), NULL, 0, matches, 0 };
+    if (trie->root == NULL || suggest_reserve(&s, 0) == -1) {
+        return 0;
+    }
+    for (int i = 0; i < SUGGEST_BAND; i++) {
+        long j = (long) i - TRIE_SUGGEST_DISTANCE;
+        s.rows[i] = j >= 0 && j <= (long) s.length ? (int) j : SUGGEST_FAR;
+    }
+    suggest_below(&s, trie->root, 0);
+    free(s.rows);
+    return s.found;
+}
@@ -0,0 +1,54 @@
+#ifndef TRIE_H
+#define TRIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A compressed radix trie mapping names to items, for finding names by
+* prefix or by spelling. Each edge carries a run of bytes and every node
+* other than the root either ends a name or has at least two children, so a
+* prefix search touches the nodes along the prefix and then about two per
+* name it returns, however many names there are. Children are kept in the
+* order of their first bytes, so names come out in strcmp order.
+*
+* Nodes are copies of the names, so unlike an HTable the trie does not need
+* its keys to outlive their entries. bytes counts what the nodes take, for
+* owners that account for their memory (see memory.h).
+*/
+
+#define TRIE_SUGGEST_DISTANCE 2		// Most edits a suggestion may be from the name asked for
+#define TRIE_SUGGEST_LIMIT 10		// Suggestions returned, closest first
+
+struct trie_node {
+	void *item;			// Of the name that ends here, or NULL
+	struct trie_node **children;	// In order of their labels' first bytes
+	uint32_t child_count;
+	uint32_t child_capacity;
+	uint32_t length;		// Bytes in label
+	char label[];			// The edge from the parent, not NUL terminated
+};
+
+struct trie {
+	struct trie_node *root;		// NULL until the first insert
+	size_t count;			// Names in the trie
+	size_t bytes;			// Taken by the nodes and their child arrays
+};
+
+/* A name found by trie_suggest, and how many edits away it is.
+*/
+struct trie_match {
+	void *item;
+	int distance;
+};
+
+typedef struct trie Trie;
+
+void trie_init(Trie *trie);
+void trie_free(Trie *trie);
+void trie_insert(Trie *trie, const char *key, void *item);
+void *trie_remove(Trie *trie, const char *key);
+size_t trie_prefix(const Trie *trie, const char *prefix, size_t limit, void (*visit)(void *item, void *context),
+                   void *context);
+size_t trie_suggest(const Trie *trie, const char *key, struct trie_match *matches);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "view.h"
+
+struct view {
+	Group group;			// What queries see; only the fields they read are set
+	User *users;			// Copies of the users in balance order, or NULL for none
+	void *history;			// Chunk directory, cold block directory and chunk start times, or NULL
+	uint64_t order_version;		// Of the group when users was copied
+};
+
+/* Memory that a read handed out before epoch may still be using.
+*/
+struct retired {
+	void *object;			// NULL for a name
+	Slab *slab;			// Where object goes back to, or NULL to free it
+	uint32_t name;			// Interned name to give a reference back to, if object is NULL
+	uint64_t epoch;
+};
+
+static uint64_t epoch;			// Reads handed out so far
+static struct retired *retired;		// Oldest first, from retired_start on
+static size_t retired_start;
+static size_t retired_count;
+static size_t retired_capacity;
+
+static void *view_alloc(size_t size) {
+    void *block = malloc(size);
+    if (block == NULL) {
+        perror("Error allocating memory for read view. Exiting...");
+        exit(1);
+    }
+    return block;
+}
+
+static void copy_users(struct view *view, Group *group) {
+    size_t count = group->user_count;
+    User *copies = count > 0 ? view_alloc(count * sizeof(User)) : NULL;
+    size_t i = 0;
+    for (User *user = group->users; user != NULL; user = user->next, i++) {
+        copies[i] = *user;
+        copies[i].prev = i > 0 ? &copies[i - 1] : NULL;
+        copies[i].next = i + 1 < count ? &copies[i + 1] : NULL;
+        copies[i].level = 0;
+        copies[i].links = NULL; // The skip list is the writer's
+    }
+    view->users = copies;
+    view->order_version = group->order_version;
+    view->group.users = copies;
+    view->group.users_last = count > 0 ? &copies[count - 1] : NULL;
+    view->group.user_count = count;
+    view->group.rank_level = 0; // So list_users knows to index the array rather than rank
+}
+
+static void copy_history(struct view *view, Group *group) {
+    size_t chunks = (group->xct_rows + XCT_CHUNK_ROWS - 1) / XCT_CHUNK_ROWS;
+    void *history = NULL;
+    view->group.xct_chunks = NULL;
+    view->group.xct_cold = NULL;
+    view->group.xct_chunk_start = NULL;
+    if (chunks > 0) {
+        history = view_alloc(chunks * (sizeof(struct xct_chunk *) + sizeof(struct xct_block *) + sizeof(int64_t)));
+        view->group.xct_chunks = history;
+        view->group.xct_cold = (struct xct_block **) (view->group.xct_chunks + chunks);
+        view->group.xct_chunk_start = (int64_t *) (view->group.xct_cold + chunks);
+        memcpy(view->group.xct_chunks, group->xct_chunks, chunks * sizeof(struct xct_chunk *));
+        memcpy(view->group.xct_cold, group->xct_cold, chunks * sizeof(struct xct_block *));
+        memcpy(view->group.xct_chunk_start, group->xct_chunk_start, chunks * sizeof(int64_t));
+    }
+    view->history = history;
+    view->group.xct_rows = group->xct_rows;
+    view->group.xct_live = group->xct_live;
+    view->group.xct_last_time = group->xct_last_time;
+    group->view_version++; // Every chunk and block there now is shared with this view
+}
+
+/* Return a view of group as it is now, for a read of its users (with users
+* set) or of its history (with xcts set). The newest view is handed out again
+* if the group has not changed in those parts since; otherwise only the
+* changed parts are copied and the view they replace is retired.
+*/
+Group *view_take(Group *group, int users, int xcts) {
+    struct view *old = group->view;
+    users = old == NULL || (users && old->order_version != group->order_version);
+    xcts = old == NULL || (xcts && (old->group.xct_rows != group->xct_rows ||
+                                    old->group.xct_live != group->xct_live));
+    if (!users && !xcts) {
+        return &old->group;
+    }
+
+    struct view *view = view_alloc(sizeof(struct view));
+    if (old != NULL) {
+        *view = *old; // Keeps the parts that have not changed
+        view_retire(NULL, old);
+    } else {
+        memset(view, 0, sizeof(struct view));
+        view->group.name = group->name;
+    }
+    if (users) {
+        if (old != NULL) {
+            view_retire(NULL, old->users);
+        }
+        copy_users(view, group);
+    }
+    if (xcts) {
+        if (old != NULL) {
+            view_retire(NULL, old->history);
+        }
+        copy_history(view, group);
+    }
+    group->view = view;
+    return &view->group;
+}
+
+/* Count a read that is about to be handed to a reader, returning its number.
+* Reads are numbered from 0 in the order they are handed out.
+*/
+uint64_t view_pin(void) {
+    return epoch++;
+}
+
+/* Queue entry until every read handed out so far is done.
+*/
+static void retire(struct retired entry) {
+    if (retired_start + retired_count == retired_capacity) {
+        if (retired_start > 0) {
+            memmove(retired, retired + retired_start, retired_count * sizeof(struct retired));
+            retired_start = 0;
+        }
+        if (retired_count == retired_capacity) {
+            retired_capacity = retired_capacity == 0 ? 64 : retired_capacity * 2;
+            retired = realloc(retired, retired_capacity * sizeof(struct retired));
+            if (retired == NULL) {
+                perror("Error allocating memory for read view. Exiting...");
+                exit(1);
+            }
+        }
+    }
+    retired[retired_start + retired_count++] = entry;
+}
+
+/* Free object, or give it back to slab, once every read handed out so far
+* is done.
+*/
+void view_retire(Slab *slab, void *object) {
+    if (object != NULL) {
+        retire((struct retired) { object, slab, INTERN_NONE, epoch });
+    }
+}
+
+/* Give back a reference to the name interned as id once every read handed
+* out so far is done.
+*/
+void view_retire_name(uint32_t id) {
+    retire((struct retired) { NULL, NULL, id, epoch });
+}
+
+/* Free everything retired before the read numbered oldest was handed out,
+* given that it is the oldest read still running (or VIEW_IDLE if none is).
+*/
+void view_collect(uint64_t oldest) {
+    while (retired_count > 0 && retired[retired_start].epoch <= oldest) {
+        struct retired *r = &retired[retired_start];
+        if (r->object == NULL) {
+            intern_unref(r->name);
+        } else if (r->slab != NULL) {
+            slab_free(r->slab, r->object);
+        } else {
+            free(r->object);
+        }
+        retired_start++;
+        retired_count--;
+    }
+    if (retired_count == 0) {
+        free(retired);
+        retired = NULL;
+        retired_start = 0;
+        retired_capacity = 0;
+    }
+}
+
+/* Free the newest view of group. No read may be running, and nothing may be
+* left retired.
+*/
+void view_release(Group *group) {
+    struct view *view = group->view;
+    if (view != NULL) {
+        free(view->users);
+        free(view->history);
+        free(view);
+        group->view = NULL;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "lists.h"
+
+/* Read views: frozen copies of a group that reader threads query while the
+* one writer thread goes on changing the group itself.
+*
+* A view is a Group header of its own, so the query functions in lists.c run
+* on it unchanged. It has two parts, each taken only when a query needs it and
+* the group has changed since the last view: the users, copied in balance
+* order, and the transaction history, of which only the chunk directories
+* are copied. The chunks and cold blocks themselves are shared. Appends only
+* write rows past the ones a view can see, and a chunk or block that is still
+* shared is copied before any of its rows is changed (see rearrange_xct and
+* kill_cold_entry), so no view ever sees its group move.
+*
+* Nothing a view may still be using is freed straight away. It is retired,
+* stamped with the number of reads handed out so far, and view_collect frees
+* it once all of those reads are done: epoch-based reclamation, with reads as
+* the epochs. Readers take no locks and never wait for the writer.
+*
+* Every function here is for the writer thread only.
+*/
+
+#define VIEW_IDLE UINT64_MAX	// For view_collect: no read is running
+
+Group *view_take(Group *group, int users, int xcts);
+uint64_t view_pin(void);
+void view_retire(Slab *slab, void *object);
+void view_retire_name(uint32_t id);
+void view_collect(uint64_t oldest);
+void view_release(Group *group);
+
+#endif
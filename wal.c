@@ -0,0 +1,450 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "output.h"
+#include "wal.h"
+
+#define WAL_MAGIC "BUXWAL"
+#define WAL_BYTE_ORDER 0x01020304u
+#define WAL_BUFFER_SIZE (1 << 20)
+#define WAL_FLUSH_THRESHOLD (WAL_BUFFER_SIZE / 2)	// Flush early once a batch is this big
+
+struct wal_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+};
+
+/* Every record is this header followed by length bytes of payload: the
+* command's arguments, each terminated by a NUL. crc covers the payload.
+*/
+struct wal_record {
+	uint32_t length;
+	uint32_t crc;
+};
+
+struct wal_buffer {
+	char *data;
+	size_t used;
+	size_t capacity;
+};
+
+static int wal_fd = -1;
+static enum wal_mode mode;
+static long window_us;
+static int replaying;			// Set while the log is fed back through process_args
+
+// Group and async modes: the command thread fills active while the flusher writes the other buffer
+static struct wal_buffer buffers[2];
+static struct wal_buffer *active;
+static pthread_t flusher;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;		// Signals the flusher that a batch has started or filled up
+static pthread_cond_t drained;		// Signals the command thread that active was swapped out or a batch written
+static int closing;
+
+// Sync mode: one record at a time, written straight from here
+static struct wal_buffer scratch;
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        crc_table[i] = crc;
+    }
+}
+
+/* CRC-32 (the zlib polynomial) of size bytes at data.
+*/
+static uint32_t crc32(const char *data, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc_table[(crc ^ (unsigned char) data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static void buffer_reserve(struct wal_buffer *buffer, size_t size) {
+    if (buffer->used + size <= buffer->capacity) {
+        return;
+    }
+    while (buffer->used + size > buffer->capacity) {
+        buffer->capacity = buffer->capacity == 0 ? WAL_BUFFER_SIZE : buffer->capacity * 2;
+    }
+    buffer->data = realloc(buffer->data, buffer->capacity);
+    if (buffer->data == NULL) {
+        perror("Error allocating memory for write-ahead log. Exiting...");
+        exit(1);
+    }
+}
+
+/* A failed log write means acknowledged commands may not be durable, so it is
+* treated like running out of memory.
+*/
+static void write_all(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(wal_fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error writing write-ahead log. Exiting...");
+            exit(1);
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+static void sync_log(void) {
+    if (fdatasync(wal_fd) == -1) {
+        perror("Error syncing write-ahead log. Exiting...");
+        exit(1);
+    }
+}
+
+static size_t record_size(int cmd_argc, char **cmd_argv) {
+    size_t size = sizeof(struct wal_record);
+    for (int i = 0; i < cmd_argc; i++) {
+        size += strlen(cmd_argv[i]) + 1;
+    }
+    return size;
+}
+
+/* Encode the command at the end of buffer, which must have room for it.
+*/
+static void encode_record(struct wal_buffer *buffer, int cmd_argc, char **cmd_argv) {
+    struct wal_record record;
+    char *payload = buffer->data + buffer->used + sizeof(record);
+    char *p = payload;
+
+    for (int i = 0; i < cmd_argc; i++) {
+        size_t length = strlen(cmd_argv[i]) + 1;
+        memcpy(p, cmd_argv[i], length);
+        p += length;
+    }
+    record.length = (uint32_t) (p - payload);
+    record.crc = crc32(payload, record.length);
+    memcpy(buffer->data + buffer->used, &record, sizeof(record));
+    buffer->used = p - buffer->data;
+}
+
+static struct timespec deadline_after(long microseconds) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += microseconds / 1000000;
+    ts.tv_nsec += (microseconds % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* The flusher thread: once a batch has started, give it one window to fill
+* (less if it grows past WAL_FLUSH_THRESHOLD), swap it out and write it with a
+* single write and, in group mode, a single fdatasync.
+*/
+static void *flush_loop(void *unused) {
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (active->used == 0 && !closing) {
+            pthread_cond_wait(&wake, &lock);
+        }
+        if (active->used == 0) {
+            break;
+        }
+        struct timespec deadline = deadline_after(window_us);
+        while (active->used < WAL_FLUSH_THRESHOLD && !closing) {
+            if (pthread_cond_timedwait(&wake, &lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        struct wal_buffer *batch = active;
+        active = batch == &buffers[0] ? &buffers[1] : &buffers[0];
+        pthread_cond_broadcast(&drained);
+        pthread_mutex_unlock(&lock);
+
+        write_all(batch->data, batch->used);
+        if (mode == WAL_GROUP) {
+            sync_log();
+        }
+
+        pthread_mutex_lock(&lock);
+        batch->used = 0;
+        pthread_cond_broadcast(&drained);
+    }
+    pthread_mutex_unlock(&lock);
+    return unused;
+}
+
+/* Set *mode from its name on the command line. Returns 0, or -1 if name is
+* not a mode.
+*/
+int wal_parse_mode(const char *name, enum wal_mode *result) {
+    if (strcmp(name, "sync") == 0) {
+        *result = WAL_SYNC;
+    } else if (strcmp(name, "group") == 0) {
+        *result = WAL_GROUP;
+    } else if (strcmp(name, "async") == 0) {
+        *result = WAL_ASYNC;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Feed every intact record after the header back through process_args and
+* return the offset just past the last one. What the commands print was seen
+* when they first ran, so it is thrown away.
+*/
+static size_t replay(char *data, size_t size, Group **group_list_addr, size_t *records) {
+    char *cmd_argv[INPUT_ARG_MAX_NUM];
+    size_t offset = sizeof(struct wal_header);
+    OutBuf discard = { 0 };
+    out_capture(&discard);
+
+    while (size - offset >= sizeof(struct wal_record)) {
+        struct wal_record record;
+        memcpy(&record, data + offset, sizeof(record));
+        char *payload = data + offset + sizeof(record);
+        if (record.length == 0 || record.length > size - offset - sizeof(record) ||
+            payload[record.length - 1] != '\0' || crc32(payload, record.length) != record.crc) {
+            break; // Torn or corrupt: nothing after this point can be trusted
+        }
+
+        int cmd_argc = 0;
+        for (char *p = payload; p < payload + record.length; p += strlen(p) + 1) {
+            if (cmd_argc == INPUT_ARG_MAX_NUM - 1) {
+                cmd_argc = -1;
+                break;
+            }
+            cmd_argv[cmd_argc++] = p;
+        }
+        if (cmd_argc == -1) {
+            break;
+        }
+        cmd_argv[cmd_argc] = NULL;
+
+        process_args(cmd_argc, cmd_argv, group_list_addr);
+        out_reset(&discard);
+        (*records)++;
+        offset += sizeof(record) + record.length;
+    }
+    out_capture(NULL);
+    out_free(&discard);
+    return offset;
+}
+
+/* Open the log at path, creating it if needed, replay it into
+* group_list_addr and start logging in the given mode. Fills in stats (which
+* may be NULL). Returns 0, -1 if the log cannot be opened and -2 if the file
+* is not a write-ahead log.
+*/
+int wal_open(const char *path, enum wal_mode wal_mode, long wal_window_us,
+             Group **group_list_addr, struct wal_replay_stats *stats) {
+    struct wal_header header;
+    struct stat st;
+    size_t records = 0;
+    size_t truncated = 0;
+
+    crc_init();
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, sizeof(WAL_MAGIC));
+    header.version = WAL_VERSION;
+    header.byte_order = WAL_BYTE_ORDER;
+
+    size_t size = (size_t) st.st_size;
+    if (size < sizeof(header)) {
+        // New log, or one that crashed before its header was complete
+        char existing[sizeof(header)];
+        if (pread(fd, existing, size, 0) != (ssize_t) size) {
+            close(fd);
+            return -1;
+        }
+        if (memcmp(existing, &header, size) != 0) {
+            close(fd);
+            return -2;
+        }
+        if (ftruncate(fd, 0) == -1 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+            fsync(fd) == -1) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        // A private writable mapping gives process_args arguments it may write to
+        char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        if (memcmp(data, &header, sizeof(header)) != 0) {
+            munmap(data, size);
+            close(fd);
+            return -2;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+        replaying = 1;
+        size_t end = replay(data, size, group_list_addr, &records);
+        replaying = 0;
+        munmap(data, size);
+
+        if (end < size) {
+            truncated = size - end;
+            if (ftruncate(fd, end) == -1 || fsync(fd) == -1) {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+    if (lseek(fd, 0, SEEK_END) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    wal_fd = fd;
+    mode = wal_mode;
+    window_us = wal_window_us;
+    if (mode != WAL_SYNC) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&wake, &attr);
+        pthread_cond_init(&drained, &attr);
+        pthread_condattr_destroy(&attr);
+
+        buffer_reserve(&buffers[0], WAL_BUFFER_SIZE);
+        buffer_reserve(&buffers[1], WAL_BUFFER_SIZE);
+        active = &buffers[0];
+        closing = 0;
+        if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0) {
+            perror("Error starting write-ahead log flusher. Exiting...");
+            exit(1);
+        }
+    }
+
+    if (stats != NULL) {
+        stats->records = records;
+        stats->truncated_bytes = truncated;
+    }
+    return 0;
+}
+
+/* Log a command that has just changed state. Does nothing if no log is open
+* or the command is itself being replayed from the log. Safe to call from any
+* thread.
+*/
+void wal_append(int cmd_argc, char **cmd_argv) {
+    if (wal_fd == -1 || replaying) {
+        return;
+    }
+    size_t size = record_size(cmd_argc, cmd_argv);
+
+    pthread_mutex_lock(&lock);
+    if (mode == WAL_SYNC) {
+        scratch.used = 0;
+        buffer_reserve(&scratch, size);
+        encode_record(&scratch, cmd_argc, cmd_argv);
+        write_all(scratch.data, scratch.used);
+        sync_log();
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    while (active->used > 0 && active->used + size > active->capacity) {
+        // Both buffers are busy; wait for the flusher to take this one
+        pthread_cond_signal(&wake);
+        pthread_cond_wait(&drained, &lock);
+    }
+    buffer_reserve(active, size); // Only grows for a record bigger than a whole buffer
+    int started = active->used == 0;
+    encode_record(active, cmd_argc, cmd_argv);
+    if (started || active->used >= WAL_FLUSH_THRESHOLD) {
+        pthread_cond_signal(&wake);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Empty the log after the whole state has been saved to or loaded from a
+* snapshot, so that a restart from that snapshot does not replay commands it
+* already holds. Records still buffered are dropped too, as they are in the
+* snapshot; a batch the flusher is writing is waited for, so that it does not
+* land after the cut. Must be called with no command running alongside.
+* Returns 0, or -1 if the log cannot be truncated.
+*/
+int wal_checkpoint(void) {
+    if (wal_fd == -1 || replaying) {
+        return 0;
+    }
+    pthread_mutex_lock(&lock);
+    if (mode != WAL_SYNC) {
+        struct wal_buffer *batch = active == &buffers[0] ? &buffers[1] : &buffers[0];
+        active->used = 0;
+        while (batch->used > 0) {
+            pthread_cond_wait(&drained, &lock);
+        }
+    }
+    int result = 0;
+    if (ftruncate(wal_fd, sizeof(struct wal_header)) == -1 ||
+        lseek(wal_fd, sizeof(struct wal_header), SEEK_SET) == -1 || fsync(wal_fd) == -1) {
+        result = -1;
+    }
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+/* Whether wal_append would log anything right now.
+*/
+int wal_enabled(void) {
+    return wal_fd != -1 && !replaying;
+}
+
+/* Write and sync everything still buffered, stop the flusher and close the
+* log.
+*/
+void wal_close(void) {
+    if (wal_fd == -1) {
+        return;
+    }
+    if (mode != WAL_SYNC) {
+        pthread_mutex_lock(&lock);
+        closing = 1;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(flusher, NULL);
+        pthread_cond_destroy(&wake);
+        pthread_cond_destroy(&drained);
+        for (int i = 0; i < 2; i++) {
+            free(buffers[i].data);
+            buffers[i].data = NULL;
+            buffers[i].used = buffers[i].capacity = 0;
+        }
+    }
+    sync_log();
+    close(wal_fd);
+    wal_fd = -1;
+    free(scratch.data);
+    scratch.data = NULL;
+    scratch.used = scratch.capacity = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include "lists.h"
+
+/* Write-ahead log of the commands that change state (add_group, add_user,
+* remove_user and add_xct).
+*
+* Each successful command is appended as one checksummed record. On startup
+* the log is replayed on top of whatever --snapshot loaded, and a torn or
+* corrupt tail left by a crash is cut off before new records are appended.
+* save and load empty the log, so it only ever holds the commands since the
+* last snapshot written or read, and a restart must name that snapshot.
+*
+* The durability mode decides when records reach the disk:
+*   sync   every record is written and fdatasync'd before the next command.
+*   group  records collect in a buffer that a flusher thread writes and
+*          fdatasyncs as one batch at least every window microseconds, so a
+*          crash loses at most one window of commands.
+*   async  like group, but the flusher never syncs; records survive the
+*          process crashing but not the machine.
+*/
+
+#define WAL_VERSION 1
+#define WAL_DEFAULT_WINDOW_US 2000
+
+enum wal_mode {
+	WAL_SYNC,
+	WAL_GROUP,
+	WAL_ASYNC
+};
+
+struct wal_replay_stats {
+	size_t records;			// Records replayed
+	size_t truncated_bytes;		// Torn or corrupt tail cut off the log
+};
+
+int wal_parse_mode(const char *name, enum wal_mode *mode);
+int wal_open(const char *path, enum wal_mode mode, long window_us,
+	     Group **group_list_addr, struct wal_replay_stats *stats);
+void wal_append(int cmd_argc, char **cmd_argv);
+int wal_checkpoint(void);
+int wal_enabled(void);
+void wal_close(void);
+
+#endif
@@ -0,0 +1,254 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "workload.h"
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Set w to the default workload: 16 groups of 1000 users, one million
+* add_xct, a Zipf skew of 1 and the default mix.
+*/
+void workload_init(struct workload *w) {
+    memset(w, 0, sizeof(*w));
+    w->groups = 16;
+    w->users = 1000;
+    w->xcts = 1000000;
+    w->skew = 1.0;
+    w->seed = 1;
+    workload_set_mix(w, WORKLOAD_DEFAULT_MIX);
+}
+
+/* Set the mix from a list such as "add_xct=80,user_balance=20". Only group
+* commands that need no more than a workload op holds may appear (so no bulk
+* commands), and add_xct must have a weight, since the workload
+* ends after a number of them. Returns 0, or -1 if the list is malformed.
+*/
+int workload_set_mix(struct workload *w, const char *mix) {
+    unsigned weights[OP_COUNT];
+    memset(weights, 0, sizeof(weights));
+
+    const char *p = mix;
+    while (*p != '\0') {
+        const char *equals = strchr(p, '=');
+        if (equals == NULL || equals - p >= 32) {
+            return -1;
+        }
+        char name[32];
+        memcpy(name, p, equals - p);
+        name[equals - p] = '\0';
+
+        int op = OP_NONE;
+        for (int i = 0; i < OP_COUNT; i++) {
+            if ((commands[i].flags & CMD_GROUP) && commands[i].min_argc <= command_record_argc(i) && strcmp(commands[i].name, name) == 0) {
+                op = i;
+            }
+        }
+        char *end;
+        long weight = strtol(equals + 1, &end, 10);
+        if (op == OP_NONE || end == equals + 1 || weight < 0 || weight > 1000000 || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        weights[op] = (unsigned) weight;
+        p = *end == ',' ? end + 1 : end;
+    }
+    if (weights[OP_ADD_XCT] == 0) {
+        return -1;
+    }
+    memcpy(w->weights, weights, sizeof(weights));
+    return 0;
+}
+
+/* If argv[*i] is a workload option, apply it (moving *i past its value) and
+* return 1. Returns 0 for anything else and -1 for a bad value.
+*/
+int workload_option(struct workload *w, int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        return 0;
+    }
+    const char *option = argv[*i];
+    const char *value = argv[*i + 1];
+    char *end;
+
+    if (strcmp(option, "--mix") == 0) {
+        (*i)++;
+        return workload_set_mix(w, value) == -1 ? -1 : 1;
+    }
+    if (strcmp(option, "--skew") == 0) {
+        w->skew = strtod(value, &end);
+        (*i)++;
+        return end == value || *end != '\0' || !(w->skew >= 0 && w->skew <= 10) ? -1 : 1;
+    }
+
+    long number = strtol(value, &end, 10);
+    int bad = end == value || *end != '\0' || number < 1;
+    if (strcmp(option, "--groups") == 0) {
+        w->groups = (int) number;
+        bad = bad || number > 1000000;
+    } else if (strcmp(option, "--users") == 0) {
+        w->users = (int) number;
+        bad = bad || number > 10000000;
+    } else if (strcmp(option, "--xcts") == 0) {
+        w->xcts = number;
+        bad = bad || number >= UINT32_MAX;
+    } else if (strcmp(option, "--seed") == 0) {
+        w->seed = (uint64_t) number;
+    } else {
+        return 0;
+    }
+    (*i)++;
+    return bad ? -1 : 1;
+}
+
+void workload_usage(FILE *stream) {
+    fprintf(stream, "[--groups <n>] [--users <per group>] [--xcts <n>] [--skew <zipf exponent>] "
+            "[--seed <n>] [--mix <command>=<weight>,...]");
+}
+
+/* Get ready to generate w from the beginning.
+*/
+void workload_start(struct workload *w) {
+    free(w->cdf);
+    w->cdf = malloc(w->users * sizeof(double));
+    if (w->cdf == NULL) {
+        perror("Error allocating memory for workload. Exiting...");
+        exit(1);
+    }
+    double sum = 0;
+    for (int k = 0; k < w->users; k++) {
+        sum += 1.0 / pow(k + 1, w->skew);
+        w->cdf[k] = sum;
+    }
+    for (int k = 0; k < w->users; k++) {
+        w->cdf[k] /= sum;
+    }
+
+    w->total_weight = 0;
+    for (int i = 0; i < OP_COUNT; i++) {
+        w->total_weight += w->weights[i];
+    }
+    // xorshift never leaves zero, so mix the seed into a non-zero state
+    w->rng = (w->seed + 1) * 0x9e3779b97f4a7c15ull;
+    w->setup_done = 0;
+    w->xcts_done = 0;
+    w->readd_group = -1;
+}
+
+static int pick_user(struct workload *w) {
+    double u = (next_random(&w->rng) >> 11) * 0x1.0p-53;
+    int low = 0, high = w->users - 1;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (w->cdf[middle] < u) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* Generate the next command of w into op. Returns 1, or 0 once the workload
+* is over.
+*/
+int workload_next(struct workload *w, struct workload_op *op) {
+    op->user = -1;
+    op->value = 0;
+
+    long setup = (long) w->groups * (w->users + 1);
+    if (w->setup_done < setup) {
+        if (w->setup_done < w->groups) {
+            op->op = OP_ADD_GROUP;
+            op->group = (int) w->setup_done;
+        } else {
+            long k = w->setup_done - w->groups;
+            op->op = OP_ADD_USER;
+            op->group = (int) (k / w->users);
+            op->user = (int) (k % w->users);
+        }
+        w->setup_done++;
+        return 1;
+    }
+    if (w->readd_group >= 0) {
+        op->op = OP_ADD_USER;
+        op->group = w->readd_group;
+        op->user = w->readd_user;
+        w->readd_group = -1;
+        return 1;
+    }
+    if (w->xcts_done >= w->xcts) {
+        return 0;
+    }
+
+    unsigned r = (unsigned) (next_random(&w->rng) % w->total_weight);
+    op->op = 0;
+    while (r >= w->weights[op->op]) {
+        r -= w->weights[op->op];
+        op->op++;
+    }
+    int flags = commands[op->op].flags;
+    op->group = (int) (next_random(&w->rng) % w->groups);
+    if (flags & CMD_USER) {
+        op->user = pick_user(w);
+    }
+    if (op->op == OP_ADD_XCT) {
+        // Mostly payments, with one in five a refund
+        uint64_t bits = next_random(&w->rng);
+        op->value = (int64_t) (bits % 10000) + 1;
+        if ((bits >> 32) % 5 == 0) {
+            op->value = -op->value;
+        }
+        w->xcts_done++;
+    } else if (flags & CMD_COUNT) {
+        op->value = WORKLOAD_COUNT_VALUE;
+    } else if (op->op == OP_REMOVE_USER) {
+        w->readd_group = op->group;
+        w->readd_user = op->user;
+    }
+    return 1;
+}
+
+/* Print op as a line of a batch file.
+*/
+void workload_print(const struct workload_op *op, FILE *stream) {
+    int flags = commands[op->op].flags;
+
+    if (op->op == OP_ADD_GROUP) {
+        fprintf(stream, "add_group g%d\n", op->group);
+        return;
+    }
+    fprintf(stream, "%s g%d", commands[op->op].name, op->group);
+    if (op->user >= 0) {
+        fprintf(stream, " u%d", op->user);
+    }
+    if (flags & CMD_CENTS) {
+        uint64_t magnitude = op->value < 0 ? -(uint64_t) op->value : (uint64_t) op->value;
+        fprintf(stream, " %s%llu.%02llu", op->value < 0 ? "-" : "",
+                (unsigned long long) (magnitude / 100), (unsigned long long) (magnitude % 100));
+    } else if (flags & CMD_COUNT) {
+        fprintf(stream, " %lld", (long long) op->value);
+    }
+    fputc('\n', stream);
+}
+
+/* Print the mix of w in the form workload_set_mix reads.
+*/
+void workload_print_mix(const struct workload *w, FILE *stream) {
+    const char *separator = "";
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (w->weights[i] > 0) {
+            fprintf(stream, "%s%s=%u", separator, commands[i].name, w->weights[i]);
+            separator = ",";
+        }
+    }
+}
+
+void workload_free(struct workload *w) {
+    free(w->cdf);
+    w->cdf = NULL;
+}
@@ -0,0 +1,59 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "commands.h"
+
+/* Deterministic synthetic workloads, shared by buxgen (which prints them as a
+* batch file) and buxbench (which runs them and times every command).
+*
+* A workload first adds its groups ("g0", "g1", ...) and their users ("u0",
+* "u1", ...), then draws commands from the mix until it has generated its
+* quota of add_xct. Groups are picked uniformly; users follow a Zipf
+* distribution, so with skew s the user of rank k is picked in proportion to
+* 1 / k^s, and u0 is the hottest. Every remove_user is followed by an
+* add_user of the same user, so the set of users stays the same. The same
+* options and seed always give the same commands.
+*/
+
+#define WORKLOAD_COUNT_VALUE 10		// The count given to recent_xct, top_paid and user_xct
+#define WORKLOAD_DEFAULT_MIX "add_xct=500,user_balance=100,under_paid=50,recent_xct=50,rank=50," \
+	"top_paid=50,user_xct=50,remove_user=20,list_users=5,user_total=1,group_total=1,recompute_balances=1"
+
+struct workload_op {
+	int op;
+	int group;
+	int user;			// -1 for commands that take no user
+	int64_t value;			// Cents for add_xct, a count for listings
+};
+
+struct workload {
+	int groups;
+	int users;			// Per group
+	long xcts;			// add_xct commands to generate in all
+	double skew;			// Zipf exponent of user popularity; 0 is uniform
+	uint64_t seed;
+	unsigned weights[OP_COUNT];	// Relative frequency of each command in the mix
+
+	// Generation state
+	uint64_t rng;
+	double *cdf;			// cdf[k] = chance of picking one of the k + 1 hottest users
+	unsigned total_weight;
+	long setup_done;		// Setup commands generated so far
+	long xcts_done;
+	int readd_group;		// Group and user of a remove_user still to be undone, or -1
+	int readd_user;
+};
+
+void workload_init(struct workload *w);
+int workload_option(struct workload *w, int argc, char **argv, int *i);
+int workload_set_mix(struct workload *w, const char *mix);
+void workload_start(struct workload *w);
+int workload_next(struct workload *w, struct workload_op *op);
+void workload_print(const struct workload_op *op, FILE *stream);
+void workload_print_mix(const struct workload *w, FILE *stream);
+void workload_free(struct workload *w);
+void workload_usage(FILE *stream);
+
+#endif